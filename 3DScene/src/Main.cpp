@@ -160,6 +160,7 @@ int main(void)
 
     glm::mat4 projection = glm::perspective(45.0f, (GLfloat)900 / (GLfloat)800, 1.0f, 150.0f);
     glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0, 0, -5.0f));
+    int mvpLocation = glGetUniformLocation(shaderProgram, "mvp");  // Look it up once, not every frame
 
     // Render loop
     while (!glfwWindowShouldClose(window))
@@ -175,7 +176,7 @@ int main(void)
         glUseProgram(shaderProgram);
 
         glm::mat4 mvp = projection * camera.getViewMatrix() * model;
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "mvp"), 1, GL_FALSE, &mvp[0][0]);
+        glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, &mvp[0][0]);
 
         glDrawArrays(GL_TRIANGLES, 0, sizeof(data)/sizeof(float));
 
@@ -11,10 +11,19 @@
 #include "ShaderProgram.h"
 #include "Camera.h"
 #include "Constants.h"
+#include "GLState.h"
+#include "RenderQueue.h"
 
 const int WIDTH = 1200, HEIGHT = 1000;
+const float FAR = 50.0f;
 Camera camera(glm::vec3(0, 0.2f, 2.5f), glm::vec3(0, 1, 0));
 
+// Draws go through a queue sorted by pass, program and material. The skybox has a pass of its own after everything
+// opaque, where it only fills what's left at the far plane. Blended draws would go in a pass after that.
+enum Pass { OPAQUE_PASS, SKYBOX_PASS };
+enum ProgramId { REFLECT_PROGRAM, SKYBOX_PROGRAM };
+enum ObjectId { CUBE_OBJECT, SKYBOX_OBJECT };
+
 // ------------------- CALLBACKS -------------------
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
@@ -172,24 +181,30 @@ int main(void)
 
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
-    // Cube shader
-    unsigned int vShader = Shaders::createShader(GL_VERTEX_SHADER, "shaders/skybox.vert");
-    unsigned int fShader = Shaders::createShader(GL_FRAGMENT_SHADER, "shaders/skybox.frag");
-    unsigned int skyboxProgram = Shaders::createAndLinkProgram({ vShader, fShader });
-    glDeleteShader(vShader);
-    glDeleteShader(fShader);
-
     //  ----------------------------------------------
 
 
-    // Shader init
-    vShader = Shaders::createShader(GL_VERTEX_SHADER, "shaders/shader.vert");
-    fShader = Shaders::createShader(GL_FRAGMENT_SHADER, "shaders/shader.frag");
-    unsigned int program = Shaders::createAndLinkProgram({ vShader, fShader });
-    glDeleteShader(vShader);
-    glDeleteShader(fShader);
+    // Shader init, the skybox and cube programs are built together so neither waits on the other's compile.
+    std::vector<unsigned int> programs = Shaders::loadPrograms({
+        { { GL_VERTEX_SHADER, "shaders/skybox.vert" }, { GL_FRAGMENT_SHADER, "shaders/skybox.frag" } },
+        { { GL_VERTEX_SHADER, "shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "shaders/shader.frag" } } });
+    unsigned int skyboxProgram = programs[0];
+    unsigned int program = programs[1];
+
+    glm::mat4 projection = glm::perspective(45.0f, (float)WIDTH / (float)HEIGHT, 0.1f, FAR);
 
-    glm::mat4 projection = glm::perspective(45.0f, (float)WIDTH / (float)HEIGHT, 0.1f, 50.0f);
+    // Uniform locations don't change after linking, so look them up once.
+    int modelLocation = glGetUniformLocation(program, "model");
+    int mvpLocation = glGetUniformLocation(program, "mvp");
+    int cameraPosLocation = glGetUniformLocation(program, "cameraPos");
+    int skyboxMvpLocation = glGetUniformLocation(skyboxProgram, "mvp");
+
+    GLState glState;
+    RenderQueue queue;
+    auto beginPass = [&](unsigned int pass) {
+        // Skybox will have depth of 1.0, which fails with GL_LESS. GL_LEQUAL will pass.
+        glState.depthFunc(pass == SKYBOX_PASS ? GL_LEQUAL : GL_LESS);
+    };
 
     // Render loop
     while (!glfwWindowShouldClose(window))
@@ -202,29 +217,30 @@ int main(void)
         // Set view matrix
         camera.update(window);
 
+        glm::mat4 view = camera.getViewMatrix();
+
         // Cube
         glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0, 0.01f, 0));  // To avoid Z fighting
         model = glm::scale(model, glm::vec3(3.0f, 3.0f, 3.0f));
-        glm::mat4 mvp = projection * camera.getViewMatrix() * model;
-        glUseProgram(program);
-        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, &model[0][0]);
-        glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
-        glUniform3fv(glGetUniformLocation(program, "cameraPos"), 1, glm::value_ptr(camera.position));
-        glBindVertexArray(cubeVAO);
-        
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-
-        // SKYBOX RENDERED LAST
-        glm::mat4 skyboxView = glm::mat4(glm::mat3(camera.getViewMatrix()));
-        mvp = projection * skyboxView;
-        glUseProgram(skyboxProgram);
-        glUniformMatrix4fv(glGetUniformLocation(skyboxProgram, "mvp"), 1, GL_FALSE, &mvp[0][0]);
-        glBindVertexArray(skyboxVAO);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
-
-        glDepthFunc(GL_LEQUAL);  // Skybox will have depth of 1.0, which fails with GL_LESS. GL_LEQUAL will pass.
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glm::mat4 mvp = projection * view * model;
+        float cubeDepth = -(view * model[3]).z / FAR;
+
+        // Skybox, queued first but drawn last thanks to its pass
+        glm::mat4 skyboxMvp = projection * glm::mat4(glm::mat3(view));
+
+        queue.clear();
+        queue.submit(RenderQueue::opaqueKey(SKYBOX_PASS, SKYBOX_PROGRAM, 0, 1.0f), { skyboxProgram, skyboxVAO, cubemap, GL_TEXTURE_CUBE_MAP, 0, 36, SKYBOX_OBJECT });
+        queue.submit(RenderQueue::opaqueKey(OPAQUE_PASS, REFLECT_PROGRAM, 0, cubeDepth), { program, cubeVAO, cubemap, GL_TEXTURE_CUBE_MAP, 0, 36, CUBE_OBJECT });
+        queue.sort();
+        queue.execute(glState, beginPass, [&](DrawPacket const &packet) {
+            if (packet.object == CUBE_OBJECT) {
+                glUniformMatrix4fv(modelLocation, 1, GL_FALSE, &model[0][0]);
+                glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, &mvp[0][0]);
+                glUniform3fv(cameraPosLocation, 1, glm::value_ptr(camera.position));
+            }
+            else
+                glUniformMatrix4fv(skyboxMvpLocation, 1, GL_FALSE, &skyboxMvp[0][0]);
+        });
 
         glfwSwapBuffers(window);
     }
@@ -0,0 +1,130 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "GLState.h"
+
+// One glDrawArrays and what it needs bound. 'object' is the caller's, handed back before the draw for its uniforms.
+struct DrawPacket {
+	unsigned int program;
+	unsigned int vao;
+	unsigned int texture;  // 0 for none, bound to unit 0.
+	GLenum textureTarget;
+	int first, count;
+	unsigned int object;
+};
+
+/*
+* Draws are submitted as packets with a 64 bit sort key, radix sorted once the frame's packets are in, then run in
+* key order. The key decides the draw order, so it packs what's most expensive to switch into the top bits:
+*
+*   opaqueKey:  pass (4) | program (12) | material (16) | depth (24) | unused (8)
+*   blendedKey: pass (4) | far to near depth (24) | program (12) | material (16) | unused (8)
+*
+* Passes always run in order. Opaque draws are grouped by program then material (its textures), front to back inside
+* a group so early depth testing can skip hidden fragments. Blended draws have to be back to front to look right, so
+* depth comes before state for them. Program and material are the caller's small ids, not GL names.
+* Binds go through a GLState, so only what changes between neighbouring packets reaches GL.
+*/
+class RenderQueue {
+	struct Entry {
+		uint64_t key;
+		unsigned int packet;
+	};
+
+	std::vector<DrawPacket> packets;
+	std::vector<Entry> entries, scratch;
+
+	static uint64_t quantizeDepth(float depth) {
+		depth = std::min(std::max(depth, 0.0f), 1.0f);
+		return (uint64_t)(depth * 0xFFFFFF);
+	}
+
+public:
+	static const unsigned int MAX_PASSES = 16, MAX_PROGRAMS = 4096, MAX_MATERIALS = 65536;
+
+	// 'depth' is 0 at the near plane and 1 at the far one.
+	static uint64_t opaqueKey(unsigned int pass, unsigned int program, unsigned int material, float depth) {
+		return (uint64_t)(pass & 0xF) << 60 | (uint64_t)(program & 0xFFF) << 48 | (uint64_t)(material & 0xFFFF) << 32 |
+			quantizeDepth(depth) << 8;
+	}
+
+	static uint64_t blendedKey(unsigned int pass, unsigned int program, unsigned int material, float depth) {
+		return (uint64_t)(pass & 0xF) << 60 | (0xFFFFFF - quantizeDepth(depth)) << 36 | (uint64_t)(program & 0xFFF) << 24 |
+			(uint64_t)(material & 0xFFFF) << 8;
+	}
+
+	static unsigned int passOf(uint64_t key) {
+		return (unsigned int)(key >> 60);
+	}
+
+	void clear() {
+		packets.clear();
+		entries.clear();
+	}
+
+	void submit(uint64_t key, DrawPacket const &packet) {
+		entries.push_back({ key, (unsigned int)packets.size() });
+		packets.push_back(packet);
+	}
+
+	size_t size() const {
+		return packets.size();
+	}
+
+	// LSD radix sort on the keys, a byte at a time. Stable, so packets with equal keys keep their submission order.
+	// Bytes that are the same in every key (the unused one, passes when there's only one) are skipped.
+	void sort() {
+		size_t count = entries.size();
+		scratch.resize(count);
+
+		size_t histograms[8][256] = {};
+		for (Entry const &entry : entries)
+			for (int byte = 0; byte < 8; byte++)
+				histograms[byte][(entry.key >> (byte * 8)) & 0xFF]++;
+
+		Entry *from = entries.data(), *to = scratch.data();
+		for (int byte = 0; byte < 8; byte++) {
+			size_t *histogram = histograms[byte];
+			if (count == 0 || histogram[(from[0].key >> (byte * 8)) & 0xFF] == count)
+				continue;
+
+			size_t offset = 0;
+			for (int digit = 0; digit < 256; digit++) {
+				size_t n = histogram[digit];
+				histogram[digit] = offset;
+				offset += n;
+			}
+			for (size_t i = 0; i < count; i++)
+				to[histogram[(from[i].key >> (byte * 8)) & 0xFF]++] = from[i];
+			std::swap(from, to);
+		}
+		if (from != entries.data())
+			entries.swap(scratch);
+	}
+
+	// Runs the packets in their current order, sort() first for key order. onPass(pass) is called before the first
+	// packet of each pass, to set its state (blending, depth func). beforeDraw(packet) is called once its program
+	// and VAO are bound, for its uniforms.
+	template <typename OnPass, typename BeforeDraw>
+	void execute(GLState &state, OnPass onPass, BeforeDraw beforeDraw) {
+		unsigned int pass = MAX_PASSES;
+		for (Entry const &entry : entries) {
+			if (passOf(entry.key) != pass) {
+				pass = passOf(entry.key);
+				onPass(pass);
+			}
+			DrawPacket const &packet = packets[entry.packet];
+			state.useProgram(packet.program);
+			state.bindVertexArray(packet.vao);
+			if (packet.texture != 0)
+				state.bindTexture(0, packet.texture, packet.textureTarget);
+			beforeDraw(packet);
+			glDrawArrays(GL_TRIANGLES, packet.first, packet.count);
+		}
+	}
+};
+
+#endif
@@ -10,8 +10,13 @@ uniform float far;
 out vec4 fragCol;
 
 void main() {
+#ifdef LINEAR_DEPTH
 	float zNdc = gl_FragCoord.z * 2.0 - 1.0;
 	float linearDepth = (2.0 * far * near) / (zNdc * (far - near) - (far + near));
 	float normalized = (linearDepth + near) / (near - far);
 	fragCol = vec4(vec3(normalized), 1.0);
+#else
+	// Straight out of the depth buffer, most of the range is bunched up near the camera.
+	fragCol = vec4(vec3(gl_FragCoord.z), 1.0);
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,172 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_SSE
+#include <emmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+/*
+* View frustum culling. Planes come straight out of a matrix, so projection * view gives world space planes and
+* a full mvp gives planes in the model's own space, where its bounding boxes already are.
+*/
+struct Frustum {
+	glm::vec4 planes[6];  // xyz = normal pointing inwards, w = distance. A point p is inside when dot(xyz, p) + w >= 0.
+
+	// Gribb & Hartmann: each clip space plane is a row of the matrix added to or subtracted from the last row.
+	static Frustum fromMatrix(glm::mat4 const &m) {
+		glm::vec4 rows[4];
+		for (int r = 0; r < 4; r++)
+			rows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+
+		Frustum frustum;
+		for (int axis = 0; axis < 3; axis++) {
+			frustum.planes[axis * 2] = rows[3] + rows[axis];
+			frustum.planes[axis * 2 + 1] = rows[3] - rows[axis];
+		}
+
+		// Normalized so the plane distances are real distances, which the sphere test needs.
+		for (glm::vec4 &plane : frustum.planes)
+			plane /= glm::length(glm::vec3(plane));
+		return frustum;
+	}
+
+	bool containsSphere(glm::vec3 centre, float radius) const {
+		for (const glm::vec4 &plane : planes)
+			if (glm::dot(glm::vec3(plane), centre) + plane.w < -radius)
+				return false;
+		return true;
+	}
+
+	// A box is out once it's entirely behind one plane: its corner furthest along the normal is still behind it.
+	bool containsBox(glm::vec3 centre, glm::vec3 extents) const {
+		for (const glm::vec4 &plane : planes) {
+			glm::vec3 normal(plane);
+			float reach = std::fabs(normal.x) * extents.x + std::fabs(normal.y) * extents.y + std::fabs(normal.z) * extents.z;
+			if (glm::dot(normal, centre) + plane.w < -reach)
+				return false;
+		}
+		return true;
+	}
+};
+
+/*
+* Axis aligned boxes as centre/extents in structure of arrays form, so the SIMD kernels read 4 or 8 boxes per load.
+* The arrays are padded to a multiple of 8 with boxes that are always culled, so the kernels never need a tail loop.
+*/
+struct BoxList {
+	std::vector<float> cx, cy, cz, ex, ey, ez;
+	unsigned int count = 0;
+
+	void add(glm::vec3 centre, glm::vec3 extents) {
+		if (count % 8 == 0) {
+			// An empty box infinitely far away along every axis fails any frustum.
+			for (std::vector<float> *axis : { &cx, &cy, &cz })
+				axis->resize(count + 8, 1e30f);
+			for (std::vector<float> *axis : { &ex, &ey, &ez })
+				axis->resize(count + 8, 0.0f);
+		}
+		cx[count] = centre.x; cy[count] = centre.y; cz[count] = centre.z;
+		ex[count] = extents.x; ey[count] = extents.y; ez[count] = extents.z;
+		count++;
+	}
+
+	void clear() {
+		cx.clear(); cy.clear(); cz.clear();
+		ex.clear(); ey.clear(); ez.clear();
+		count = 0;
+	}
+};
+
+namespace Culling {
+	// Writes the index of every box in [begin, end) touching the frustum to 'visible' (room for end - begin), returns
+	// how many. 'begin' has to be a multiple of 8 and 'end' one too or boxes.count, so the SIMD loads stay in range.
+	unsigned int cullScalar(Frustum const &frustum, BoxList const &boxes, unsigned int begin, unsigned int end, unsigned int *visible) {
+		unsigned int visibleCount = 0;
+		for (unsigned int i = begin; i < end; i++)
+			if (frustum.containsBox(glm::vec3(boxes.cx[i], boxes.cy[i], boxes.cz[i]), glm::vec3(boxes.ex[i], boxes.ey[i], boxes.ez[i])))
+				visible[visibleCount++] = i;
+		return visibleCount;
+	}
+
+#ifdef FRUSTUM_SSE
+	unsigned int cullSSE(Frustum const &frustum, BoxList const &boxes, unsigned int begin, unsigned int end, unsigned int *visible) {
+		unsigned int visibleCount = 0;
+		for (unsigned int i = begin; i < end; i += 4) {
+			__m128 cx = _mm_loadu_ps(&boxes.cx[i]), cy = _mm_loadu_ps(&boxes.cy[i]), cz = _mm_loadu_ps(&boxes.cz[i]);
+			__m128 ex = _mm_loadu_ps(&boxes.ex[i]), ey = _mm_loadu_ps(&boxes.ey[i]), ez = _mm_loadu_ps(&boxes.ez[i]);
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (const glm::vec4 &plane : frustum.planes) {
+				// dot(normal, centre) + w + dot(|normal|, extents) >= 0 for 4 boxes at once.
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				__m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::fabs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(std::fabs(plane.y)))),
+					_mm_mul_ps(ez, _mm_set1_ps(std::fabs(plane.z))));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			for (; mask; mask &= mask - 1) {
+				unsigned int bit = 0;
+				while (!(mask & (1 << bit)))
+					bit++;
+				visible[visibleCount++] = i + bit;
+			}
+		}
+		return visibleCount;
+	}
+#endif
+
+#ifdef __AVX__
+	unsigned int cullAVX(Frustum const &frustum, BoxList const &boxes, unsigned int begin, unsigned int end, unsigned int *visible) {
+		unsigned int visibleCount = 0;
+		for (unsigned int i = begin; i < end; i += 8) {
+			__m256 cx = _mm256_loadu_ps(&boxes.cx[i]), cy = _mm256_loadu_ps(&boxes.cy[i]), cz = _mm256_loadu_ps(&boxes.cz[i]);
+			__m256 ex = _mm256_loadu_ps(&boxes.ex[i]), ey = _mm256_loadu_ps(&boxes.ey[i]), ez = _mm256_loadu_ps(&boxes.ez[i]);
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (const glm::vec4 &plane : frustum.planes) {
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)), _mm256_mul_ps(cy, _mm256_set1_ps(plane.y))),
+					_mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+				__m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(std::fabs(plane.x))), _mm256_mul_ps(ey, _mm256_set1_ps(std::fabs(plane.y)))),
+					_mm256_mul_ps(ez, _mm256_set1_ps(std::fabs(plane.z))));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+
+			int mask = _mm256_movemask_ps(inside);
+			for (; mask; mask &= mask - 1) {
+				unsigned int bit = 0;
+				while (!(mask & (1 << bit)))
+					bit++;
+				visible[visibleCount++] = i + bit;
+			}
+		}
+		return visibleCount;
+	}
+#endif
+
+	// The widest kernel this build has.
+	unsigned int cull(Frustum const &frustum, BoxList const &boxes, unsigned int begin, unsigned int end, unsigned int *visible) {
+#if defined(__AVX__)
+		return cullAVX(frustum, boxes, begin, end, visible);
+#elif defined(FRUSTUM_SSE)
+		return cullSSE(frustum, boxes, begin, end, visible);
+#else
+		return cullScalar(frustum, boxes, begin, end, visible);
+#endif
+	}
+
+	// Every box.
+	unsigned int cull(Frustum const &frustum, BoxList const &boxes, unsigned int *visible) {
+		return cull(frustum, boxes, 0, boxes.count, visible);
+	}
+}
+
+#endif
@@ -9,15 +9,19 @@
 #include "ShaderProgram.h"
 #include "Texture.h"
 #include "Camera.h"
+#include "Frustum.h"
 
 const int WIDTH = 800, HEIGHT = 600;
 Camera camera(glm::vec3(0, 0.2f, 2.5f), glm::vec3(0, 1, 0));
+bool linearDepth = true;  // L toggles between linearized and raw depth
 
 // ------------------- CALLBACKS -------------------
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
+    if (key == GLFW_KEY_L && action == GLFW_PRESS)
+        linearDepth = !linearDepth;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
@@ -145,23 +149,27 @@ int main(void)
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    // Shader init
-    unsigned int vShader = Shaders::createShader(GL_VERTEX_SHADER, "shaders/shader.vert");
-    unsigned int fShader = Shaders::createShader(GL_FRAGMENT_SHADER, "shaders/shader.frag");
-    unsigned int program = Shaders::createAndLinkProgram({ vShader, fShader });
-    glDeleteShader(vShader);
-    glDeleteShader(fShader);
+    // Shader init, both variants from shaders/shader.variants are built up front so toggling doesn't hitch
+    Shaders::Variants shaderVariants({ { GL_VERTEX_SHADER, "shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "shaders/shader.frag" } });
+    shaderVariants.prepare("shaders/shader.variants");
 
     //Texture init
     unsigned int marbleTexture = Texture::load("assets/marble.jpg", GL_RGB);
     unsigned int metalTexture = Texture::load("assets/metal.png", GL_RGB);
-    glUseProgram(program);
-    glUniform1i(glGetUniformLocation(program, "tex"), 0);
 
     float far = 30.0f, near = 0.1f;
     glm::mat4 projection = glm::perspective(45.0f, (float)WIDTH / (float)HEIGHT, near, far);
-    glUniform1f(glGetUniformLocation(program, "near"), near);
-    glUniform1f(glGetUniformLocation(program, "far"), far);
+
+    // Uniforms that never change are set once per variant. Index 1 is LINEAR_DEPTH.
+    unsigned int programs[2] = { shaderVariants.get({}), shaderVariants.get({ "LINEAR_DEPTH" }) };
+    int mvpLocations[2];  // Look them up once, not every draw
+    for (int v = 0; v < 2; v++) {
+        glUseProgram(programs[v]);
+        glUniform1i(glGetUniformLocation(programs[v], "tex"), 0);
+        glUniform1f(glGetUniformLocation(programs[v], "near"), near);
+        glUniform1f(glGetUniformLocation(programs[v], "far"), far);
+        mvpLocations[v] = glGetUniformLocation(programs[v], "mvp");
+    }
 
     // Render loop
     while (!glfwWindowShouldClose(window))
@@ -174,35 +182,39 @@ int main(void)
         // Set view matrix
         camera.update(window);
 
+        unsigned int program = programs[linearDepth];
+        int mvpLocation = mvpLocations[linearDepth];
         glUseProgram(program);
 
-        // Cube 1
-        glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(-1.5f, 0.01f, -2.0f));
-        glm::mat4 mvp = projection * camera.getViewMatrix() * model;
-        glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
+        // Anything whose box is outside the view isn't drawn. The cubes are only translated, so their boxes stay axis aligned.
+        glm::mat4 viewProjection = projection * camera.getViewMatrix();
+        Frustum frustum = Frustum::fromMatrix(viewProjection);
+        glm::vec3 cubePositions[] = { glm::vec3(-1.5f, 0.01f, -2.0f), glm::vec3(2.0f, 0.01f, 1.5f) };
+
+        // Cubes
         glBindVertexArray(cubeVAO);
         glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
         
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, marbleTexture);
-        glDrawArrays(GL_TRIANGLES, 0, sizeof(cubeVerts) / sizeof(float));
-
-        // Cube 2
-        model = glm::translate(glm::mat4(1.0f), glm::vec3(2.0f, 0.01f, 1.5f));
-        mvp = projection * camera.getViewMatrix() * model;
-        glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
-
-        glDrawArrays(GL_TRIANGLES, 0, sizeof(cubeVerts) / sizeof(float));
+        for (glm::vec3 const &position : cubePositions) {
+            if (!frustum.containsBox(position, glm::vec3(0.5f)))
+                continue;
+            glm::mat4 mvp = viewProjection * glm::translate(glm::mat4(1.0f), position);
+            glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, &mvp[0][0]);
+            glDrawArrays(GL_TRIANGLES, 0, sizeof(cubeVerts) / sizeof(float));
+        }
 
         // Plane
-        mvp = projection * camera.getViewMatrix();
-        glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
-        glBindVertexArray(planeVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, metalTexture);
-        glDrawArrays(GL_TRIANGLES, 0, sizeof(planeVerts) / sizeof(float));
+        if (frustum.containsBox(glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(5.0f, 0.0f, 5.0f))) {
+            glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, &viewProjection[0][0]);
+            glBindVertexArray(planeVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, metalTexture);
+            glDrawArrays(GL_TRIANGLES, 0, sizeof(planeVerts) / sizeof(float));
+        }
 
         glfwSwapBuffers(window);
     }
@@ -66,12 +66,7 @@ int main(void)
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); 
     // Create our shaders
-    unsigned int vertexShader = Shaders::createShader(GL_VERTEX_SHADER, "shaders/shader.vert");
-    unsigned int fragmentShader = Shaders::createShader(GL_FRAGMENT_SHADER, "shaders/shader.frag");
-
-    unsigned int program = Shaders::createAndLinkProgram({ vertexShader, fragmentShader });
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    unsigned int program = Shaders::loadProgram({ { GL_VERTEX_SHADER, "shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "shaders/shader.frag" } });
 
     // Render loop
     while (!glfwWindowShouldClose(window))
@@ -9,7 +9,9 @@
 #include "ShaderProgram.h"
 #include "Texture.h"
 #include "Camera.h"
+#include "Frustum.h"
 #include "Constants.h"
+#include "GLState.h"
 
 const int WIDTH = 1200, HEIGHT = 1000;
 Camera camera(glm::vec3(0, 0.2f, 2.5f), glm::vec3(0, 1, 0));
@@ -25,6 +27,9 @@ unsigned int marbleTexture, metalTexture;
 
 // Shaders
 unsigned int program, quadProgram;
+int mvpLocation;
+
+GLState glState;  // Binds and toggles go through this, it drops the ones that are already set.
 
 // ------------------- CALLBACKS -------------------
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -46,26 +51,27 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 
 
 void drawScene() {
-    glUseProgram(program);
+    glState.useProgram(program);
+    glm::mat4 viewProjection = projection * camera.getViewMatrix();
+    Frustum frustum = Frustum::fromMatrix(viewProjection);  // Anything whose box is outside the view isn't drawn.
 
     // Cube
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0, 0.01f, 0));  // To avoid Z fighting
-    glm::mat4 mvp = projection * camera.getViewMatrix() * model;
-    glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
-    glBindVertexArray(cubeVAO);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, marbleTexture);
-    glDrawArrays(GL_TRIANGLES, 0, sizeof(Constants::cubeVerts) / sizeof(float));
+    glm::vec3 cubePosition(0, 0.01f, 0);  // To avoid Z fighting
+    if (frustum.containsBox(cubePosition, glm::vec3(0.5f))) {
+        glm::mat4 mvp = viewProjection * glm::translate(glm::mat4(1.0f), cubePosition);
+        glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, &mvp[0][0]);
+        glState.bindVertexArray(cubeVAO);
+        glState.bindTexture(0, marbleTexture);
+        glDrawArrays(GL_TRIANGLES, 0, sizeof(Constants::cubeVerts) / sizeof(float));
+    }
 
     // Plane
-    mvp = projection * camera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
-    glBindVertexArray(planeVAO);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, metalTexture);
-    glDrawArrays(GL_TRIANGLES, 0, sizeof(Constants::planeVerts) / sizeof(float));
+    if (frustum.containsBox(glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(5.0f, 0.0f, 5.0f))) {
+        glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, &viewProjection[0][0]);
+        glState.bindVertexArray(planeVAO);
+        glState.bindTexture(0, metalTexture);
+        glDrawArrays(GL_TRIANGLES, 0, sizeof(Constants::planeVerts) / sizeof(float));
+    }
 }
 
 
@@ -130,17 +136,14 @@ int main(void)
     glBindVertexArray(0);
 
     // Shader init
-    unsigned int vShader = Shaders::createShader(GL_VERTEX_SHADER, "shaders/shader.vert");
-    unsigned int fShader = Shaders::createShader(GL_FRAGMENT_SHADER, "shaders/shader.frag");
-    program = Shaders::createAndLinkProgram({ vShader, fShader });
-    glDeleteShader(vShader);
-    glDeleteShader(fShader);
+    program = Shaders::loadProgram({ { GL_VERTEX_SHADER, "shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "shaders/shader.frag" } });
 
     //Texture init
     marbleTexture = Texture::load("assets/marble.jpg", GL_RGB);
     metalTexture = Texture::load("assets/metal.png", GL_RGB);
     glUseProgram(program);
     glUniform1i(glGetUniformLocation(program, "tex"), 0);
+    mvpLocation = glGetUniformLocation(program, "mvp");  // Look it up once, not every draw
 
 
     // ------- FRAMEBUFFER STUFF ---------
@@ -205,11 +208,7 @@ int main(void)
     glEnableVertexAttribArray(1);
 
     // Create shaders to render FBO quad, just rendering a quad nothing fancy
-    unsigned int vQuadShader = Shaders::createShader(GL_VERTEX_SHADER, "shaders/quad.vert");
-    unsigned int fQuadShader = Shaders::createShader(GL_FRAGMENT_SHADER, "shaders/quad.frag");
-    quadProgram = Shaders::createAndLinkProgram({ vQuadShader, fQuadShader });
-    glDeleteShader(vQuadShader);
-    glDeleteShader(fQuadShader);
+    quadProgram = Shaders::loadProgram({ { GL_VERTEX_SHADER, "shaders/quad.vert" }, { GL_FRAGMENT_SHADER, "shaders/quad.frag" } });
 
     glUseProgram(quadProgram);
     glUniform1i(glGetUniformLocation(quadProgram, "tex"), 0);
@@ -230,7 +229,7 @@ int main(void)
         glBindFramebuffer(GL_FRAMEBUFFER, FBO);
         glClearColor(0.06f, 0.07f, 0.08f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_DEPTH_TEST);
+        glState.enable(GL_DEPTH_TEST);
         drawScene();
 
         //Draw the texture with our scene on it to a quad (Second RENDER pass)
@@ -239,11 +238,10 @@ int main(void)
         glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
         
-        glUseProgram(quadProgram);
-        glBindVertexArray(quadVAO);
-        glDisable(GL_DEPTH_TEST);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        glState.useProgram(quadProgram);
+        glState.bindVertexArray(quadVAO);
+        glState.disable(GL_DEPTH_TEST);
+        glState.bindTexture(0, texture);
         glDrawArrays(GL_TRIANGLES, 0, sizeof(quadVerts) / sizeof(float));
 
         glfwSwapBuffers(window);
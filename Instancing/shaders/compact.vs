@@ -0,0 +1,36 @@
+#version 330 core
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inCol;
+layout (location = 2) in vec3 instancePosition;
+layout (location = 3) in ivec3 instanceRotation;  // Smallest three quaternion components, see Transforms::CompactInstance
+layout (location = 4) in float instanceScale;
+
+out vec3 color;
+
+uniform mat4 viewProjection;
+
+vec4 decodeRotation(ivec3 packed) {
+	int largest = (packed.x & 1) | ((packed.y & 1) << 1);
+	vec3 small = vec3(packed >> 1) * (0.70710678 / 16383.0);
+	float rebuilt = sqrt(max(1.0 - dot(small, small), 0.0));
+	if (largest == 0)
+		return vec4(rebuilt, small);
+	if (largest == 1)
+		return vec4(small.x, rebuilt, small.yz);
+	if (largest == 2)
+		return vec4(small.xy, rebuilt, small.z);
+	return vec4(small, rebuilt);
+}
+
+// Same result as the rotation part of the matrix Transforms::compose builds.
+vec3 rotate(vec4 q, vec3 v) {
+	return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main() {
+	vec4 rotation = decodeRotation(instanceRotation);
+	vec3 position = instancePosition + rotate(rotation, inPos * instanceScale);
+	gl_Position = viewProjection * vec4(position, 1.0);
+	color = inCol;
+}
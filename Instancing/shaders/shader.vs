@@ -9,9 +9,10 @@ layout (location = 5) in vec4 model_row4;
 
 out vec3 color;
 
+uniform mat4 viewProjection;
 
 void main() {
 	mat4 model = mat4(model_row1, model_row2, model_row3, model_row4);
-	gl_Position = model * vec4(inPos, 1.0);
+	gl_Position = viewProjection * model * vec4(inPos, 1.0);
 	color = inCol;
 }
\ No newline at end of file
@@ -0,0 +1,382 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "Constants.h"
+#include "Frustum.h"
+#include "InstanceCuller.h"
+#include "StreamingBuffer.h"
+#include "Timer.h"
+#include "Transforms.h"
+#include "Jobs.h"
+#include "Utils.h"
+
+/*
+* Benchmarks for the instancing sample, run with 'Instancing --bench <name>' once a GL context exists.
+*/
+namespace Benchmark {
+    // 'count' quads on a square grid in the XZ plane one unit apart, each scaled to a unit across and stood up at a random angle.
+    Transforms::Store instanceGrid(unsigned int count) {
+        Transforms::Store store;
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+
+        unsigned int side = (unsigned int)std::ceil(std::sqrt((double)count));
+        for (unsigned int i = 0; i < count; i++) {
+            glm::vec3 position((float)(i % side) - side * 0.5f, 0.5f, (float)(i / side) - side * 0.5f);
+            store.add(position, Transforms::rotation(glm::vec3(0, 1, 0), glm::radians(angle(random))), glm::vec3(10.0f));
+        }
+        return store;
+    }
+
+    std::vector<glm::mat4> instanceMatrices(Transforms::Store const &store) {
+        std::vector<glm::mat4> matrices(store.size());
+        Transforms::compose(store, 0, store.size(), matrices.data());
+        return matrices;
+    }
+
+    // Draws all instances vs culling them on the CPU and uploading the survivors vs culling them in a compute pass,
+    // from 1k to 4M instances. The camera stands in the middle of the grid looking out, so most of it is behind or beside it.
+    void instanceCulling(int frames = 20) {
+        unsigned int program = Utils::loadProgram({ { GL_VERTEX_SHADER, "shaders/shader.vs" }, { GL_FRAGMENT_SHADER, "shaders/shader.fs" } });
+        int viewProjectionLocation = glGetUniformLocation(program, "viewProjection");
+
+        unsigned int quadVBO;
+        glGenBuffers(1, &quadVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Constants::quadVerts), Constants::quadVerts, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        std::cout << "Instance culling, ms per frame over " << frames << " frames (visible instances)" << std::endl;
+        for (unsigned int count = 1024; count <= 4 * 1024 * 1024; count *= 4) {
+            std::vector<glm::mat4> instances = instanceMatrices(instanceGrid(count));
+            float side = std::ceil(std::sqrt((float)count));
+            glm::mat4 projection = glm::perspective(glm::radians(45.0f), 900.0f / 800.0f, 0.1f, side);
+            glm::mat4 viewProjection = projection * glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 0.0f, side * 0.5f), glm::vec3(0, 1, 0));
+            Frustum frustum = Frustum::fromMatrix(viewProjection);
+
+            unsigned int allBuffer, cpuBuffer;
+            glGenBuffers(1, &allBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, allBuffer);
+            glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), instances.data(), GL_STATIC_DRAW);
+            glGenBuffers(1, &cpuBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, cpuBuffer);
+            glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            unsigned int allVAO = Instances::createQuadVAO(quadVBO, allBuffer), cpuVAO = Instances::createQuadVAO(quadVBO, cpuBuffer);
+
+            glUseProgram(program);
+            glUniformMatrix4fv(viewProjectionLocation, 1, GL_FALSE, &viewProjection[0][0]);
+            std::cout << "  " << count << " instances:" << std::endl;
+
+            // Everything, every frame.
+            glBindVertexArray(allVAO);
+            glFinish();
+            Timer timer;
+            for (int f = 0; f < frames; f++)
+                glDrawArraysInstanced(GL_TRIANGLES, 0, 6, count);
+            glFinish();
+            std::cout << "    no culling:  " << timer.elapsedMs() / frames << " ms (" << count << ")" << std::endl;
+
+            // CPU culls into a compacted array, which is uploaded over the last frame's (orphaned) buffer.
+            std::vector<glm::mat4> visible(count);
+            unsigned int visibleCount = 0;
+            double cullMs = 0;
+            glBindVertexArray(cpuVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, cpuBuffer);
+            glFinish();
+            timer.reset();
+            for (int f = 0; f < frames; f++) {
+                Timer cullTimer;
+                visibleCount = Instances::cull(frustum, instances.data(), count, Constants::quadRadius, visible.data());
+                cullMs += cullTimer.elapsedMs();
+                glBufferData(GL_ARRAY_BUFFER, (size_t)count * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+                glBufferSubData(GL_ARRAY_BUFFER, 0, (size_t)visibleCount * sizeof(glm::mat4), visible.data());
+                glDrawArraysInstanced(GL_TRIANGLES, 0, 6, visibleCount);
+            }
+            glFinish();
+            std::cout << "    CPU culling: " << timer.elapsedMs() / frames << " ms, " << cullMs / frames << " of it culling (" << visibleCount << ")" << std::endl;
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            // Compute pass straight into an indirect draw, the CPU only records two calls.
+            InstanceCuller culler;
+            if (culler.create(allBuffer, count, 6)) {
+                unsigned int gpuVAO = Instances::createQuadVAO(quadVBO, culler.visibleMatrices());
+                glFinish();
+                timer.reset();
+                for (int f = 0; f < frames; f++) {
+                    culler.cull(frustum, Constants::quadRadius);
+                    glUseProgram(program);
+                    glBindVertexArray(gpuVAO);
+                    culler.draw();
+                }
+                glFinish();
+                std::cout << "    GPU culling: " << timer.elapsedMs() / frames << " ms (" << culler.visibleCount() << ")" << std::endl;
+                glDeleteVertexArrays(1, &gpuVAO);
+                culler.destroy();
+            }
+            else
+                std::cout << "    GPU culling needs compute shaders (GL 4.3)" << std::endl;
+
+            glBindVertexArray(0);
+            glDeleteVertexArrays(1, &allVAO);
+            glDeleteVertexArrays(1, &cpuVAO);
+            glDeleteBuffers(1, &allBuffer);
+            glDeleteBuffers(1, &cpuBuffer);
+        }
+
+        glDeleteBuffers(1, &quadVBO);
+        glDeleteProgram(program);
+    }
+
+    /*
+    * A new frame of instance matrices every frame, uploaded three ways:
+    *  - glBufferSubData into the same buffer, which has to wait whenever the GPU is still reading it.
+    *  - Orphaning, glBufferData(NULL) first so the driver can hand out fresh memory, then glBufferSubData.
+    *  - StreamingBuffer, a memcpy straight into a mapped region the GPU is done with.
+    * Each frame draws the instances so the GPU really does read them. The view projection is all zeros, which puts every
+    * vertex on the same point: every matrix is still fetched, but there's no rasterizing to drown out the uploads.
+    */
+    void instanceStreaming(int frames = 200) {
+        unsigned int program = Utils::loadProgram({ { GL_VERTEX_SHADER, "shaders/shader.vs" }, { GL_FRAGMENT_SHADER, "shaders/shader.fs" } });
+
+        glm::mat4 viewProjection(0.0f);
+        glUseProgram(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "viewProjection"), 1, GL_FALSE, &viewProjection[0][0]);
+
+        unsigned int quadVBO;
+        glGenBuffers(1, &quadVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Constants::quadVerts), Constants::quadVerts, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        std::cout << "Instance matrix streaming over " << frames << " frames" << std::endl;
+        unsigned int counts[] = { 1024, 16384, 262144, 1048576 };
+        for (unsigned int count : counts) {
+            std::vector<glm::mat4> source = instanceMatrices(instanceGrid(count));
+            size_t bytes = (size_t)count * sizeof(glm::mat4);
+            std::cout << "  " << count << " instances (" << bytes / 1024 << " KB per frame):" << std::endl;
+
+            auto report = [&](const char *method, double ms) {
+                std::cout << "    " << method << ms / frames << " ms per frame, " << (double)bytes * frames / (ms * 1e6) << " GB/s" << std::endl;
+            };
+
+            unsigned int buffer;
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
+            unsigned int VAO = Instances::createQuadVAO(quadVBO, buffer);
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+            glFinish();
+            Timer timer;
+            for (int f = 0; f < frames; f++) {
+                glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, source.data());
+                glDrawArraysInstanced(GL_TRIANGLES, 0, 6, count);
+            }
+            glFinish();
+            report("glBufferSubData: ", timer.elapsedMs());
+
+            timer.reset();
+            for (int f = 0; f < frames; f++) {
+                glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
+                glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, source.data());
+                glDrawArraysInstanced(GL_TRIANGLES, 0, 6, count);
+            }
+            glFinish();
+            report("orphaning:       ", timer.elapsedMs());
+
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindVertexArray(0);
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &buffer);
+
+            StreamingBuffer stream;
+            if (stream.create(bytes)) {
+                VAO = Instances::createQuadVAO(quadVBO, stream.id());
+                glBindVertexArray(VAO);
+                glFinish();
+                timer.reset();
+                for (int f = 0; f < frames; f++) {
+                    std::memcpy(stream.begin(), source.data(), bytes);
+                    glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, 6, count, stream.offset() / sizeof(glm::mat4));
+                    stream.end();
+                }
+                glFinish();
+                report("persistent map:  ", timer.elapsedMs());
+                std::cout << "      waited on the GPU " << stream.stallCount() << " times" << std::endl;
+
+                glBindVertexArray(0);
+                glDeleteVertexArrays(1, &VAO);
+                stream.destroy();
+            }
+            else
+                std::cout << "    persistent map needs glBufferStorage (GL 4.4)" << std::endl;
+        }
+
+        glDeleteBuffers(1, &quadVBO);
+        glDeleteProgram(program);
+    }
+
+    // Matrices per second for a crowd of spinning instances: glm calls in a loop vs each compose kernel on one thread,
+    // then the widest kernel across a growing pool. It's all CPU, the matrices go to a plain array.
+    void transformComposition(unsigned int count = 1 << 20, int runs = 20) {
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> angle(0.0f, 6.2831853f), position(-500.0f, 500.0f), scale(0.5f, 2.0f);
+        std::vector<glm::vec3> positions(count), scales(count);
+        std::vector<float> angles(count);
+        Transforms::Store store;
+        for (unsigned int i = 0; i < count; i++) {
+            positions[i] = glm::vec3(position(random), 0.0f, position(random));
+            scales[i] = glm::vec3(scale(random));
+            angles[i] = angle(random);
+            store.add(positions[i], Transforms::rotation(glm::vec3(0, 1, 0), angles[i]), scales[i]);
+        }
+
+        std::vector<glm::mat4> reference(count), matrices(count);
+        auto report = [&](std::string const &name, double ms) {
+            std::cout << "  " << name << ": " << (double)count * runs / (ms * 1e3) << " M matrices/s" << std::endl;
+        };
+
+        std::cout << "Composing " << count << " instance matrices, " << runs << " runs" << std::endl;
+        Timer timer;
+        for (int r = 0; r < runs; r++) {
+            for (unsigned int i = 0; i < count; i++) {
+                glm::mat4 model = glm::translate(glm::mat4(1.0f), positions[i]);
+                model = glm::rotate(model, angles[i], glm::vec3(0, 1, 0));
+                reference[i] = glm::scale(model, scales[i]);
+            }
+        }
+        report("glm, 1 thread", timer.elapsedMs());
+
+        typedef void (*Kernel)(Transforms::Store const&, unsigned int, unsigned int, glm::mat4*);
+        std::vector<std::pair<std::string, Kernel>> kernels = { { "scalar", Transforms::composeScalar } };
+#ifdef TRANSFORMS_SSE
+        kernels.push_back({ "SSE", Transforms::composeSSE });
+#endif
+#ifdef __AVX__
+        kernels.push_back({ "AVX", Transforms::composeAVX });
+#endif
+        for (auto const &kernel : kernels) {
+            timer.reset();
+            for (int r = 0; r < runs; r++)
+                kernel.second(store, 0, count, matrices.data());
+            double ms = timer.elapsedMs();
+
+            // Quaternions and glm's axis angle matrices round differently, this should be down around 1e-4.
+            float maxDifference = 0.0f;
+            for (unsigned int i = 0; i < count; i++)
+                for (int c = 0; c < 4; c++)
+                    for (int e = 0; e < 4; e++)
+                        maxDifference = std::max(maxDifference, std::fabs(matrices[i][c][e] - reference[i][c][e]));
+            report(kernel.first + ", 1 thread (max difference from glm " + std::to_string(maxDifference) + ")", ms);
+        }
+
+        unsigned int maxThreads = Jobs::defaultThreads();
+        for (unsigned int threads = 2; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2) {
+            Jobs::Scheduler jobs(threads);
+            timer.reset();
+            for (int r = 0; r < runs; r++)
+                Transforms::compose(store, matrices.data(), jobs);
+            report("widest kernel, " + std::to_string(threads) + " threads", timer.elapsedMs());
+        }
+    }
+
+    /*
+    * A mat4 per instance vs a 20 byte CompactInstance, drawn straight from static buffers at 256k to 4M instances:
+    *  - Collapsed, the view projection is all zeros so nothing is rasterized and the time is the instance fetch and
+    *    the vertex shader, given as the bandwidth the instance data is read at.
+    *  - In view, from the middle of the grid like the culling benchmark, for the frame time a real view gets.
+    */
+    void instanceFormats(int frames = 20) {
+        const char *shaders[] = { "shaders/shader.vs", "shaders/compact.vs" };
+        unsigned int programs[2];
+        for (int f = 0; f < 2; f++)
+            programs[f] = Utils::loadProgram({ { GL_VERTEX_SHADER, shaders[f] }, { GL_FRAGMENT_SHADER, "shaders/shader.fs" } });
+
+        unsigned int quadVBO;
+        glGenBuffers(1, &quadVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Constants::quadVerts), Constants::quadVerts, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        std::cout << "Instance formats, ms per frame over " << frames << " frames" << std::endl;
+        for (unsigned int count = 256 * 1024; count <= 4 * 1024 * 1024; count *= 4) {
+            Transforms::Store store = instanceGrid(count);
+            std::vector<glm::mat4> matrices = instanceMatrices(store);
+            std::vector<Transforms::CompactInstance> compact(count);
+            Transforms::packCompact(store, 0, count, compact.data());
+
+            float side = std::ceil(std::sqrt((float)count));
+            glm::mat4 projection = glm::perspective(glm::radians(45.0f), 900.0f / 800.0f, 0.1f, side);
+            glm::mat4 views[2] = {
+                glm::mat4(0.0f),
+                projection * glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 0.0f, side * 0.5f), glm::vec3(0, 1, 0))
+            };
+
+            std::cout << "  " << count << " instances:" << std::endl;
+            for (int f = 0; f < 2; f++) {
+                InstanceFormat format = f == 0 ? MATRIX_INSTANCES : COMPACT_INSTANCES;
+                size_t bytes = format == MATRIX_INSTANCES ? matrices.size() * sizeof(glm::mat4) : compact.size() * sizeof(Transforms::CompactInstance);
+                const void *data = format == MATRIX_INSTANCES ? (const void*)matrices.data() : (const void*)compact.data();
+
+                unsigned int buffer;
+                glGenBuffers(1, &buffer);
+                glBindBuffer(GL_ARRAY_BUFFER, buffer);
+                glBufferData(GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                unsigned int VAO = Instances::createQuadVAO(quadVBO, buffer, format);
+
+                glUseProgram(programs[f]);
+                glBindVertexArray(VAO);
+                double ms[2];
+                for (int v = 0; v < 2; v++) {
+                    glUniformMatrix4fv(glGetUniformLocation(programs[f], "viewProjection"), 1, GL_FALSE, &views[v][0][0]);
+                    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, count);  // Warm up
+                    glFinish();
+                    Timer timer;
+                    for (int frame = 0; frame < frames; frame++)
+                        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, count);
+                    glFinish();
+                    ms[v] = timer.elapsedMs() / frames;
+                }
+
+                std::cout << "    " << (format == MATRIX_INSTANCES ? "mat4:    " : "compact: ") << bytes / count << " bytes each, collapsed " << ms[0] << " ms ("
+                    << bytes / (ms[0] * 1e6) << " GB/s of instance data), in view " << ms[1] << " ms" << std::endl;
+
+                glBindVertexArray(0);
+                glDeleteVertexArrays(1, &VAO);
+                glDeleteBuffers(1, &buffer);
+            }
+        }
+
+        glDeleteBuffers(1, &quadVBO);
+        for (unsigned int program : programs)
+            glDeleteProgram(program);
+    }
+
+    bool run(std::string const &name) {
+        if (name == "culling")
+            instanceCulling();
+        else if (name == "streaming")
+            instanceStreaming();
+        else if (name == "transforms")
+            transformComposition();
+        else if (name == "formats")
+            instanceFormats();
+        else {
+            std::cout << "Unknown benchmark '" << name << "'" << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+#endif
@@ -10,6 +10,9 @@ namespace Constants {
 		-0.05f,  0.05f, 0.0f,	1.0f, 0.0f, 1.0f,
 		-0.05f, -0.05f, 0.0f,   1.0f, 0.0f, 0.0f
 	};
+
+	// Bounding sphere of the quad, for culling.
+	const float quadRadius = 0.0708f;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,182 @@
+#ifndef INSTANCECULLER_H
+#define INSTANCECULLER_H
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <glm/glm.hpp>
+#include "Frustum.h"
+#include "Transforms.h"
+#include "Utils.h"
+
+// One draw as glDrawArraysIndirect reads it from the indirect buffer.
+struct DrawArraysCommand {
+    unsigned int count;
+    unsigned int instanceCount;
+    unsigned int first;
+    unsigned int baseInstance;
+};
+
+// What the instance attributes are: a mat4 each (shaders/shader.vs) or a Transforms::CompactInstance (shaders/compact.vs).
+enum InstanceFormat {
+    MATRIX_INSTANCES,
+    COMPACT_INSTANCES
+};
+
+namespace Instances {
+    // Points attributes 2-5 of the bound VAO at a buffer of mat4s, one per instance.
+    void setMatrixAttributes(unsigned int buffer) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (int column = 0; column < 4; column++) {
+            glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(2 + column);
+            glVertexAttribDivisor(2 + column, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Points attributes 2-4 of the bound VAO at a buffer of CompactInstances.
+    void setCompactAttributes(unsigned int buffer) {
+        GLsizei stride = sizeof(Transforms::CompactInstance);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Transforms::CompactInstance, position));
+        glVertexAttribIPointer(3, 3, GL_SHORT, stride, (void*)offsetof(Transforms::CompactInstance, rotation));
+        glVertexAttribPointer(4, 1, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(Transforms::CompactInstance, scale));
+        for (int location = 2; location <= 4; location++) {
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // The quad from Constants.h instanced with what's in 'instanceBuffer'.
+    unsigned int createQuadVAO(unsigned int quadVBO, unsigned int instanceBuffer, InstanceFormat format = MATRIX_INSTANCES) {
+        unsigned int VAO;
+        glGenVertexArrays(1, &VAO);
+        glBindVertexArray(VAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        if (format == COMPACT_INSTANCES)
+            setCompactAttributes(instanceBuffer);
+        else
+            setMatrixAttributes(instanceBuffer);
+
+        glBindVertexArray(0);
+        return VAO;
+    }
+
+    // Copies the instances whose bounding sphere touches the frustum into 'visible', returns how many.
+    // 'radius' is the sphere before the instance's matrix, which scales it by its largest axis.
+    unsigned int cull(Frustum const &frustum, const glm::mat4 *instances, unsigned int count, float radius, glm::mat4 *visible) {
+        unsigned int visibleCount = 0;
+        for (unsigned int i = 0; i < count; i++) {
+            glm::mat4 const &model = instances[i];
+            float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+            if (frustum.containsSphere(glm::vec3(model[3]), radius * scale))
+                visible[visibleCount++] = model;
+        }
+        return visibleCount;
+    }
+}
+
+/*
+* Frustum culls instances on the GPU with the compute pass in shaders/cull.comp. It compacts the visible matrices
+* into a buffer of its own and counts them straight into an indirect command, so nothing is read back and the
+* draw runs off whatever survived. The input buffer isn't touched and stays owned by the caller.
+*/
+class InstanceCuller {
+    unsigned int program = 0;
+    unsigned int instanceBuffer = 0, visibleBuffer = 0, commandBuffer = 0;
+    unsigned int instanceCount = 0, vertexCount = 0;
+    int planesLocation = -1, totalInstancesLocation = -1, radiusLocation = -1;
+public:
+    static const unsigned int GROUP_SIZE = 256;  // local_size_x in cull.comp
+
+    // 'instances' holds 'count' mat4s. Needs compute shaders (GL 4.3), returns false without them.
+    bool create(unsigned int instances, unsigned int count, unsigned int verticesPerInstance) {
+        if (!GLAD_GL_VERSION_4_3)
+            return false;
+
+        program = Utils::loadProgram({ { GL_COMPUTE_SHADER, "shaders/cull.comp" } });
+        if (program == (unsigned int)-1) {
+            program = 0;
+            return false;
+        }
+        planesLocation = glGetUniformLocation(program, "planes");
+        totalInstancesLocation = glGetUniformLocation(program, "totalInstances");
+        radiusLocation = glGetUniformLocation(program, "radius");
+
+        instanceBuffer = instances;
+        instanceCount = count;
+        vertexCount = verticesPerInstance;
+
+        // Room for everything to be visible, the pass only ever writes the front of it.
+        glGenBuffers(1, &visibleBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+        glBufferData(GL_ARRAY_BUFFER, (size_t)count * sizeof(glm::mat4), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        DrawArraysCommand command = { vertexCount, 0, 0, 0 };
+        glGenBuffers(1, &commandBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(command), &command, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        return true;
+    }
+
+    // Instance matrices of the last cull, for the draw VAO's attributes.
+    unsigned int visibleMatrices() const {
+        return visibleBuffer;
+    }
+
+    // 'radius' is an instance's bounding sphere before its matrix. Leaves the compute program bound.
+    // 'firstInstance' is where this frame's matrices start, for a StreamingBuffer region. Its byte offset has to meet
+    // the storage buffer offset alignment, which the StreamingBuffer regions do.
+    void cull(Frustum const &frustum, float radius, unsigned int firstInstance = 0) {
+        DrawArraysCommand reset = { vertexCount, 0, 0, 0 };
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(reset), &reset);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        glUseProgram(program);
+        glUniform4fv(planesLocation, 6, &frustum.planes[0][0]);
+        glUniform1ui(totalInstancesLocation, instanceCount);
+        glUniform1f(radiusLocation, radius);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer, (size_t)firstInstance * sizeof(glm::mat4), (size_t)instanceCount * sizeof(glm::mat4));
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+        glDispatchCompute((instanceCount + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+
+        // The draw reads the count and the matrices the pass just wrote.
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    }
+
+    // Draws what the last cull kept, with the program and a VAO over visibleMatrices() bound.
+    void draw() {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glDrawArraysIndirect(GL_TRIANGLES, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    // Reads the count back, which waits for the GPU, so it's for stats only.
+    unsigned int visibleCount() {
+        DrawArraysCommand command;
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(command), &command);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        return command.instanceCount;
+    }
+
+    void destroy() {
+        glDeleteProgram(program);
+        glDeleteBuffers(1, &visibleBuffer);
+        glDeleteBuffers(1, &commandBuffer);
+        program = visibleBuffer = commandBuffer = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef JOBS_H
+#define JOBS_H
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Jobs {
+	// Thread count to use when the caller doesn't care, hardware_concurrency can report 0.
+	unsigned int defaultThreads() {
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	class Counter;
+
+	struct Job {
+		std::function<void()> fn;
+		Counter *counter;
+		bool background;
+	};
+
+	/*
+	* How many of the jobs run with it haven't finished. Scheduler::wait() on it to block until they have, or hand it
+	* to Scheduler::runAfter to hold jobs back until then. Has to outlive its jobs, waiting on it sees to that.
+	*/
+	class Counter {
+		friend class Scheduler;
+		std::atomic<unsigned int> pending;
+		std::mutex mutex;            // Taken when the count reaches zero, and to add dependents.
+		std::vector<Job> dependents;  // Jobs that start once the count is zero.
+	public:
+		Counter(): pending(0) {}
+		Counter(Counter const&) = delete;
+		Counter &operator=(Counter const&) = delete;
+
+		bool done() const {
+			return pending.load() == 0;
+		}
+	};
+
+	/*
+	* Work stealing scheduler. Every thread has its own queue: jobs go on the back of the queue of the thread that runs
+	* them, it takes its own work from the back (newest first, still warm in its cache) and an idle thread steals from
+	* the front of someone else's (oldest first, usually the biggest piece of what's left). Threads that aren't
+	* workers, the main thread included, share queue 0.
+	* wait() runs jobs while it waits, so the main thread helps out instead of blocking, and a job can wait on jobs it
+	* started without tying up a worker. Idle workers spin briefly, then sleep until something is queued.
+	* Background jobs (runBackground) sit in a queue of their own that only workers take from, after everything else,
+	* so a long one (a texture decode) never lands on the render thread while it helps out in wait().
+	*/
+	class Scheduler {
+		struct Queue {
+			std::mutex mutex;
+			std::deque<Job> jobs;
+		};
+
+		struct ThreadSlot {
+			const Scheduler *scheduler;
+			unsigned int queue;
+		};
+
+		std::vector<std::unique_ptr<Queue>> queues;  // [0] is for threads that aren't workers, then one per worker.
+		Queue background;
+		std::vector<std::thread> workers;
+		std::atomic<unsigned int> queued;    // Jobs sitting in any queue, dependents still held back don't count.
+		std::atomic<unsigned int> sleeping;  // Workers waiting on 'wake'.
+		std::atomic<bool> stopping;
+		std::mutex sleepMutex;
+		std::condition_variable wake;
+
+		static const int SPINS = 64;  // Empty looks before an idle worker goes to sleep.
+
+		static ThreadSlot &current() {
+			static thread_local ThreadSlot slot = { nullptr, 0 };
+			return slot;
+		}
+
+		unsigned int ownQueue() const {
+			return current().scheduler == this ? current().queue : 0;
+		}
+
+		void push(Job job) {
+			Queue &queue = job.background ? background : *queues[ownQueue()];
+			{
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				queue.jobs.push_back(std::move(job));
+			}
+			// Incremented before 'sleeping' is read, and a worker counts itself sleeping before it checks 'queued',
+			// so either it sees the job or we see it and wake it.
+			queued++;
+			if (sleeping.load() > 0) {
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				wake.notify_one();
+			}
+		}
+
+		// Background jobs only go to workers, or to anyone when there are none to run them.
+		bool take(unsigned int self, Job &job) {
+			if (queued.load() == 0)
+				return false;
+			if (takeFrom(self, job))
+				return true;
+			if (self == 0 && !workers.empty())
+				return false;
+			std::lock_guard<std::mutex> lock(background.mutex);
+			if (background.jobs.empty())
+				return false;
+			job = std::move(background.jobs.front());
+			background.jobs.pop_front();
+			queued--;
+			return true;
+		}
+
+		bool takeFrom(unsigned int self, Job &job) {
+			for (unsigned int i = 0; i < queues.size(); i++) {
+				unsigned int index = (self + i) % queues.size();
+				Queue &queue = *queues[index];
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				if (queue.jobs.empty())
+					continue;
+				if (index == self) {
+					job = std::move(queue.jobs.back());
+					queue.jobs.pop_back();
+				}
+				else {
+					job = std::move(queue.jobs.front());
+					queue.jobs.pop_front();
+				}
+				queued--;
+				return true;
+			}
+			return false;
+		}
+
+		// Only the count reaching zero happens under the counter's lock, so a waiter that takes the lock after seeing
+		// zero knows nobody is still touching the counter.
+		void finish(Counter &counter) {
+			unsigned int left = counter.pending.load();
+			while (left > 1)
+				if (counter.pending.compare_exchange_weak(left, left - 1))
+					return;
+
+			std::vector<Job> released;
+			{
+				std::lock_guard<std::mutex> lock(counter.mutex);
+				if (--counter.pending == 0)
+					released.swap(counter.dependents);
+			}
+			for (Job &job : released)
+				push(std::move(job));
+		}
+
+		bool runOne(unsigned int self) {
+			Job job;
+			if (!take(self, job))
+				return false;
+			job.fn();
+			finish(*job.counter);
+			return true;
+		}
+
+		void workerLoop(unsigned int self) {
+			current() = { this, self };
+			while (!stopping.load()) {
+				if (runOne(self))
+					continue;
+				for (int spin = 0; spin < SPINS && queued.load() == 0 && !stopping.load(); spin++)
+					std::this_thread::yield();
+				if (queued.load() > 0)
+					continue;
+
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleeping++;
+				wake.wait(lock, [this]() { return stopping.load() || queued.load() > 0; });
+				sleeping--;
+			}
+		}
+	public:
+		// 'threads' counts the calling thread, 0 = one per core.
+		explicit Scheduler(unsigned int threads = 0): queued(0), sleeping(0), stopping(false) {
+			if (threads == 0)
+				threads = defaultThreads();
+			for (unsigned int t = 0; t < threads; t++)
+				queues.emplace_back(new Queue());
+			for (unsigned int t = 1; t < threads; t++)
+				workers.emplace_back([this, t]() { workerLoop(t); });
+		}
+
+		Scheduler(Scheduler const&) = delete;
+		Scheduler &operator=(Scheduler const&) = delete;
+
+		// Jobs still queued are dropped, wait on their counters first.
+		~Scheduler() {
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (std::thread &worker : workers)
+				worker.join();
+		}
+
+		unsigned int threadCount() const {
+			return queues.size();
+		}
+
+		// Queues fn, 'counter' counts it until it has run.
+		void run(std::function<void()> fn, Counter &counter) {
+			counter.pending++;
+			push({ std::move(fn), &counter, false });
+		}
+
+		// Like run(), for long jobs nobody is about to wait on. They run on workers once there's nothing else to do.
+		void runBackground(std::function<void()> fn, Counter &counter) {
+			counter.pending++;
+			push({ std::move(fn), &counter, true });
+		}
+
+		// Queues fn once every job of 'dependency' has finished, right away if they have.
+		void runAfter(Counter &dependency, std::function<void()> fn, Counter &counter) {
+			counter.pending++;
+			{
+				std::lock_guard<std::mutex> lock(dependency.mutex);
+				if (dependency.pending.load() != 0) {
+					dependency.dependents.push_back({ std::move(fn), &counter, false });
+					return;
+				}
+			}
+			push({ std::move(fn), &counter, false });
+		}
+
+		// Runs queued jobs, anyone's, until every job of 'counter' has finished.
+		void wait(Counter &counter) {
+			unsigned int self = ownQueue();
+			while (counter.pending.load() != 0)
+				if (!runOne(self))
+					std::this_thread::yield();
+			std::lock_guard<std::mutex> lock(counter.mutex);  // The job that took it to zero may still be in finish().
+		}
+
+		/*
+		* Runs fn(i) for every i in [0, count), blocking (and helping) until done. Indices go out in jobs of 'grain'
+		* at a time, 0 picks enough jobs for a few per thread so uneven work still balances out. Fine from inside a job.
+		*/
+		template <typename Fn>
+		void forEach(unsigned int count, Fn const &fn, unsigned int grain = 0) {
+			if (count == 0)
+				return;
+			if (grain == 0)
+				grain = std::max(1u, count / (threadCount() * 4));
+
+			Counter counter;
+			for (unsigned int begin = 0; begin < count; begin += grain) {
+				unsigned int end = std::min(count, begin + grain);
+				run([&fn, begin, end]() {
+					for (unsigned int i = begin; i < end; i++)
+						fn(i);
+				}, counter);
+			}
+			wait(counter);
+		}
+	};
+}
+
+#endif
@@ -7,15 +7,32 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include "Utils.h"
 #include "Constants.h"
+#include "InstanceCuller.h"
+#include "StreamingBuffer.h"
+#include "Transforms.h"
+#include "Benchmark.h"
+
+bool gpuCulling = false;  // G toggles culling the instances in a compute pass
+bool compactInstances = false;  // C toggles 20 byte instances instead of a matrix each
 
 // ------------------- CALLBACKS -------------------
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+        gpuCulling = !gpuCulling;
+    if (key == GLFW_KEY_C && action == GLFW_PRESS)
+        compactInstances = !compactInstances;
+}
+
+// Every quad is turned by its own angle, and spins over time.
+void spinQuads(Transforms::Store &transforms, float time) {
+    for (unsigned int i = 0; i < transforms.size(); i++)
+        transforms.setRotation(i, Transforms::rotation(glm::vec3(0, 0, 1), glm::radians((float)i * 10.0f + time * 90.0f)));
 }
 
-int main(void)
+int main(int argc, char** argv)
 {
     GLFWwindow* window;
 
@@ -43,6 +60,13 @@ int main(void)
 
     std::cout << "OpenGL version: " << glGetString(GL_VERSION) << std::endl;
 
+    // 'Instancing --bench <name>' runs a benchmark instead of the scene.
+    if (argc > 2 && std::string(argv[1]) == "--bench") {
+        bool ran = Benchmark::run(argv[2]);
+        glfwTerminate();
+        return ran ? 0 : -1;
+    }
+
     // VBO STUFF
     unsigned int quadVBO;
     unsigned int quadVAO;
@@ -60,15 +84,16 @@ int main(void)
         for (int y = -5; y < 5; y++)
             quad_positions[index++] = glm::vec2(x * space_between + offset, y * space_between + offset);
 
-    glm::mat4 instance_model_matrices[100];
+    Transforms::Store transforms;
     float scale_factor = 0.5f; // Make every quad 2x bigger.
-    for (int i = 0; i < 100; i++) {
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(quad_positions[i], 0.0));
-        model = glm::rotate(model, glm::radians((float)i * 10.0f), glm::vec3(0, 0, 1));
-        model = glm::scale(model, glm::vec3(scale_factor, scale_factor, scale_factor));
-        instance_model_matrices[i] = model;
-    }
+    for (int i = 0; i < 100; i++)
+        transforms.add(glm::vec3(quad_positions[i], 0.0), Transforms::rotation(glm::vec3(0, 0, 1), 0.0f), glm::vec3(scale_factor));
+    spinQuads(transforms, 0.0f);
+
+    // Matrices are built a few at a time with SIMD. 100 of them is far less than a job's worth (see
+    // Transforms::compose with a scheduler), so they're built right here.
+    glm::mat4 instance_model_matrices[100];
+    Transforms::compose(transforms, 0, transforms.size(), instance_model_matrices);
 
     unsigned int matrixVBO;
     glGenBuffers(1, &matrixVBO);
@@ -77,40 +102,40 @@ int main(void)
 
     std::cout << sizeof(instance_model_matrices) << std::endl;
 
-    glGenVertexArrays(1, &quadVAO);
-    glBindVertexArray(quadVAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    glBindBuffer(GL_ARRAY_BUFFER, matrixVBO);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 4 * 4, (void*)(4 * 0 * sizeof(float)));
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 4 * 4, (void*)(4 * 1 * sizeof(float)));
-    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 4 * 4, (void*)(4 * 2 * sizeof(float)));
-    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 4 * 4, (void*)(4 * 3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
-    glEnableVertexAttribArray(5);
-    glVertexAttribDivisor(2, 1);
-    glVertexAttribDivisor(3, 1);
-    glVertexAttribDivisor(4, 1);
-    glVertexAttribDivisor(5, 1);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(quadVAO);
-    
-
-    // Shader stuff
-    unsigned int vShader = Utils::createShader(GL_VERTEX_SHADER, "shaders/shader.vs");
-    unsigned int fShader = Utils::createShader(GL_FRAGMENT_SHADER, "shaders/shader.fs");
-    unsigned int program = Utils::createAndLinkProgram({ vShader, fShader });
-    glDeleteShader(vShader);
-    glDeleteShader(fShader);
+    // The matrices are rewritten every frame into a ring of 3 persistently mapped regions, so the quads can spin
+    // without waiting on the GPU. Without GL 4.4 they stay put in matrixVBO.
+    StreamingBuffer instanceStream;
+    bool streaming = instanceStream.create(sizeof(instance_model_matrices));
+    unsigned int instanceBuffer = streaming ? instanceStream.id() : matrixVBO;
+    quadVAO = Instances::createQuadVAO(quadVBO, instanceBuffer);
+
+    // The same quad, instanced from what the compute pass kept.
+    InstanceCuller culler;
+    unsigned int culledVAO = 0;
+    if (culler.create(instanceBuffer, 100, 6))
+        culledVAO = Instances::createQuadVAO(quadVBO, culler.visibleMatrices());
+
+    // Compact instances stream through their own ring. Its regions are aligned to a multiple of both the instance
+    // size and 256, so each region starts on a whole base instance.
+    StreamingBuffer compactStream;
+    unsigned int compactVAO = 0;
+    if (streaming && compactStream.create(100 * sizeof(Transforms::CompactInstance), 3, 64 * sizeof(Transforms::CompactInstance)))
+        compactVAO = Instances::createQuadVAO(quadVBO, compactStream.id(), COMPACT_INSTANCES);
+
+    // Shader stuff, built as one batch so the compiles overlap.
+    std::vector<unsigned int> programs = Utils::loadPrograms({
+        { { GL_VERTEX_SHADER, "shaders/shader.vs" }, { GL_FRAGMENT_SHADER, "shaders/shader.fs" } },
+        { { GL_VERTEX_SHADER, "shaders/compact.vs" }, { GL_FRAGMENT_SHADER, "shaders/shader.fs" } } });
+    unsigned int program = programs[0];
+    unsigned int compactProgram = programs[1];
+
+    // The quads are placed straight in clip space, so the view is the identity and so is the frustum.
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    Frustum frustum = Frustum::fromMatrix(viewProjection);
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "viewProjection"), 1, GL_FALSE, &viewProjection[0][0]);
+    glUseProgram(compactProgram);
+    glUniformMatrix4fv(glGetUniformLocation(compactProgram, "viewProjection"), 1, GL_FALSE, &viewProjection[0][0]);
 
     // Render loop
     while (!glfwWindowShouldClose(window))
@@ -119,10 +144,52 @@ int main(void)
 
         glClear(GL_COLOR_BUFFER_BIT);
 
-        // Rendering here
-        glUseProgram(program);
-        glBindVertexArray(quadVAO); 
-        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, 100);
+        if (gpuCulling && !culledVAO) {
+            std::cout << "Compute shaders aren't available, staying on the plain instanced draw" << std::endl;
+            gpuCulling = false;
+        }
+        if (compactInstances && !compactVAO) {
+            std::cout << "Compact instances stream through glBufferStorage, which isn't available" << std::endl;
+            compactInstances = false;
+        }
+
+        // This frame's instances go in the next region, the draws pick them out with the base instance.
+        unsigned int firstInstance = 0;
+        if (compactInstances) {
+            spinQuads(transforms, (float)glfwGetTime());
+            Transforms::packCompact(transforms, 0, transforms.size(), (Transforms::CompactInstance*)compactStream.begin());
+            firstInstance = compactStream.offset() / sizeof(Transforms::CompactInstance);
+        }
+        else if (streaming) {
+            spinQuads(transforms, (float)glfwGetTime());
+            Transforms::compose(transforms, 0, transforms.size(), (glm::mat4*)instanceStream.begin());
+            firstInstance = instanceStream.offset() / sizeof(glm::mat4);
+        }
+
+        // Rendering here. The compute pass reads matrices, so compact instances aren't culled.
+        if (compactInstances) {
+            glUseProgram(compactProgram);
+            glBindVertexArray(compactVAO);
+            glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, 6, 100, firstInstance);
+            compactStream.end();
+        }
+        else if (gpuCulling) {
+            culler.cull(frustum, Constants::quadRadius, firstInstance);
+            glUseProgram(program);
+            glBindVertexArray(culledVAO);
+            culler.draw();
+        }
+        else {
+            glUseProgram(program);
+            glBindVertexArray(quadVAO); 
+            if (streaming)
+                glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, 6, 100, firstInstance);
+            else
+                glDrawArraysInstanced(GL_TRIANGLES, 0, 6, 100);
+        }
+
+        if (streaming && !compactInstances)
+            instanceStream.end();
 
         glfwSwapBuffers(window);
     }
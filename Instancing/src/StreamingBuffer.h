@@ -0,0 +1,94 @@
+#ifndef STREAMINGBUFFER_H
+#define STREAMINGBUFFER_H
+#include <glad/glad.h>
+#include <vector>
+
+/*
+* A buffer for data that changes every frame, split into 'frames' regions (3 by default) and persistently mapped.
+* Each frame the CPU writes straight into the next region while the GPU is still reading the ones before it.
+* A fence per region stops the CPU from overwriting a region before the draws that read it have finished.
+* Nothing is copied through the driver and the buffer is never reallocated, unlike glBufferSubData or orphaning.
+*/
+class StreamingBuffer {
+    unsigned int buffer = 0;
+    unsigned char *mapped = nullptr;
+    size_t regionSize = 0;
+    unsigned int regionCount = 0, current = 0;
+    std::vector<GLsync> fences;
+    unsigned long long stalls = 0;  // Times begin() had to wait for the GPU.
+public:
+    // 'frameBytes' is the most one frame writes. Regions are aligned to 'alignment' so any of them can be bound as a
+    // uniform or storage range, 256 covers every GPU's offset alignment.
+    // Needs glBufferStorage (GL 4.4), returns false without it.
+    bool create(size_t frameBytes, unsigned int frames = 3, size_t alignment = 256) {
+        if (!GLAD_GL_VERSION_4_4)
+            return false;
+
+        regionSize = (frameBytes + alignment - 1) / alignment * alignment;
+        regionCount = frames;
+        current = 0;
+        fences.assign(frames, (GLsync)0);
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferStorage(GL_ARRAY_BUFFER, regionSize * frames, NULL, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, regionSize * frames, flags);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return mapped != nullptr;
+    }
+
+    // Waits until the GPU is done with the next region and returns it for this frame's writes.
+    void *begin() {
+        GLsync &fence = fences[current];
+        if (fence) {
+            GLenum result = glClientWaitSync(fence, 0, 0);
+            if (result == GL_TIMEOUT_EXPIRED) {
+                stalls++;
+                do
+                    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                while (result == GL_TIMEOUT_EXPIRED);
+            }
+            glDeleteSync(fence);
+            fence = 0;
+        }
+        return mapped + offset();
+    }
+
+    // Call once the draws that read this frame's region are issued, moves on to the next region.
+    void end() {
+        fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        current = (current + 1) % regionCount;
+    }
+
+    unsigned int id() const {
+        return buffer;
+    }
+
+    // Where the region begin() handed out starts in the buffer, in bytes.
+    size_t offset() const {
+        return current * regionSize;
+    }
+
+    unsigned long long stallCount() const {
+        return stalls;
+    }
+
+    void destroy() {
+        for (GLsync fence : fences)
+            if (fence)
+                glDeleteSync(fence);
+        fences.clear();
+
+        if (buffer != 0) {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+        }
+        buffer = 0;
+        mapped = nullptr;
+    }
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include "Jobs.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORMS_SSE
+#include <emmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+/*
+* Instance transforms kept as position, rotation and scale in structure of arrays form, and turned into matrices
+* (translate * rotate * scale, the same as the glm calls) several instances at a time. Animating means changing a
+* few floats per instance, and the matrices are written straight to wherever they go, like a StreamingBuffer region.
+*/
+namespace Transforms {
+    // Quaternion (x, y, z, w) for a rotation of 'radians' about 'axis'.
+    glm::vec4 rotation(glm::vec3 axis, float radians) {
+        glm::vec3 v = glm::normalize(axis) * std::sin(radians * 0.5f);
+        return glm::vec4(v.x, v.y, v.z, std::cos(radians * 0.5f));
+    }
+
+    struct Store {
+        std::vector<float> px, py, pz;      // Position
+        std::vector<float> qx, qy, qz, qw;  // Rotation, a unit quaternion
+        std::vector<float> sx, sy, sz;      // Scale
+
+        unsigned int size() const {
+            return px.size();
+        }
+
+        void add(glm::vec3 position, glm::vec4 quaternion, glm::vec3 scale) {
+            px.push_back(position.x); py.push_back(position.y); pz.push_back(position.z);
+            qx.push_back(quaternion.x); qy.push_back(quaternion.y); qz.push_back(quaternion.z); qw.push_back(quaternion.w);
+            sx.push_back(scale.x); sy.push_back(scale.y); sz.push_back(scale.z);
+        }
+
+        void setRotation(unsigned int i, glm::vec4 quaternion) {
+            qx[i] = quaternion.x; qy[i] = quaternion.y; qz[i] = quaternion.z; qw[i] = quaternion.w;
+        }
+    };
+
+    /*
+    * An instance in 20 bytes instead of a 64 byte matrix, decoded in shaders/compact.vs:
+    *  - Position as plain floats, instances can be far from the origin.
+    *  - The rotation quaternion as its smallest three components, which are all within +-1/sqrt(2), in 15 bits each.
+    *    The largest is rebuilt from them, q and -q are the same rotation so it's flipped to be positive. Its index
+    *    takes the low bit of the first two shorts. Rebuilding a fixed component (say w) instead loses a lot of
+    *    precision when that component is near 0.
+    *  - One half float scale, this format is for uniformly scaled instances and takes the x scale.
+    */
+    struct CompactInstance {
+        float position[3];
+        int16_t rotation[3];
+        uint16_t scale;
+    };
+
+    // Packs instances [begin, end) into out[begin, end).
+    void packCompact(Store const &store, unsigned int begin, unsigned int end, CompactInstance *out) {
+        for (unsigned int i = begin; i < end; i++) {
+            CompactInstance &instance = out[i];
+            instance.position[0] = store.px[i];
+            instance.position[1] = store.py[i];
+            instance.position[2] = store.pz[i];
+
+            float q[4] = { store.qx[i], store.qy[i], store.qz[i], store.qw[i] };
+            int largest = 0;
+            for (int c = 1; c < 4; c++)
+                if (std::fabs(q[c]) > std::fabs(q[largest]))
+                    largest = c;
+            float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+
+            for (int c = 0, stored = 0; c < 4; c++) {
+                if (c == largest)
+                    continue;
+                int value = (int)std::round(glm::clamp(q[c] * sign * 1.41421356f, -1.0f, 1.0f) * 16383.0f);
+                int bit = stored < 2 ? (largest >> stored) & 1 : 0;
+                instance.rotation[stored++] = (int16_t)(value * 2 + bit);
+            }
+            instance.scale = glm::packHalf1x16(store.sx[i]);
+        }
+    }
+
+    // Matrices for instances [begin, end) into out[begin, end).
+    void composeScalar(Store const &store, unsigned int begin, unsigned int end, glm::mat4 *out) {
+        for (unsigned int i = begin; i < end; i++) {
+            float x = store.qx[i], y = store.qy[i], z = store.qz[i], w = store.qw[i];
+            float xx = x * x, yy = y * y, zz = z * z, xy = x * y, xz = x * z, yz = y * z, wx = w * x, wy = w * y, wz = w * z;
+
+            glm::mat4 &m = out[i];
+            m[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * store.sx[i];
+            m[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * store.sy[i];
+            m[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * store.sz[i];
+            m[3] = glm::vec4(store.px[i], store.py[i], store.pz[i], 1.0f);
+        }
+    }
+
+#ifdef TRANSFORMS_SSE
+    // The rotation and scale maths for 4 instances at once, one per lane, then a transpose per column to lay
+    // each instance's matrix out the way GL reads it.
+    void composeSSE(Store const &store, unsigned int begin, unsigned int end, glm::mat4 *out) {
+        unsigned int i = begin;
+        const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps();
+        for (; i + 4 <= end; i += 4) {
+            __m128 x = _mm_loadu_ps(&store.qx[i]), y = _mm_loadu_ps(&store.qy[i]), z = _mm_loadu_ps(&store.qz[i]), w = _mm_loadu_ps(&store.qw[i]);
+            __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+            __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+            __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+            __m128 sx = _mm_mul_ps(_mm_loadu_ps(&store.sx[i]), two), sy = _mm_mul_ps(_mm_loadu_ps(&store.sy[i]), two), sz = _mm_mul_ps(_mm_loadu_ps(&store.sz[i]), two);
+
+            // Scale is folded into the 2 of the rotation terms, (1 - 2a) * s is written s - 2s * a.
+            __m128 columns[4][4] = {
+                { _mm_sub_ps(_mm_mul_ps(sx, _mm_set1_ps(0.5f)), _mm_mul_ps(sx, _mm_add_ps(yy, zz))), _mm_mul_ps(sx, _mm_add_ps(xy, wz)), _mm_mul_ps(sx, _mm_sub_ps(xz, wy)), zero },
+                { _mm_mul_ps(sy, _mm_sub_ps(xy, wz)), _mm_sub_ps(_mm_mul_ps(sy, _mm_set1_ps(0.5f)), _mm_mul_ps(sy, _mm_add_ps(xx, zz))), _mm_mul_ps(sy, _mm_add_ps(yz, wx)), zero },
+                { _mm_mul_ps(sz, _mm_add_ps(xz, wy)), _mm_mul_ps(sz, _mm_sub_ps(yz, wx)), _mm_sub_ps(_mm_mul_ps(sz, _mm_set1_ps(0.5f)), _mm_mul_ps(sz, _mm_add_ps(xx, yy))), zero },
+                { _mm_loadu_ps(&store.px[i]), _mm_loadu_ps(&store.py[i]), _mm_loadu_ps(&store.pz[i]), one }
+            };
+
+            float *matrices = &out[i][0][0];
+            for (int c = 0; c < 4; c++) {
+                _MM_TRANSPOSE4_PS(columns[c][0], columns[c][1], columns[c][2], columns[c][3]);
+                for (int m = 0; m < 4; m++)
+                    _mm_storeu_ps(matrices + m * 16 + c * 4, columns[c][m]);
+            }
+        }
+        composeScalar(store, i, end, out);
+    }
+#endif
+
+#ifdef __AVX__
+    // Same as composeSSE 8 instances at a time, each half of the registers is transposed on its own.
+    void composeAVX(Store const &store, unsigned int begin, unsigned int end, glm::mat4 *out) {
+        unsigned int i = begin;
+        const __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f), half = _mm256_set1_ps(0.5f), zero = _mm256_setzero_ps();
+        for (; i + 8 <= end; i += 8) {
+            __m256 x = _mm256_loadu_ps(&store.qx[i]), y = _mm256_loadu_ps(&store.qy[i]), z = _mm256_loadu_ps(&store.qz[i]), w = _mm256_loadu_ps(&store.qw[i]);
+            __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+            __m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+            __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+            __m256 sx = _mm256_mul_ps(_mm256_loadu_ps(&store.sx[i]), two), sy = _mm256_mul_ps(_mm256_loadu_ps(&store.sy[i]), two), sz = _mm256_mul_ps(_mm256_loadu_ps(&store.sz[i]), two);
+
+            __m256 columns[4][4] = {
+                { _mm256_sub_ps(_mm256_mul_ps(sx, half), _mm256_mul_ps(sx, _mm256_add_ps(yy, zz))), _mm256_mul_ps(sx, _mm256_add_ps(xy, wz)), _mm256_mul_ps(sx, _mm256_sub_ps(xz, wy)), zero },
+                { _mm256_mul_ps(sy, _mm256_sub_ps(xy, wz)), _mm256_sub_ps(_mm256_mul_ps(sy, half), _mm256_mul_ps(sy, _mm256_add_ps(xx, zz))), _mm256_mul_ps(sy, _mm256_add_ps(yz, wx)), zero },
+                { _mm256_mul_ps(sz, _mm256_add_ps(xz, wy)), _mm256_mul_ps(sz, _mm256_sub_ps(yz, wx)), _mm256_sub_ps(_mm256_mul_ps(sz, half), _mm256_mul_ps(sz, _mm256_add_ps(xx, yy))), zero },
+                { _mm256_loadu_ps(&store.px[i]), _mm256_loadu_ps(&store.py[i]), _mm256_loadu_ps(&store.pz[i]), one }
+            };
+
+            float *matrices = &out[i][0][0];
+            for (int c = 0; c < 4; c++) {
+                __m128 low[4], high[4];
+                for (int r = 0; r < 4; r++) {
+                    low[r] = _mm256_castps256_ps128(columns[c][r]);
+                    high[r] = _mm256_extractf128_ps(columns[c][r], 1);
+                }
+                _MM_TRANSPOSE4_PS(low[0], low[1], low[2], low[3]);
+                _MM_TRANSPOSE4_PS(high[0], high[1], high[2], high[3]);
+                for (int m = 0; m < 4; m++) {
+                    _mm_storeu_ps(matrices + m * 16 + c * 4, low[m]);
+                    _mm_storeu_ps(matrices + (m + 4) * 16 + c * 4, high[m]);
+                }
+            }
+        }
+        composeScalar(store, i, end, out);
+    }
+#endif
+
+    // The widest kernel this build has.
+    void compose(Store const &store, unsigned int begin, unsigned int end, glm::mat4 *out) {
+#if defined(__AVX__)
+        composeAVX(store, begin, end, out);
+#elif defined(TRANSFORMS_SSE)
+        composeSSE(store, begin, end, out);
+#else
+        composeScalar(store, begin, end, out);
+#endif
+    }
+
+    // Every matrix, a job per chunk. Chunks are big enough that handing them out costs next to nothing.
+    void compose(Store const &store, glm::mat4 *out, Jobs::Scheduler &jobs, unsigned int chunkSize = 4096) {
+        unsigned int count = store.size();
+        jobs.forEach((count + chunkSize - 1) / chunkSize, [&](unsigned int chunk) {
+            unsigned int begin = chunk * chunkSize;
+            compose(store, begin, std::min(begin + chunkSize, count), out);
+        }, 1);
+    }
+}
+
+#endif
@@ -1,30 +1,49 @@
 #ifndef UTIL_H
 #define UTIL_H
 #include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <string>
 #include <vector>
-#include <sstream>
 #include <fstream>
 #include <iostream>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+// GL_KHR_parallel_shader_compile isn't in our glad, so its one function is loaded by hand.
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
 namespace Utils {
-    unsigned int createShader(GLenum type, std::string path) {
+    struct ShaderFile {
+        GLenum type;
+        std::string path;
+    };
 
-        // Read in our shader code
-        std::ifstream stream(path);
-        std::string source;
-        if (stream) {
-            std::stringstream shaderStream;
-            shaderStream << stream.rdbuf(); // Read buffer into the string stream
-            stream.close();
-            source = shaderStream.str();
+    // The whole file in one read, sized up front. Binary so Windows line endings don't throw the size off, GLSL takes them.
+    bool readSource(std::string const &path, std::string &source) {
+        std::ifstream stream(path, std::ios::binary | std::ios::ate);
+        std::streamoff size = stream ? (std::streamoff)stream.tellg() : -1;
+        if (size < 0) {
+            std::cerr << "Error reading shader file " << path << std::endl;
+            return false;
         }
-        else {
+
+        source.resize((size_t)size);
+        stream.seekg(0);
+        if (size > 0 && !stream.read(&source[0], size)) {
             std::cerr << "Error reading shader file " << path << std::endl;
-            return -1;
+            return false;
         }
+        return true;
+    }
+
+    unsigned int createShader(GLenum type, std::string path) {
+        // Read in our shader code
+        std::string source;
+        if (!readSource(path, source))
+            return -1;
 
         const char* sourcestr = source.c_str();
         unsigned int shaderID = glCreateShader(type);
@@ -63,6 +82,232 @@ namespace Utils {
 
         return program;
     }
+
+    bool hasExtension(const char *name) {
+        int count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (int i = 0; i < count; i++)
+            if (std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+                return true;
+        return false;
+    }
+
+    // Whether the driver compiles on threads of its own (KHR or ARB_parallel_shader_compile), turned on by the first call.
+    bool parallelCompile() {
+        // Asked once, the samples only ever have the one context.
+        static int enabled = -1;
+        if (enabled < 0) {
+            PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads = nullptr;
+            if (hasExtension("GL_KHR_parallel_shader_compile"))
+                maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+            else if (hasExtension("GL_ARB_parallel_shader_compile"))
+                maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+
+            // As many threads as the driver wants to use.
+            if (maxThreads)
+                maxThreads(0xFFFFFFFF);
+            enabled = maxThreads != nullptr;
+        }
+        return enabled == 1;
+    }
+
+    // Program binaries are core in 4.1, and a driver may still support no formats at all.
+    bool binariesSupported() {
+        if (!GLAD_GL_VERSION_4_1)
+            return false;
+        int formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    // 64 bit FNV-1a, plenty to tell sources apart.
+    uint64_t hash(const void *data, size_t length, uint64_t seed = 14695981039346656037ull) {
+        const unsigned char *bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < length; i++)
+            seed = (seed ^ bytes[i]) * 1099511628211ull;
+        return seed;
+    }
+
+    uint64_t hashString(const GLubyte *string, uint64_t seed) {
+        const char *text = string ? (const char*)string : "";
+        return hash(text, std::char_traits<char>::length(text) + 1, seed);
+    }
+
+    const uint32_t CACHE_MAGIC = 0x504C474F; // "OGLP"
+    const uint32_t CACHE_VERSION = 1;
+
+    // Followed by 'length' bytes of binary.
+    struct CacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;       // Hash of the sources and the driver, anything else means the binary is stale.
+        uint32_t format;    // As glGetProgramBinary reported it.
+        uint32_t length;
+    };
+
+    // The program from the cache file, or 0 if there's none for 'key' or the driver won't take it.
+    unsigned int loadBinary(std::string const &cachePath, uint64_t key) {
+        std::ifstream stream(cachePath, std::ios::binary);
+        CacheHeader header;
+        if (!stream || !stream.read((char*)&header, sizeof(header)))
+            return 0;
+        if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.key != key)
+            return 0;
+
+        std::vector<char> binary(header.length);
+        if (!stream.read(binary.data(), header.length))
+            return 0;
+
+        unsigned int program = glCreateProgram();
+        glProgramBinary(program, header.format, binary.data(), header.length);
+
+        // Drivers can still refuse a binary the key didn't catch (an update that kept the version string).
+        int success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
+    }
+
+    void saveBinary(std::string const &cachePath, uint64_t key, unsigned int program) {
+        int length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLenum format;
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+
+        CacheHeader header = { CACHE_MAGIC, CACHE_VERSION, key, format, (uint32_t)length };
+        std::ofstream stream(cachePath, std::ios::binary | std::ios::trunc);
+        if (!stream) {
+            std::cerr << "Couldn't write program cache " << cachePath << std::endl;
+            return;
+        }
+        stream.write((const char*)&header, sizeof(header));
+        stream.write(binary.data(), length);
+    }
+
+    // Hash of everything that makes a binary valid: the stages, their sources and the driver.
+    uint64_t programKey(std::vector<ShaderFile> const &files, std::vector<std::string> const &sources) {
+        uint64_t key = hash(&CACHE_VERSION, sizeof(CACHE_VERSION));
+        for (size_t i = 0; i < files.size(); i++) {
+            key = hash(&files[i].type, sizeof(files[i].type), key);
+            key = hash(sources[i].data(), sources[i].size(), key);
+        }
+        key = hashString(glGetString(GL_VENDOR), key);
+        key = hashString(glGetString(GL_RENDERER), key);
+        return hashString(glGetString(GL_VERSION), key);
+    }
+
+    // Prints why a program didn't link, the compile log of whichever shader failed or else the link log.
+    void reportErrors(std::vector<ShaderFile> const &files, std::vector<unsigned int> const &shaders, unsigned int program) {
+        char infoLog[512];
+        for (size_t i = 0; i < shaders.size(); i++) {
+            int success;
+            glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &success);
+            if (!success) {
+                glGetShaderInfoLog(shaders[i], 512, NULL, infoLog);
+                std::cerr << "Error compiling shader at " << files[i].path << ": " << infoLog << std::endl;
+                return;
+            }
+        }
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cerr << "Error linking program: " << infoLog << std::endl;
+    }
+
+    // Several programs at once. Every compile and link is issued before any status is queried, so the driver gets to
+    // work through the whole batch together, on its own threads with GL_KHR_parallel_shader_compile. Cache hits skip all
+    // of that. Returns a program (or -1) per entry, in order.
+    std::vector<unsigned int> loadPrograms(std::vector<std::vector<ShaderFile>> const &programs, std::vector<bool> *cached = nullptr) {
+        bool binaries = binariesSupported();
+        parallelCompile();
+
+        std::vector<unsigned int> result(programs.size(), (unsigned int)-1);
+        std::vector<uint64_t> keys(programs.size());
+        std::vector<std::vector<unsigned int>> shaders(programs.size());
+        if (cached)
+            cached->assign(programs.size(), false);
+
+        // Cache hits are done straight away, everything else gets its compiles issued without waiting on any of them.
+        for (size_t p = 0; p < programs.size(); p++) {
+            std::vector<ShaderFile> const &files = programs[p];
+            std::vector<std::string> sources(files.size());
+            bool read = !files.empty();
+            for (size_t i = 0; i < files.size() && read; i++)
+                read = readSource(files[i].path, sources[i]);
+            if (!read)
+                continue;
+
+            keys[p] = programKey(files, sources);
+            if (binaries) {
+                unsigned int program = loadBinary(files[0].path + ".program", keys[p]);
+                if (program != 0) {
+                    result[p] = program;
+                    if (cached)
+                        (*cached)[p] = true;
+                    continue;
+                }
+            }
+
+            for (size_t i = 0; i < files.size(); i++) {
+                const char* sourcestr = sources[i].c_str();
+                unsigned int shader = glCreateShader(files[i].type);
+                glShaderSource(shader, 1, &sourcestr, NULL);
+                glCompileShader(shader);
+                shaders[p].push_back(shader);
+            }
+        }
+
+        // Then every link, still without asking. A shader that didn't compile just makes its link fail.
+        for (size_t p = 0; p < programs.size(); p++) {
+            if (shaders[p].empty())
+                continue;
+
+            unsigned int program = glCreateProgram();
+            for (unsigned int shader : shaders[p])
+                glAttachShader(program, shader);
+            // Lets the driver know we'll ask for the binary, some only keep it around when told beforehand.
+            if (binaries)
+                glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            glLinkProgram(program);
+            result[p] = program;
+        }
+
+        // Only now wait on the results, a parallel compiler has had the whole batch to work on by this point.
+        for (size_t p = 0; p < programs.size(); p++) {
+            if (shaders[p].empty())
+                continue;
+
+            int success;
+            glGetProgramiv(result[p], GL_LINK_STATUS, &success);
+            if (!success) {
+                reportErrors(programs[p], shaders[p], result[p]);
+                glDeleteProgram(result[p]);
+                result[p] = -1;
+            }
+            else if (binaries)
+                saveBinary(programs[p][0].path + ".program", keys[p], result[p]);
+
+            for (unsigned int shader : shaders[p])
+                glDeleteShader(shader);
+        }
+        return result;
+    }
+
+    // Builds a program from shader files, e.g. { { GL_VERTEX_SHADER, "shaders/shader.vs" }, { GL_FRAGMENT_SHADER, "shaders/shader.fs" } }.
+    // The linked binary is cached next to the first file ('<path>.program') and later launches load that instead of
+    // compiling, until the sources or the driver change. 'cached' says which happened. Returns -1 on failure.
+    unsigned int loadProgram(std::vector<ShaderFile> const &files, bool *cached = nullptr) {
+        std::vector<bool> wasCached;
+        unsigned int program = loadPrograms({ files }, &wasCached)[0];
+        if (cached)
+            *cached = wasCached[0];
+        return program;
+    }
 }
 
 #endif
\ No newline at end of file
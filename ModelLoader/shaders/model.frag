@@ -8,9 +8,20 @@ uniform sampler2D diffuse_texture1;
 uniform sampler2D specular_texture1;
 uniform sampler2D normal_texture1;
 
+#ifdef PLAIN_UNIFORMS
 uniform vec3 lightDir;
 uniform vec3 viewPos;
 uniform vec3 lightColor;
+#else
+layout (std140) uniform Frame {  // See UniformBlocks.h
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	vec3 viewPos;
+	vec3 lightDir;
+	vec3 lightColor;
+};
+#endif
 
 out vec4 fragCol;
 
@@ -18,7 +29,6 @@ void main() {
 
 	// Texture colours at our fragment
 	vec3 diffuseTex = texture(diffuse_texture1, uv).rgb;
-	vec3 specularTex = texture(specular_texture1, uv).rgb;
 
 	float ambient = 0.2f;
 	vec3 ambientCol = ambient * diffuseTex;
@@ -29,11 +39,16 @@ void main() {
 	float diffuse = max(dot(norm, lightdir), 0);
 	vec3 diffuseCol = diffuse * diffuseTex;
 
+	fragCol = vec4(ambientCol, 1.0) + vec4(diffuseCol, 1.0);
+
+	// Only meshes with a specular map get highlights, the rest skip the texture fetch and the maths.
+#ifdef HAS_SPECULAR_MAP
+	vec3 specularTex = texture(specular_texture1, uv).rgb;
 	vec3 viewdir = normalize(viewPos - fragPos);
 	vec3 reflected = reflect(-lightdir, norm);  // From light source to fragment
 	float specular = max(pow(dot(reflected, viewdir), 32.0), 0);
 	vec3 specularCol = specular * specularTex;
-
-	fragCol = vec4(ambientCol, 1.0) + vec4(diffuseCol, 1.0) + vec4(specularCol, 1.0);
+	fragCol += vec4(specularCol, 1.0);
+#endif
 	fragCol *= vec4(lightColor, 1.0);
 }
\ No newline at end of file
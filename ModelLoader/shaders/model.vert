@@ -1,19 +1,44 @@
 #version 330 core
 
 layout (location = 0) in vec3 inPos;
-layout (location = 1) in vec3 inNorm;
+layout (location = 1) in vec3 inNorm;  // Only xy with packed normals.
 layout (location = 2) in vec2 inUv;
 
+// PLAIN_UNIFORMS is only for the benchmarks, to compare against setting each uniform on each program.
+#ifdef PLAIN_UNIFORMS
 uniform mat4 mvp;
 uniform mat4 model;
+#else
+layout (std140) uniform Object {  // See UniformBlocks.h
+	mat4 mvp;
+	mat4 model;
+};
+#endif
+
+// Packed vertices store positions in [0, 1] across the mesh bounds, see VertexPacking.h.
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionOffset = vec3(0.0);
+uniform bool packedNormals = false;
 
 out vec2 uv;
 out vec3 normal;
 out vec3 fragPos;
 
+// Unfolds an octahedral encoded normal back onto the sphere.
+vec3 octDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
 void main() {
-	gl_Position = mvp * vec4(inPos, 1.0);
+	vec3 pos = positionOffset + inPos * positionScale;
+	vec3 norm = packedNormals ? octDecode(inNorm.xy) : inNorm;
+
+	gl_Position = mvp * vec4(pos, 1.0);
 	uv = inUv;
-	normal = mat3(transpose(inverse(model))) * inNorm;  // Normal oriented in world space
-	fragPos = vec3(model * vec4(inPos, 1.0));  // Vertex position in world space
-}
\ No newline at end of file
+	normal = mat3(transpose(inverse(model))) * norm;  // Normal oriented in world space
+	fragPos = vec3(model * vec4(pos, 1.0));  // Vertex position in world space
+}
@@ -0,0 +1,103 @@
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/*
+* Replaces the global operator new/delete to count heap allocations, so benchmarks can report allocations per frame.
+* Each block carries its size in a header in front of it, so the bytes still allocated and their peak are tracked too.
+* That costs every allocation in the program (Assimp's included) a few atomics and 16 bytes, so the replacement is
+* only compiled into benchmark builds: define COUNT_ALLOCATIONS for them. Without it the counters stay at 0.
+* Only include this from one translation unit (Main.cpp).
+*/
+namespace Allocations {
+#ifdef COUNT_ALLOCATIONS
+	const bool counted = true;
+#else
+	const bool counted = false;
+#endif
+
+	std::atomic<unsigned long long> count(0);
+	std::atomic<unsigned long long> bytes(0);
+	std::atomic<long long> live(0);  // Bytes allocated and not freed yet.
+	std::atomic<long long> peak(0);  // Most of 'live' since resetPeak().
+
+	// Big enough to keep the block after it aligned like malloc's.
+	const size_t HEADER = alignof(std::max_align_t);
+
+	void reset() {
+		count = 0;
+		bytes = 0;
+	}
+
+	void resetPeak() {
+		peak = live.load();
+	}
+}
+
+#ifdef COUNT_ALLOCATIONS
+void *operator new(size_t size) {
+	Allocations::count++;
+	Allocations::bytes += size;
+	long long live = Allocations::live += (long long)size;
+	long long peak = Allocations::peak.load();
+	while (live > peak && !Allocations::peak.compare_exchange_weak(peak, live));
+
+	if (unsigned char *memory = (unsigned char*)std::malloc(size + Allocations::HEADER)) {
+		*(size_t*)memory = size;
+		return memory + Allocations::HEADER;
+	}
+	Allocations::live -= (long long)size;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+	if (!memory)
+		return;
+	unsigned char *block = (unsigned char*)memory - Allocations::HEADER;
+	Allocations::live -= (long long)*(size_t*)block;
+	std::free(block);
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete[](void *memory) noexcept {
+	operator delete(memory);
+}
+
+// The rest have to go through the ones above too, or they'd free blocks without the header.
+void operator delete(void *memory, size_t) noexcept {
+	operator delete(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept {
+	operator delete(memory);
+}
+
+void *operator new(size_t size, std::nothrow_t const&) noexcept {
+	try {
+		return operator new(size);
+	}
+	catch (std::bad_alloc const&) {
+		return nullptr;
+	}
+}
+
+void *operator new[](size_t size, std::nothrow_t const&) noexcept {
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void *memory, std::nothrow_t const&) noexcept {
+	operator delete(memory);
+}
+
+void operator delete[](void *memory, std::nothrow_t const&) noexcept {
+	operator delete(memory);
+}
+#endif
+
+#endif
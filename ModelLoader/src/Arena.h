@@ -0,0 +1,260 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+* Bump allocator for memory that all dies at once: a frame's transient data, or the scratch space of one mesh's
+* import. allocate() moves a pointer along a block, nothing is freed on its own. reset() frees everything, mark() and
+* rewind() everything since the mark. Blocks come from the heap as needed and are kept, and a reset after the arena
+* needed more than one block swaps them for one big enough for all of it, so a steady workload stops touching the heap.
+* Not thread safe, give each thread its own.
+*/
+class LinearArena {
+	struct Block {
+		unsigned char *memory;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	size_t block = 0;   // Block being allocated from.
+	size_t offset = 0;  // Into it.
+	size_t blockSize;
+	size_t usedBefore = 0;  // Bytes in the blocks before 'block'.
+	size_t peakUsed = 0;
+	unsigned long long heapAllocations = 0;
+
+	void addBlock(size_t size) {
+		blocks.push_back({ (unsigned char*)::operator new(size), size });
+		heapAllocations++;
+	}
+
+	void freeBlocks() {
+		for (Block &b : blocks)
+			::operator delete(b.memory);
+		blocks.clear();
+	}
+public:
+	struct Marker {
+		size_t block, offset, usedBefore;
+	};
+
+	explicit LinearArena(size_t blockSize = 1 << 20): blockSize(blockSize) {}
+
+	LinearArena(LinearArena const&) = delete;
+	LinearArena &operator=(LinearArena const&) = delete;
+
+	~LinearArena() {
+		freeBlocks();
+	}
+
+	// 'alignment' has to be a power of two.
+	void *allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+		while (true) {
+			if (block < blocks.size()) {
+				uintptr_t base = (uintptr_t)blocks[block].memory;
+				size_t aligned = ((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+				if (aligned + size <= blocks[block].size) {
+					offset = aligned + size;
+					peakUsed = std::max(peakUsed, usedBefore + offset);
+					return blocks[block].memory + aligned;
+				}
+				// Doesn't fit, whatever is left of this block goes unused until the next reset.
+				usedBefore += blocks[block].size;
+				block++;
+				offset = 0;
+				if (block < blocks.size())
+					continue;
+			}
+			addBlock(std::max(blockSize, size + alignment));
+		}
+	}
+
+	template <typename T>
+	T *allocate(size_t count) {
+		return (T*)allocate(count * sizeof(T), alignof(T));
+	}
+
+	Marker mark() const {
+		return { block, offset, usedBefore };
+	}
+
+	// Everything allocated since 'marker' is gone, the blocks stay for reuse.
+	void rewind(Marker const &marker) {
+		block = marker.block;
+		offset = marker.offset;
+		usedBefore = marker.usedBefore;
+	}
+
+	void reset() {
+		if (blocks.size() > 1) {
+			size_t total = 0;
+			for (Block const &b : blocks)
+				total += b.size;
+			freeBlocks();
+			addBlock(total);
+		}
+		block = offset = usedBefore = 0;
+	}
+
+	// Bytes handed out since the last reset, counting what was skipped at the end of full blocks.
+	size_t used() const {
+		return usedBefore + offset;
+	}
+
+	// Most bytes ever in use at once, and the heap allocations made for blocks, since the arena was made.
+	size_t peak() const {
+		return peakUsed;
+	}
+
+	unsigned long long blockAllocations() const {
+		return heapAllocations;
+	}
+};
+
+// Rewinds the arena to where it was when the scope started.
+class ArenaScope {
+	LinearArena *arena;
+	LinearArena::Marker marker;
+public:
+	explicit ArenaScope(LinearArena *arena): arena(arena) {
+		if (arena)
+			marker = arena->mark();
+	}
+
+	ArenaScope(ArenaScope const&) = delete;
+	ArenaScope &operator=(ArenaScope const&) = delete;
+
+	~ArenaScope() {
+		if (arena)
+			arena->rewind(marker);
+	}
+};
+
+/*
+* Arenas lent out to jobs. A job takes one for as long as it runs (PooledArena) and it comes back reset, so no two jobs
+* ever share one, whatever threads they end up on. There are only ever as many as were in use at once.
+*/
+class ArenaPool {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<LinearArena>> arenas;
+	std::vector<LinearArena*> available;
+	size_t blockSize;
+public:
+	explicit ArenaPool(size_t blockSize = 1 << 20): blockSize(blockSize) {}
+
+	ArenaPool(ArenaPool const&) = delete;
+	ArenaPool &operator=(ArenaPool const&) = delete;
+
+	LinearArena *acquire() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (available.empty()) {
+			arenas.emplace_back(new LinearArena(blockSize));
+			return arenas.back().get();
+		}
+		LinearArena *arena = available.back();
+		available.pop_back();
+		return arena;
+	}
+
+	void release(LinearArena *arena) {
+		arena->reset();
+		std::lock_guard<std::mutex> lock(mutex);
+		available.push_back(arena);
+	}
+
+	// Biggest peak of any of the arenas. Only while none are lent out.
+	size_t peak() const {
+		size_t most = 0;
+		for (auto const &arena : arenas)
+			most = std::max(most, arena->peak());
+		return most;
+	}
+};
+
+// An arena from a pool for the length of a scope. No arena (nullptr) without a pool.
+class PooledArena {
+	ArenaPool *pool;
+	LinearArena *arena;
+public:
+	explicit PooledArena(ArenaPool *pool): pool(pool), arena(pool ? pool->acquire() : nullptr) {}
+
+	PooledArena(PooledArena const&) = delete;
+	PooledArena &operator=(PooledArena const&) = delete;
+
+	~PooledArena() {
+		if (pool)
+			pool->release(arena);
+	}
+
+	LinearArena *get() const {
+		return arena;
+	}
+};
+
+/*
+* Standard allocator on top of a LinearArena, so standard containers can live in one. deallocate() does nothing,
+* the memory comes back when the arena is reset or rewound, which the container mustn't outlive. Without an arena it's
+* a plain heap allocator, so code can take an optional arena without two versions of every container.
+*/
+template <typename T>
+class ArenaAllocator {
+	template <typename U> friend class ArenaAllocator;
+	LinearArena *arena;
+public:
+	typedef T value_type;
+	// Containers take the arena along when moved or swapped, so one can be pointed at another arena by assigning to it.
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	ArenaAllocator(LinearArena *arena = nullptr): arena(arena) {}
+
+	template <typename U>
+	ArenaAllocator(ArenaAllocator<U> const &other): arena(other.arena) {}
+
+	T *allocate(size_t count) {
+		if (arena)
+			return arena->allocate<T>(count);
+		return (T*)::operator new(count * sizeof(T));
+	}
+
+	void deallocate(T *memory, size_t) {
+		if (!arena)
+			::operator delete(memory);
+	}
+
+	// Elements made without a value are default initialised, not zeroed: resize(n) on a vector of ints leaves them
+	// as whatever was in the memory, like new int[n]. Lists that are written before they're read (a draw's visible
+	// list) skip a fill that way. Give a value where zeros are needed, resize(n, 0).
+	template <typename U>
+	void construct(U *memory) {
+		::new((void*)memory) U;
+	}
+
+	template <typename U, typename... Args>
+	void construct(U *memory, Args&&... args) {
+		::new((void*)memory) U(std::forward<Args>(args)...);
+	}
+
+	template <typename U>
+	bool operator==(ArenaAllocator<U> const &other) const {
+		return arena == other.arena;
+	}
+
+	template <typename U>
+	bool operator!=(ArenaAllocator<U> const &other) const {
+		return arena != other.arena;
+	}
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
@@ -0,0 +1,1269 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <random>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "Model.h"
+#include "Jobs.h"
+#include "MeshOptimizer.h"
+#include "IndexCodec.h"
+#include "Frustum.h"
+#include "ShaderProgram.h"
+#include "ShaderRegistry.h"
+#include "UniformBlocks.h"
+#include "GLCounter.h"
+#include "Allocations.h"
+#include "Timer.h"
+
+/*
+* Benchmarks for the model loader, run with 'ModelLoader --bench <name>' once a GL context exists.
+*/
+namespace Benchmark {
+	// Cold = Assimp import + writing the cache, warm = building straight from the memory mapped cache.
+	void modelLoad(std::string const &path, int runs = 5) {
+		double cold = 0, warm = 0;
+
+		for (int i = 0; i < runs; i++) {
+			std::remove((path + ".cache").c_str());
+			Timer timer;
+			Model model(path);
+			glFinish();
+			cold += timer.elapsedMs();
+			model.destroy();
+		}
+
+		for (int i = 0; i < runs; i++) {
+			Timer timer;
+			Model model(path);
+			glFinish();
+			warm += timer.elapsedMs();
+			model.destroy();
+		}
+
+		std::cout << "Model load '" << path << "' over " << runs << " runs" << std::endl;
+		std::cout << "  cold (import): " << cold / runs << " ms" << std::endl;
+		std::cout << "  warm (cache):  " << warm / runs << " ms" << std::endl;
+	}
+
+	// Writes an OBJ with 'meshCount' separate objects, each a grid of 2 * gridSize^2 triangles.
+	bool writeSyntheticObj(std::string const &path, int meshCount, int gridSize) {
+		std::ofstream stream(path);
+		if (!stream)
+			return false;
+
+		int verticesPerMesh = (gridSize + 1) * (gridSize + 1);
+		for (int m = 0; m < meshCount; m++) {
+			stream << "o mesh" << m << "\n";
+			float offsetX = (m % 32) * 1.5f, offsetZ = (m / 32) * 1.5f;
+			for (int y = 0; y <= gridSize; y++) {
+				for (int x = 0; x <= gridSize; x++) {
+					float u = (float)x / gridSize, v = (float)y / gridSize;
+					stream << "v " << offsetX + u << " " << 0.1f * (x % 2) << " " << offsetZ + v << "\n";
+					stream << "vt " << u << " " << v << "\n";
+				}
+			}
+			stream << "vn 0 1 0\n";
+
+			// OBJ indices are 1 based and global across the whole file.
+			int base = m * verticesPerMesh + 1;
+			for (int y = 0; y < gridSize; y++) {
+				for (int x = 0; x < gridSize; x++) {
+					int i0 = base + y * (gridSize + 1) + x, i1 = i0 + 1, i2 = i0 + gridSize + 1, i3 = i2 + 1;
+					stream << "f " << i0 << "/" << i0 << "/" << m + 1 << " " << i1 << "/" << i1 << "/" << m + 1 << " " << i3 << "/" << i3 << "/" << m + 1 << "\n";
+					stream << "f " << i0 << "/" << i0 << "/" << m + 1 << " " << i3 << "/" << i3 << "/" << m + 1 << " " << i2 << "/" << i2 << "/" << m + 1 << "\n";
+				}
+			}
+		}
+
+		return (bool)stream;
+	}
+
+	// Load time of a many mesh OBJ as the mesh processing goes from 1 to N threads.
+	void threadScaling(int meshCount = 512, int gridSize = 24, int runs = 3) {
+		std::string path = "assets/synthetic.obj";
+		if (!writeSyntheticObj(path, meshCount, gridSize)) {
+			std::cout << "Couldn't write '" << path << "'" << std::endl;
+			return;
+		}
+
+		std::cout << "Mesh processing of " << meshCount << " meshes (" << 2 * gridSize * gridSize << " triangles each)" << std::endl;
+		double singleThreaded = 0;
+		unsigned int maxThreads = Jobs::defaultThreads();
+		for (unsigned int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2) {
+			ModelOptions options;
+			options.useCache = false;
+			options.threads = threads;
+
+			ModelLoadTimes total;
+			for (int i = 0; i < runs; i++) {
+				Model model(path, options);
+				ModelLoadTimes times = model.getLoadTimes();
+				total.import += times.import;
+				total.process += times.process;
+				total.upload += times.upload;
+				model.destroy();
+			}
+
+			double process = total.process / runs;
+			if (threads == 1)
+				singleThreaded = process;
+
+			std::cout << "  " << threads << " threads: process " << process << " ms (" << singleThreaded / process << "x), import "
+				<< total.import / runs << " ms, upload " << total.upload / runs << " ms" << std::endl;
+		}
+
+		std::remove(path.c_str());
+	}
+
+	std::vector<Shaders::ShaderFile> modelFiles() {
+		return { { GL_VERTEX_SHADER, "shaders/model.vert" }, { GL_FRAGMENT_SHADER, "shaders/model.frag" } };
+	}
+
+	// The full variant, with specular and plain uniforms, so the numbers stay comparable with older runs.
+	unsigned int modelProgram() {
+		return Shaders::loadProgram(Shaders::withDefines(modelFiles(), { "HAS_SPECULAR_MAP", "PLAIN_UNIFORMS" }));
+	}
+
+	// What Mesh::draw used to do every frame: build each sampler name and look it up.
+	void legacySamplerLookups(unsigned int program, Model const &model) {
+		for (const Mesh &mesh : model.getMeshes()) {
+			const std::vector<Texture> &textures = mesh.getTextures();
+			int diffuse = 1, specular = 1, normal = 1, height = 1;
+			for (int i = 0; i < textures.size(); i++) {
+				std::string type = "";
+				int num = 0;
+				if (textures[i].type == Texture::DIFFUSE) { type = "diffuse"; num = diffuse++; }
+				else if (textures[i].type == Texture::SPECULAR) { type = "specular"; num = specular++; }
+				else if (textures[i].type == Texture::NORMAL) { type = "normal"; num = normal++; }
+				else if (textures[i].type == Texture::HEIGHT) { type = "height"; num = height++; }
+
+				glUniform1i(glGetUniformLocation(program, (type + "_texture" + std::to_string(num)).c_str()), Mesh::samplerUnit(textures[i].type, num));
+			}
+		}
+	}
+
+	// GL calls, heap allocations and CPU time per frame of the backpack scene, looking uniforms up every frame vs cached.
+	void uniformLookups(int frames = 500) {
+		Model model("assets/backpack/backpack.obj");
+		unsigned int program = modelProgram();
+		Shaders::Uniforms uniforms(program);
+		int mvpLocation = uniforms["mvp"], modelLocation = uniforms["model"];
+		int lightDirLocation = uniforms["lightDir"], viewPosLocation = uniforms["viewPos"], lightColorLocation = uniforms["lightColor"];
+		Mesh::bindSamplers(program);
+
+		glm::mat4 projection = glm::perspective(45.0f, 1.2f, 0.1f, 50.0f);
+		glm::mat4 view = glm::lookAt(glm::vec3(0, 0.2f, 2.5f), glm::vec3(0, 0.2f, 0), glm::vec3(0, 1, 0));
+		glm::mat4 modelMatrix = glm::mat4(1.0f);
+		glm::mat4 mvp = projection * view * modelMatrix;
+		glm::vec3 lightDir(-0.2f, -1.0f, -0.3f), lightColor(0.5f, 0.68f, 0.65f), viewPos(0, 0.2f, 2.5f);
+
+		GLCounter::install();
+		std::cout << "Uniform lookups over " << frames << " frames of '" << "assets/backpack/backpack.obj" << "' (per frame)" << std::endl;
+		if (!Allocations::counted)
+			std::cout << "  Allocations aren't counted, build with COUNT_ALLOCATIONS defined for them" << std::endl;
+
+		for (int cached = 0; cached <= 1; cached++) {
+			glFinish();
+			GLCounter::reset();
+			Allocations::reset();
+			Timer timer;
+
+			for (int f = 0; f < frames; f++) {
+				glUseProgram(program);
+				if (cached) {
+					glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, &mvp[0][0]);
+					glUniformMatrix4fv(modelLocation, 1, GL_FALSE, &modelMatrix[0][0]);
+					glUniform3fv(lightDirLocation, 1, &lightDir[0]);
+					glUniform3fv(viewPosLocation, 1, &viewPos[0]);
+					glUniform3fv(lightColorLocation, 1, &lightColor[0]);
+				}
+				else {
+					glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
+					glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, &modelMatrix[0][0]);
+					glUniform3fv(glGetUniformLocation(program, "lightDir"), 1, &lightDir[0]);
+					glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, &viewPos[0]);
+					glUniform3fv(glGetUniformLocation(program, "lightColor"), 1, &lightColor[0]);
+					legacySamplerLookups(program, model);
+				}
+				model.draw();
+			}
+
+			double ms = timer.elapsedMs();
+			unsigned long long allocations = Allocations::count;
+			glFinish();
+
+			std::cout << "  " << (cached ? "cached" : "per frame lookups") << ": " << ms / frames << " ms CPU";
+			if (Allocations::counted)
+				std::cout << ", " << (double)allocations / frames << " allocations";
+			std::cout << std::endl;
+			GLCounter::print(frames);
+		}
+
+		model.destroy();
+		glDeleteProgram(program);
+	}
+
+	// Draws a model for a number of frames and reports CPU time and GL calls per frame.
+	void drawFrames(Model &model, unsigned int program, int frames) {
+		glUseProgram(program);
+		model.draw();  // Warm up, the first draw can include driver work we don't want to time.
+		glFinish();
+
+		GLCounter::reset();
+		Timer timer;
+		for (int f = 0; f < frames; f++)
+			model.draw();
+		double ms = timer.elapsedMs();
+		glFinish();
+
+		std::cout << "    CPU: " << ms / frames << " ms per frame" << std::endl;
+		GLCounter::print(frames);
+	}
+
+	// One VAO/VBO/EBO per mesh vs every mesh in one shared arena, on the backpack and a many mesh scene.
+	void bufferLayout(int frames = 300) {
+		std::string synthetic = "assets/synthetic.obj";
+		writeSyntheticObj(synthetic, 2048, 4);
+
+		unsigned int program = modelProgram();
+		Mesh::bindSamplers(program);
+		GLCounter::install();
+
+		std::string paths[] = { "assets/backpack/backpack.obj", synthetic };
+		for (std::string const &path : paths) {
+			for (int shared = 0; shared <= 1; shared++) {
+				ModelOptions options;
+				options.useCache = false;
+				options.sharedBuffers = shared;
+
+				Model model(path, options);
+				std::cout << "'" << path << "' (" << model.meshCount() << " meshes), " << (shared ? "shared arena" : "per mesh buffers") << std::endl;
+				drawFrames(model, program, frames);
+				model.destroy();
+			}
+		}
+
+		glDeleteProgram(program);
+		std::remove(synthetic.c_str());
+	}
+
+	// Per mesh draws vs multi draw indirect on scenes with thousands of meshes.
+	void submission(int frames = 300) {
+		if (!GLAD_GL_VERSION_4_3) {
+			std::cout << "Multi draw indirect needs GL 4.3" << std::endl;
+			return;
+		}
+
+		std::string synthetic = "assets/synthetic.obj";
+		unsigned int program = modelProgram();
+		Mesh::bindSamplers(program);
+		GLCounter::install();
+
+		int meshCounts[] = { 1024, 4096, 8192 };
+		for (int meshCount : meshCounts) {
+			writeSyntheticObj(synthetic, meshCount, 2);
+			ModelOptions options;
+			options.useCache = false;
+			Model model(synthetic, options);
+
+			Model::Submission modes[] = { Model::PER_MESH, Model::MULTI_DRAW_INDIRECT };
+			for (Model::Submission mode : modes) {
+				model.setSubmission(mode);
+				std::cout << model.meshCount() << " meshes, " << (mode == Model::PER_MESH ? "per mesh draws" : "multi draw indirect") << std::endl;
+				drawFrames(model, program, frames);
+			}
+			model.destroy();
+		}
+
+		glDeleteProgram(program);
+		std::remove(synthetic.c_str());
+	}
+
+	// A flat grid of 2 * size^2 triangles, optionally with the triangles shuffled like a badly exported mesh.
+	MeshData gridMesh(int size, bool shuffle) {
+		MeshData mesh;
+		for (int y = 0; y <= size; y++) {
+			for (int x = 0; x <= size; x++) {
+				Vertex v;
+				v.position = glm::vec3((float)x / size, 0.0f, (float)y / size);
+				v.normal = glm::vec3(0, 1, 0);
+				v.uv = glm::vec2((float)x / size, (float)y / size);
+				mesh.vertices.push_back(v);
+			}
+		}
+
+		std::vector<unsigned int> triangles;
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				unsigned int i0 = y * (size + 1) + x, i1 = i0 + 1, i2 = i0 + size + 1, i3 = i2 + 1;
+				triangles.push_back(mesh.indices.size());
+				mesh.indices.insert(mesh.indices.end(), { i0, i1, i3 });
+				triangles.push_back(mesh.indices.size());
+				mesh.indices.insert(mesh.indices.end(), { i0, i3, i2 });
+			}
+		}
+
+		if (shuffle) {
+			std::mt19937 random(1234);
+			std::shuffle(triangles.begin(), triangles.end(), random);
+			std::vector<unsigned int> shuffled;
+			for (unsigned int t : triangles)
+				shuffled.insert(shuffled.end(), mesh.indices.begin() + t, mesh.indices.begin() + t + 3);
+			mesh.indices.swap(shuffled);
+		}
+		return mesh;
+	}
+
+	// A UV sphere, emitted ring by ring (Assimp's usual order for generated geometry).
+	MeshData sphereMesh(int rings, int segments) {
+		MeshData mesh;
+		for (int r = 0; r <= rings; r++) {
+			float theta = 3.14159265f * r / rings;
+			for (int s = 0; s <= segments; s++) {
+				float phi = 2.0f * 3.14159265f * s / segments;
+				Vertex v;
+				v.normal = glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+				v.position = v.normal;
+				v.uv = glm::vec2((float)s / segments, (float)r / rings);
+				mesh.vertices.push_back(v);
+			}
+		}
+
+		for (int r = 0; r < rings; r++) {
+			for (int s = 0; s < segments; s++) {
+				unsigned int i0 = r * (segments + 1) + s, i1 = i0 + 1, i2 = i0 + segments + 1, i3 = i2 + 1;
+				mesh.indices.insert(mesh.indices.end(), { i0, i2, i1, i1, i2, i3 });
+			}
+		}
+		return mesh;
+	}
+
+	// ACMR/ATVR before and after each pass of MeshOptimizer on synthetic meshes, plus how long the passes take, then
+	// what the whole pass does to the backpack as imported (which needs the GL context, for the model's buffers).
+	void meshOptimization(int runs = 5) {
+		struct Case {
+			const char *name;
+			MeshData mesh;
+		};
+		Case cases[] = {
+			{ "grid 64 (in order)", gridMesh(64, false) },
+			{ "grid 64 (shuffled)", gridMesh(64, true) },
+			{ "grid 256 (shuffled)", gridMesh(256, true) },
+			{ "sphere 128x256", sphereMesh(128, 256) },
+		};
+
+		std::cout << "Mesh optimization, " << MeshOptimizer::FIFO_CACHE_SIZE << " entry FIFO cache, best of " << runs << " runs" << std::endl;
+		for (Case const &test : cases) {
+			unsigned int vertexCount = test.mesh.vertices.size();
+			double cacheMs = 1e9, overdrawMs = 1e9, fetchMs = 1e9;
+			MeshOptimizer::Stats before = MeshOptimizer::analyze(test.mesh.indices, vertexCount), afterCache, afterOverdraw;
+
+			for (int i = 0; i < runs; i++) {
+				MeshData mesh = test.mesh;
+				Timer timer;
+				mesh.indices = MeshOptimizer::optimizeVertexCache(mesh.indices, vertexCount);
+				cacheMs = std::min(cacheMs, timer.elapsedMs());
+				afterCache = MeshOptimizer::analyze(mesh.indices, vertexCount);
+
+				timer.reset();
+				mesh.indices = MeshOptimizer::optimizeOverdraw(mesh.indices, mesh.vertices);
+				overdrawMs = std::min(overdrawMs, timer.elapsedMs());
+				afterOverdraw = MeshOptimizer::analyze(mesh.indices, vertexCount);
+
+				timer.reset();
+				MeshOptimizer::optimizeVertexFetch(mesh.vertices, mesh.indices);
+				fetchMs = std::min(fetchMs, timer.elapsedMs());
+			}
+
+			std::cout << "  " << test.name << ", " << test.mesh.indices.size() / 3 << " triangles" << std::endl;
+			std::cout << "    ACMR " << before.acmr << " -> " << afterCache.acmr << " (cache) -> " << afterOverdraw.acmr << " (overdraw)"
+				<< ", ATVR " << before.atvr << " -> " << afterOverdraw.atvr << std::endl;
+			std::cout << "    cache " << cacheMs << " ms, overdraw " << overdrawMs << " ms, fetch " << fetchMs << " ms" << std::endl;
+		}
+
+		// The whole pass on real data, as the sample imports it.
+		std::string path = "assets/backpack/backpack.obj";
+		ModelOptions options;
+		options.useCache = false;
+		options.optimizeMeshes = true;
+		Model model(path, options);
+		ModelOptimizeStats stats = model.getOptimizeStats();
+		std::cout << "  '" << path << "', " << model.meshCount() << " meshes, " << stats.triangles << " triangles" << std::endl;
+		std::cout << "    ACMR " << stats.before.acmr << " -> " << stats.after.acmr << ", ATVR " << stats.before.atvr << " -> " << stats.after.atvr << std::endl;
+		model.destroy();
+	}
+
+	// Float vs packed vertices: buffer sizes, what the packing costs in accuracy, and draw time.
+	void vertexFormats(int frames = 300) {
+		unsigned int program = modelProgram();
+		Mesh::bindSamplers(program);
+		GLCounter::install();
+
+		std::string synthetic = "assets/synthetic.obj";
+		writeSyntheticObj(synthetic, 256, 32);
+
+		std::string paths[] = { "assets/backpack/backpack.obj", synthetic };
+		for (std::string const &path : paths) {
+			size_t floatBytes = 0;
+			VertexFormat formats[] = { FLOAT_VERTICES, PACKED_VERTICES };
+			for (VertexFormat format : formats) {
+				ModelOptions options;
+				options.useCache = false;
+				options.vertexFormat = format;
+				Model model(path, options);
+				model.bindUniforms(program);
+
+				if (format == FLOAT_VERTICES)
+					floatBytes = model.vertexBytes();
+				std::cout << "'" << path << "', " << (format == PACKED_VERTICES ? "packed" : "float") << " vertices: "
+					<< model.vertexBytes() / 1024 << " KB vertices (" << 100.0 * model.vertexBytes() / floatBytes << "%), "
+					<< model.indexBytes() / 1024 << " KB indices" << std::endl;
+				if (format == PACKED_VERTICES)
+					model.getPackingError().print();
+				drawFrames(model, program, frames);
+				model.destroy();
+			}
+		}
+
+		glDeleteProgram(program);
+		std::remove(synthetic.c_str());
+	}
+
+	// Size of a file in bytes, 0 if it's missing.
+	uint64_t fileSize(std::string const &path) {
+		uint64_t size = 0;
+		int64_t time;
+		MeshCache::sourceStamp(path, size, time);
+		return size;
+	}
+
+	// Narrowest index type per mesh vs always 32 bit, then the compressed cache encoding: ratio, decode speed and warm loads.
+	void indexFormats(int frames = 300, int runs = 10) {
+		unsigned int program = modelProgram();
+		Mesh::bindSamplers(program);
+		GLCounter::install();
+
+		std::string synthetic = "assets/synthetic.obj";
+		writeSyntheticObj(synthetic, 1024, 8);
+
+		std::string paths[] = { "assets/backpack/backpack.obj", synthetic };
+		for (std::string const &path : paths) {
+			size_t wideBytes = 0;
+			for (int narrow = 0; narrow <= 1; narrow++) {
+				ModelOptions options;
+				options.useCache = false;
+				options.narrowIndices = narrow;
+				Model model(path, options);
+
+				if (!narrow)
+					wideBytes = model.indexBytes();
+				std::cout << "'" << path << "', " << (narrow ? "narrowest" : "32 bit") << " indices: " << model.indexBytes() / 1024 << " KB ("
+					<< 100.0 * model.indexBytes() / wideBytes << "%)" << std::endl;
+				drawFrames(model, program, frames);
+				model.destroy();
+			}
+		}
+
+		// Codec on its own, raw Assimp style order vs after MeshOptimizer has put the vertices in first use order.
+		std::cout << "Index compression, best of " << runs << " decodes" << std::endl;
+		for (int optimized = 0; optimized <= 1; optimized++) {
+			MeshData mesh = gridMesh(256, true);
+			if (optimized) {
+				MeshOptimizer::Stats before, after;
+				MeshOptimizer::optimize(mesh, before, after);
+			}
+
+			std::vector<unsigned char> encoded = IndexCodec::encode(mesh.indices.data(), mesh.indices.size());
+			std::vector<unsigned int> decoded(mesh.indices.size());
+			double best = 1e9;
+			for (int i = 0; i < runs; i++) {
+				Timer timer;
+				IndexCodec::decode(encoded.data(), encoded.size(), decoded.data(), decoded.size(), mesh.vertices.size());
+				best = std::min(best, timer.elapsedMs());
+			}
+
+			double rawBytes = mesh.indices.size() * sizeof(unsigned int);
+			std::cout << "  " << (optimized ? "optimized" : "shuffled ") << " grid: " << (double)encoded.size() / mesh.indices.size() << " bytes per index ("
+				<< 100.0 * encoded.size() / rawBytes << "% of 32 bit), decode " << mesh.indices.size() / best / 1000.0 << " M indices/s, "
+				<< rawBytes / best / 1000.0 << " MB/s" << (decoded == mesh.indices ? "" : " MISMATCH") << std::endl;
+		}
+
+		// Whole cache on the backpack, written then loaded warm.
+		std::string backpack = "assets/backpack/backpack.obj";
+		for (int compressed = 0; compressed <= 1; compressed++) {
+			ModelOptions options;
+			options.compressIndices = compressed;
+			std::remove((backpack + ".cache").c_str());
+			Model(backpack, options).destroy();
+
+			Timer timer;
+			Model model(backpack, options);
+			double ms = timer.elapsedMs();
+			std::cout << "Backpack cache " << (compressed ? "with compressed" : "with raw") << " indices: " << fileSize(backpack + ".cache") / 1024
+				<< " KB, warm load " << ms << " ms (" << model.getLoadTimes().decode << " ms decoding)" << std::endl;
+			model.destroy();
+		}
+		std::remove((backpack + ".cache").c_str());
+
+		glDeleteProgram(program);
+		std::remove(synthetic.c_str());
+	}
+
+	// Flies a camera from right up close to far away from a 5x5 grid of backpacks and back, with and without LODs.
+	// False if any mesh got fewer LODs than asked for, the two runs would draw the same thing then.
+	bool lodPath(int frames = 600) {
+		std::string path = "assets/backpack/backpack.obj";
+		unsigned int program = modelProgram();
+		Mesh::bindSamplers(program);
+		int mvpLocation = glGetUniformLocation(program, "mvp"), modelLocation = glGetUniformLocation(program, "model");
+
+		const float viewportHeight = 1000.0f;
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.2f, 0.1f, 200.0f);
+
+		std::cout << "LOD camera path, " << frames << " frames over a 5x5 grid of '" << path << "'" << std::endl;
+		bool passed = true;
+		unsigned int levels[] = { 0, 4 };
+		for (unsigned int lodLevels : levels) {
+			ModelOptions options;
+			options.useCache = false;
+			options.optimizeMeshes = true;
+			options.lodLevels = lodLevels;
+			Model model(path, options);
+			model.bindUniforms(program);
+
+			unsigned int missingLods = 0;
+			for (Mesh const &mesh : model.getMeshes())
+				missingLods += mesh.lodCount() - 1 < lodLevels;
+			if (missingLods > 0) {
+				std::cout << "  FAILED: " << missingLods << " of " << model.meshCount() << " meshes have fewer than " << lodLevels << " LODs" << std::endl;
+				passed = false;
+			}
+
+			glUseProgram(program);
+			glFinish();
+			unsigned long long totalTriangles = 0;
+			Timer timer;
+			for (int f = 0; f < frames; f++) {
+				// Out to 100 units and back, so every LOD gets its turn.
+				float t = (float)f / (frames - 1);
+				float distance = 2.0f + 98.0f * (1.0f - std::fabs(2.0f * t - 1.0f));
+				glm::vec3 cameraPosition(0.0f, 1.0f, distance);
+				glm::mat4 view = glm::lookAt(cameraPosition, glm::vec3(0.0f), glm::vec3(0, 1, 0));
+
+				unsigned long long frameTriangles = 0;
+				for (int x = -2; x <= 2; x++) {
+					for (int z = -2; z <= 2; z++) {
+						glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x * 4.0f, 0.0f, z * 4.0f));
+						glm::mat4 mvp = projection * view * modelMatrix;
+						glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, &mvp[0][0]);
+						glUniformMatrix4fv(modelLocation, 1, GL_FALSE, &modelMatrix[0][0]);
+
+						model.setLodView(cameraPosition, modelMatrix, projection, viewportHeight);
+						model.draw();
+						frameTriangles += model.getDrawnTriangles();
+					}
+				}
+				glFinish();  // Frame time includes the GPU, that's where the triangles cost.
+				totalTriangles += frameTriangles;
+
+				if (f % (frames / 4) == 0)
+					std::cout << "    distance " << distance << ": " << frameTriangles << " triangles" << std::endl;
+			}
+			double ms = timer.elapsedMs();
+
+			std::cout << "  " << (lodLevels ? std::to_string(lodLevels) + " LODs" : std::string("no LODs")) << ": " << totalTriangles / frames
+				<< " triangles, " << ms / frames << " ms per frame, " << model.indexBytes() / 1024 << " KB of indices" << std::endl;
+			model.destroy();
+		}
+
+		glDeleteProgram(program);
+		return passed;
+	}
+
+	// The culling kernels alone on 100k random boxes, then what culling does to a 4096 mesh scene seen from inside it.
+	void culling(int frames = 300) {
+		const unsigned int boxCount = 100000;
+		const int runs = 200;
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f), size(0.1f, 2.0f);
+		BoxList boxes;
+		for (unsigned int i = 0; i < boxCount; i++)
+			boxes.add(glm::vec3(position(random), position(random), position(random)), glm::vec3(size(random), size(random), size(random)));
+
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.2f, 0.1f, 200.0f);
+		Frustum frustum = Frustum::fromMatrix(projection * glm::lookAt(glm::vec3(0.0f), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)));
+		std::vector<unsigned int> visible(boxes.cx.size());
+
+		std::cout << "Frustum culling " << boxCount << " boxes, " << runs << " runs" << std::endl;
+		typedef unsigned int (*Kernel)(Frustum const&, BoxList const&, unsigned int, unsigned int, unsigned int*);
+		std::vector<std::pair<std::string, Kernel>> kernels = { { "scalar", Culling::cullScalar } };
+#ifdef FRUSTUM_SSE
+		kernels.push_back({ "SSE", Culling::cullSSE });
+#endif
+#ifdef __AVX__
+		kernels.push_back({ "AVX", Culling::cullAVX });
+#endif
+		for (auto const &kernel : kernels) {
+			unsigned int visibleCount = 0;
+			Timer timer;
+			for (int r = 0; r < runs; r++)
+				visibleCount = kernel.second(frustum, boxes, 0, boxes.count, visible.data());
+			double ms = timer.elapsedMs();
+			std::cout << "  " << kernel.first << ": " << ms * 1e6 / ((double)runs * boxCount) << " ns per box, " << visibleCount << " visible" << std::endl;
+		}
+
+		// The widest kernel a chunk per job, the way Model culls with a scheduler.
+		unsigned int chunks = (boxCount + Model::CULL_CHUNK - 1) / Model::CULL_CHUNK;
+		std::vector<unsigned int> chunkVisible(chunks);
+		unsigned int maxThreads = Jobs::defaultThreads();
+		for (unsigned int threads = 2; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2) {
+			Jobs::Scheduler jobs(threads);
+			unsigned int visibleCount = 0;
+			Timer timer;
+			for (int r = 0; r < runs; r++) {
+				jobs.forEach(chunks, [&](unsigned int chunk) {
+					unsigned int begin = chunk * Model::CULL_CHUNK;
+					chunkVisible[chunk] = Culling::cull(frustum, boxes, begin, std::min(begin + Model::CULL_CHUNK, boxes.count), &visible[begin]);
+				}, 1);
+				visibleCount = 0;
+				for (unsigned int n : chunkVisible)
+					visibleCount += n;
+			}
+			double ms = timer.elapsedMs();
+			std::cout << "  widest kernel, " << threads << " threads: " << ms * 1e6 / ((double)runs * boxCount) << " ns per box, " << visibleCount << " visible" << std::endl;
+		}
+
+		std::string synthetic = "assets/synthetic.obj";
+		writeSyntheticObj(synthetic, 4096, 2);
+		unsigned int program = modelProgram();
+		Mesh::bindSamplers(program);
+		GLCounter::install();
+
+		ModelOptions options;
+		options.useCache = false;
+		Model model(synthetic, options);
+
+		// The scene is 48 x 192 units, the camera stands in the middle looking down the long side.
+		glm::mat4 view = glm::lookAt(glm::vec3(24.0f, 3.0f, 96.0f), glm::vec3(24.0f, 0.0f, 192.0f), glm::vec3(0, 1, 0));
+		glm::mat4 mvp = projection * view;
+		glUseProgram(program);
+		glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
+
+		Model::Submission modes[] = { Model::PER_MESH, Model::MULTI_DRAW_INDIRECT };
+		for (Model::Submission mode : modes) {
+			if (!model.setSubmission(mode))
+				continue;
+			for (int cull = 0; cull <= 1; cull++) {
+				if (cull)
+					model.setFrustum(projection * view, glm::mat4(1.0f));
+				else
+					model.clearFrustum();
+
+				std::cout << model.meshCount() << " meshes, " << (mode == Model::PER_MESH ? "per mesh draws" : "multi draw indirect")
+					<< (cull ? ", culled" : ", not culled") << std::endl;
+				drawFrames(model, program, frames);
+				std::cout << "    " << model.getDrawnMeshes() << " meshes drawn" << std::endl;
+			}
+		}
+		model.destroy();
+
+		glDeleteProgram(program);
+		std::remove(synthetic.c_str());
+	}
+
+	// Every sample's shader programs. Paths are relative to ModelLoader's folder, so run it from there like the other benchmarks.
+	std::vector<std::vector<Shaders::ShaderFile>> samplePrograms() {
+		std::vector<std::vector<Shaders::ShaderFile>> programs = {
+			{ { GL_VERTEX_SHADER, "../3DScene/shaders/triangle.vert" }, { GL_FRAGMENT_SHADER, "../3DScene/shaders/triangle.frag" } },
+			{ { GL_VERTEX_SHADER, "../Cubemap/shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "../Cubemap/shaders/shader.frag" } },
+			{ { GL_VERTEX_SHADER, "../Cubemap/shaders/skybox.vert" }, { GL_FRAGMENT_SHADER, "../Cubemap/shaders/skybox.frag" } },
+			{ { GL_VERTEX_SHADER, "../DepthBuffer/shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "../DepthBuffer/shaders/shader.frag" } },
+			{ { GL_VERTEX_SHADER, "../ElementBufferObject/shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "../ElementBufferObject/shaders/shader.frag" } },
+			{ { GL_VERTEX_SHADER, "../FrameBuffer/shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "../FrameBuffer/shaders/shader.frag" } },
+			{ { GL_VERTEX_SHADER, "../FrameBuffer/shaders/quad.vert" }, { GL_FRAGMENT_SHADER, "../FrameBuffer/shaders/quad.frag" } },
+			{ { GL_VERTEX_SHADER, "../Instancing/shaders/shader.vs" }, { GL_FRAGMENT_SHADER, "../Instancing/shaders/shader.fs" } },
+			{ { GL_VERTEX_SHADER, "../Instancing/shaders/compact.vs" }, { GL_FRAGMENT_SHADER, "../Instancing/shaders/shader.fs" } },
+			{ { GL_COMPUTE_SHADER, "../Instancing/shaders/cull.comp" } },
+			{ { GL_VERTEX_SHADER, "shaders/model.vert" }, { GL_FRAGMENT_SHADER, "shaders/model.frag" } },
+			{ { GL_VERTEX_SHADER, "../StencilBuffer/shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "../StencilBuffer/shaders/shader.frag" } },
+			{ { GL_VERTEX_SHADER, "../StencilBuffer/shaders/outline.vert" }, { GL_FRAGMENT_SHADER, "../StencilBuffer/shaders/outline.frag" } },
+			{ { GL_VERTEX_SHADER, "../Textures/shaders/texture.vert" }, { GL_FRAGMENT_SHADER, "../Textures/shaders/texture.frag" } },
+			{ { GL_VERTEX_SHADER, "../Triangle/shaders/triangle.vert" }, { GL_FRAGMENT_SHADER, "../Triangle/shaders/triangle.frag" } },
+		};
+		if (!GLAD_GL_VERSION_4_3)
+			programs.erase(std::remove_if(programs.begin(), programs.end(),
+				[](std::vector<Shaders::ShaderFile> const &files) { return files[0].type == GL_COMPUTE_SHADER; }), programs.end());
+		return programs;
+	}
+
+	// Every sample's programs built cold (compiled from source, cache written) and warm (loaded from the cache).
+	// Drivers keep shader caches of their own (Mesa's, NVIDIA's), so cold is only truly cold with those turned off.
+	void programCache(int runs = 5) {
+		std::vector<std::vector<Shaders::ShaderFile>> programs = samplePrograms();
+		std::cout << "Program cache, ms per program over " << runs << " runs" << std::endl;
+		double coldTotal = 0, warmTotal = 0;
+		for (auto const &files : programs) {
+			double cold = 0, warm = 0;
+			bool allCached = true, failed = false;
+			for (int i = 0; i < runs && !failed; i++) {
+				std::remove((files[0].path + ".program").c_str());
+				Timer timer;
+				unsigned int program = Shaders::loadProgram(files);
+				glFinish();
+				cold += timer.elapsedMs();
+				if (program == (unsigned int)-1) {
+					failed = true;
+					break;
+				}
+				glDeleteProgram(program);
+
+				bool cached;
+				timer.reset();
+				program = Shaders::loadProgram(files, &cached);
+				glFinish();
+				warm += timer.elapsedMs();
+				glDeleteProgram(program);
+				allCached = allCached && cached;
+			}
+			if (failed) {
+				std::cout << "  " << files[0].path << ": failed to build, skipped" << std::endl;
+				continue;
+			}
+
+			std::cout << "  " << files[0].path << ": cold " << cold / runs << ", warm " << warm / runs
+				<< (allCached ? "" : " (binary not cached)") << std::endl;
+			coldTotal += cold / runs;
+			warmTotal += warm / runs;
+		}
+		std::cout << "  all programs: cold " << coldTotal << " ms, warm " << warmTotal << " ms" << std::endl;
+	}
+
+	// Builds a program the way the samples did before batching: each shader's compile status is queried before the
+	// next one is issued, then the link's. No cache is read or written.
+	unsigned int buildOneAtATime(std::vector<Shaders::ShaderFile> const &files) {
+		std::vector<unsigned int> shaders;
+		for (Shaders::ShaderFile const &file : files) {
+			unsigned int shader = Shaders::createShader(file.type, file.path);
+			if (shader == (unsigned int)-1)
+				break;
+			shaders.push_back(shader);
+		}
+		unsigned int program = shaders.size() == files.size() ? Shaders::createAndLinkProgram(shaders) : (unsigned int)-1;
+		for (unsigned int shader : shaders)
+			glDeleteShader(shader);
+		return program;
+	}
+
+	// Wall time to build every sample's programs from source: one at a time, each waiting on its own status like
+	// createShader/createAndLinkProgram do, against one loadPrograms batch that only asks once everything is issued.
+	// The batch also writes the binary cache, which the one at a time path skips.
+	void programBatch(int runs = 5) {
+		std::vector<std::vector<Shaders::ShaderFile>> programs = samplePrograms();
+		auto removeCaches = [&]() {
+			for (auto const &files : programs)
+				std::remove((files[0].path + ".program").c_str());
+		};
+
+		double serial = 0, batched = 0;
+		for (int i = 0; i < runs; i++) {
+			Timer timer;
+			std::vector<unsigned int> built;
+			for (auto const &files : programs)
+				built.push_back(buildOneAtATime(files));
+			glFinish();
+			serial += timer.elapsedMs();
+			for (unsigned int program : built)
+				if (program != (unsigned int)-1)
+					glDeleteProgram(program);
+
+			removeCaches();
+			timer.reset();
+			built = Shaders::loadPrograms(programs);
+			glFinish();
+			batched += timer.elapsedMs();
+			for (unsigned int program : built)
+				if (program != (unsigned int)-1)
+					glDeleteProgram(program);
+		}
+		removeCaches();
+
+		std::cout << "Building " << programs.size() << " programs from source over " << runs << " runs, parallel compile "
+			<< (Shaders::parallelCompile() ? "on" : "not supported") << std::endl;
+		std::cout << "  one at a time: " << serial / runs << " ms" << std::endl;
+		std::cout << "  one batch:     " << batched / runs << " ms" << std::endl;
+	}
+
+	bool copyFile(std::string const &from, std::string const &to, std::string const &append = "") {
+		std::string source;
+		if (!Shaders::readSource(from, source))
+			return false;
+		std::ofstream stream(to, std::ios::binary | std::ios::trunc);
+		stream << source << append;
+		return (bool)stream;
+	}
+
+	// Edits a copy of the model shader on disk while drawing the backpack, and checks the registry swaps the rebuilt
+	// program in within MAX_FRAMES frames without a frame time spike. The first edit doesn't compile, which must keep
+	// the old program, the second fixes it. False if any of that didn't hold, so '--bench reload' can fail a run.
+	bool shaderReload(int frames = 240) {
+		const int MAX_FRAMES = 30, BROKEN_AT = 60, FIXED_AT = 120;
+		const double MAX_SPIKE = 4.0;  // Worst frame while reloading, as a multiple of the median before any edit.
+		std::string vert = "shaders/reload.vert", frag = "shaders/reload.frag";
+		if (!copyFile("shaders/model.vert", vert) || !copyFile("shaders/model.frag", frag)) {
+			std::cout << "Couldn't copy the model shaders" << std::endl;
+			return false;
+		}
+
+		ModelOptions options;
+		Model model("assets/backpack/backpack.obj", options);
+		ShaderRegistry registry;
+		int id = registry.add({ { GL_VERTEX_SHADER, vert }, { GL_FRAGMENT_SHADER, frag } });
+		if (id < 0)
+			return false;
+
+		auto bind = [&]() {
+			Mesh::bindSamplers(registry.program(id));
+			model.bindUniforms(registry.program(id));
+		};
+		bind();
+
+		std::vector<double> frameMs;
+		int swappedAt = -1;
+		bool keptOldProgram = true;
+		for (int f = 0; f < frames; f++) {
+			if (f == BROKEN_AT)
+				copyFile("shaders/model.frag", frag, "\nthis won't compile\n");
+			else if (f == FIXED_AT)
+				copyFile("shaders/model.frag", frag, "\n// edited\n");
+
+			Timer timer;
+			if (registry.update()) {
+				bind();
+				if (f < FIXED_AT)
+					keptOldProgram = false;
+				else if (swappedAt < 0)
+					swappedAt = f;
+			}
+			glUseProgram(registry.program(id));
+			model.draw();
+			glFinish();
+			frameMs.push_back(timer.elapsedMs());
+		}
+
+		std::vector<double> sorted(frameMs.begin(), frameMs.begin() + BROKEN_AT);
+		std::sort(sorted.begin(), sorted.end());
+		double median = sorted[sorted.size() / 2];
+		double worst = 0;
+		for (int f = FIXED_AT; f < frames && f <= FIXED_AT + MAX_FRAMES; f++)
+			worst = std::max(worst, frameMs[f]);
+
+		std::cout << "Shader reload, " << (Shaders::parallelCompile() ? "parallel compile" : "no parallel compile") << std::endl;
+		std::cout << "  broken edit kept the old program: " << (keptOldProgram ? "yes" : "NO") << std::endl;
+		if (swappedAt < 0)
+			std::cout << "  FAILED: fixed edit never swapped in" << std::endl;
+		else
+			std::cout << "  fixed edit swapped in after " << swappedAt - FIXED_AT << " frames (limit " << MAX_FRAMES << ")"
+				<< (swappedAt - FIXED_AT <= MAX_FRAMES ? "" : " FAILED") << std::endl;
+		bool spiked = worst > median * MAX_SPIKE;
+		std::cout << "  frame time: median " << median << " ms, worst while reloading " << worst << " ms (limit "
+			<< median * MAX_SPIKE << ")" << (spiked ? " FAILED" : "") << std::endl;
+
+		registry.destroy();
+		model.destroy();
+		for (std::string const &path : { vert, frag, vert + ".program" })
+			std::remove(path.c_str());
+		return keptOldProgram && swappedAt >= 0 && swappedAt - FIXED_AT <= MAX_FRAMES && !spiked;
+	}
+
+	// GL calls and CPU time per frame of a grid of backpacks drawn with their shader variants: the camera, light and
+	// matrices set as uniforms on every program vs the shared Frame and Object blocks.
+	void uniformBlocks(int frames = 300, int gridSize = 4) {
+		Model model("assets/backpack/backpack.obj");
+		std::vector<glm::mat4> objects;
+		for (int z = 0; z < gridSize; z++)
+			for (int x = 0; x < gridSize; x++)
+				objects.push_back(glm::translate(glm::mat4(1.0f), glm::vec3((x - gridSize / 2) * 1.5f, 0.0f, -z * 1.5f)));
+
+		glm::mat4 projection = glm::perspective(45.0f, 1.2f, 0.1f, 50.0f);
+		glm::mat4 view = glm::lookAt(glm::vec3(0, 2.0f, 4.0f), glm::vec3(0, 0, -2.0f), glm::vec3(0, 1, 0));
+		glm::mat4 viewProjection = projection * view;
+		glm::vec3 lightDir(-0.2f, -1.0f, -0.3f), lightColor(0.5f, 0.68f, 0.65f), viewPos(0, 2.0f, 4.0f);
+
+		GLCounter::install();
+		std::cout << "Uniform blocks over " << frames << " frames of " << objects.size() << " backpacks with "
+			<< model.getShaderVariants().size() << " shader variants (per frame)" << std::endl;
+
+		for (int blocks = 0; blocks <= 1; blocks++) {
+			std::vector<std::vector<Shaders::ShaderFile>> variantFiles;
+			for (std::vector<std::string> defines : model.getShaderVariants()) {
+				if (!blocks)
+					defines.push_back("PLAIN_UNIFORMS");
+				variantFiles.push_back(Shaders::withDefines(modelFiles(), defines));
+			}
+			std::vector<unsigned int> programs = Shaders::loadPrograms(variantFiles);
+
+			struct Locations {
+				int mvp, model, lightDir, viewPos, lightColor;
+			};
+			std::vector<Locations> locations;
+			bool built = true;
+			for (unsigned int program : programs) {
+				built &= program != (unsigned int)-1;
+				if (program == (unsigned int)-1)
+					continue;
+				Shaders::Uniforms uniforms(program);
+				locations.push_back({ uniforms["mvp"], uniforms["model"], uniforms["lightDir"], uniforms["viewPos"], uniforms["lightColor"] });
+				Mesh::bindSamplers(program);
+				UniformBlocks::bindBlocks(program);
+			}
+			if (!built) {
+				for (unsigned int program : programs)
+					if (program != (unsigned int)-1)
+						glDeleteProgram(program);
+				continue;
+			}
+			model.setVariantPrograms(programs);
+
+			FrameUniforms frameUniforms;
+			ObjectUniforms objectUniforms;
+			if (blocks) {
+				frameUniforms.create();
+				objectUniforms.create();
+			}
+
+			auto drawFrame = [&]() {
+				if (blocks) {
+					UniformBlocks::FrameData frame;
+					frame.view = view;
+					frame.projection = projection;
+					frame.viewProjection = viewProjection;
+					frame.viewPos = viewPos;
+					frame.lightDir = lightDir;
+					frame.lightColor = lightColor;
+					frameUniforms.update(frame);
+
+					objectUniforms.clear();
+					for (glm::mat4 const &object : objects)
+						objectUniforms.push({ viewProjection * object, object });
+					objectUniforms.upload();
+				}
+				else {
+					// Per frame data, still once per program.
+					for (size_t p = 0; p < programs.size(); p++) {
+						glUseProgram(programs[p]);
+						glUniform3fv(locations[p].lightDir, 1, &lightDir[0]);
+						glUniform3fv(locations[p].viewPos, 1, &viewPos[0]);
+						glUniform3fv(locations[p].lightColor, 1, &lightColor[0]);
+					}
+				}
+
+				for (size_t o = 0; o < objects.size(); o++) {
+					if (blocks)
+						objectUniforms.bind((unsigned int)o);
+					else {
+						glm::mat4 mvp = viewProjection * objects[o];
+						for (size_t p = 0; p < programs.size(); p++) {
+							glUseProgram(programs[p]);
+							glUniformMatrix4fv(locations[p].mvp, 1, GL_FALSE, &mvp[0][0]);
+							glUniformMatrix4fv(locations[p].model, 1, GL_FALSE, &objects[o][0][0]);
+						}
+					}
+					model.draw();
+				}
+			};
+
+			drawFrame();  // Warm up
+			glFinish();
+			GLCounter::reset();
+			Timer timer;
+			for (int f = 0; f < frames; f++)
+				drawFrame();
+			double ms = timer.elapsedMs();
+			glFinish();
+
+			std::cout << "  " << (blocks ? "uniform blocks" : "plain uniforms") << ": " << ms / frames << " ms CPU" << std::endl;
+			GLCounter::print(frames);
+
+			model.setVariantPrograms({});
+			for (unsigned int program : programs)
+				glDeleteProgram(program);
+			if (blocks) {
+				frameUniforms.destroy();
+				objectUniforms.destroy();
+			}
+		}
+
+		model.destroy();
+	}
+
+	/*
+	* Checks runAfter on 'jobs'. Each round queues jobs on one counter, then dependents on it while workers are running
+	* those, so some runAfter calls race the counter's last finish(), then a second level of dependents on those. Every dependent has
+	* to run exactly once, and only after all of its dependency's jobs have. Also checks that this thread, waiting,
+	* never picks up a background job while there are workers to run it.
+	*/
+	bool jobDependencies(Jobs::Scheduler &jobs, int rounds = 2000) {
+		const unsigned int FIRST = 16, SECOND = FIRST / 2;
+		const double LOST_AFTER_MS = 2000;
+
+		// Outlives the round if a dependent goes missing, queued jobs might still point at it.
+		struct Round {
+			Jobs::Counter first, second, third, background;
+			std::atomic<unsigned int> firstDone{ 0 }, secondDone{ 0 }, thirdDone{ 0 }, early{ 0 };
+			std::atomic<bool> backgroundHere{ false };
+		};
+
+		unsigned int early = 0, backgroundHere = 0;
+		std::thread::id self = std::this_thread::get_id();
+		for (int r = 0; r < rounds; r++) {
+			std::unique_ptr<Round> round(new Round());
+			Round &state = *round;
+			jobs.runBackground([&state, self]() { state.backgroundHere = std::this_thread::get_id() == self; }, state.background);
+			// The yield gives other threads a chance at the dependents while these are still going.
+			for (unsigned int j = 0; j < FIRST; j++)
+				jobs.run([&state]() {
+					std::this_thread::yield();
+					state.firstDone++;
+				}, state.first);
+			// The workers are already running the first jobs, so some of these land as the count reaches zero.
+			for (unsigned int j = 0; j < SECOND; j++)
+				jobs.runAfter(state.first, [&state]() {
+					if (state.firstDone.load() != FIRST)
+						state.early++;
+					state.secondDone++;
+				}, state.second);
+			jobs.runAfter(state.second, [&state]() {
+				if (state.secondDone.load() != SECOND)
+					state.early++;
+				state.thirdDone++;
+			}, state.third);
+
+			// Helping out in wait() is where this thread could wrongly pick up a dependent or the background job.
+			jobs.wait(state.first);
+			// With workers, watch for a dependent that never runs instead of waiting on it forever.
+			if (jobs.threadCount() > 1) {
+				Timer timer;
+				while (!(state.third.done() && state.background.done()) && timer.elapsedMs() < LOST_AFTER_MS)
+					std::this_thread::yield();
+				if (!state.third.done() || !state.background.done()) {
+					std::cout << "    FAILED: a dependent job never ran in round " << r << std::endl;
+					round.release();
+					return false;
+				}
+			}
+			jobs.wait(state.third);
+			jobs.wait(state.background);
+
+			early += state.early;
+			backgroundHere += jobs.threadCount() > 1 && state.backgroundHere;
+			if (state.secondDone != SECOND || state.thirdDone != 1) {
+				std::cout << "    FAILED: dependents ran " << state.secondDone + state.thirdDone << " times, expected " << SECOND + 1 << std::endl;
+				return false;
+			}
+		}
+
+		if (early || backgroundHere)
+			std::cout << "    FAILED: " << early << " dependents ran early, " << backgroundHere << " background jobs ran on the waiting thread" << std::endl;
+		return early == 0 && backgroundHere == 0;
+	}
+
+	/*
+	* The job scheduler on its own, from 1 thread to one per core:
+	*  - spawn: what run() costs the caller per job, queueing empty jobs without waiting on them.
+	*  - throughput: empty jobs run and finished per second, queueing and waiting included.
+	*  - parallel for: forEach over a loop heavy enough to be worth splitting, against a plain loop on this thread.
+	*  - dependencies: jobDependencies() passing. False if it or the parallel for's result check fails.
+	*/
+	bool jobSystem(int runs = 5) {
+		const unsigned int emptyJobs = 200000, iterations = 1 << 20;
+		std::vector<float> results(iterations);
+		auto work = [&](unsigned int i) {
+			float x = (float)i;
+			for (int k = 0; k < 64; k++)
+				x = std::sqrt(x * 1.0001f + 1.0f);
+			results[i] = x;
+		};
+
+		Timer timer;
+		for (int r = 0; r < runs; r++)
+			for (unsigned int i = 0; i < iterations; i++)
+				work(i);
+		double serial = timer.elapsedMs() / runs;
+		float reference = results[iterations - 1];
+
+		std::cout << "Job system, " << emptyJobs << " empty jobs, parallel for over " << iterations << " items (plain loop " << serial << " ms)" << std::endl;
+		bool passed = true;
+		unsigned int maxThreads = Jobs::defaultThreads();
+		for (unsigned int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2) {
+			Jobs::Scheduler jobs(threads);
+			double spawn = 0, throughput = 0, parallelFor = 0;
+			for (int r = 0; r < runs; r++) {
+				Jobs::Counter counter;
+				timer.reset();
+				for (unsigned int j = 0; j < emptyJobs; j++)
+					jobs.run([]() {}, counter);
+				spawn += timer.elapsedMs();
+				jobs.wait(counter);
+				throughput += timer.elapsedMs();
+
+				std::fill(results.begin(), results.end(), 0.0f);
+				timer.reset();
+				jobs.forEach(iterations, work);
+				parallelFor += timer.elapsedMs();
+			}
+
+			std::cout << "  " << threads << " threads: spawn " << spawn * 1e6 / ((double)runs * emptyJobs) << " ns per job, "
+				<< (double)runs * emptyJobs / (throughput * 1e3) << " M empty jobs/s, parallel for " << parallelFor / runs << " ms ("
+				<< serial * runs / parallelFor << "x)" << (results[iterations - 1] == reference ? "" : ", WRONG RESULT") << std::endl;
+			bool dependencies = jobDependencies(jobs);
+			std::cout << "    dependencies: " << (dependencies ? "ok" : "FAILED") << std::endl;
+			passed = passed && dependencies && results[iterations - 1] == reference;
+		}
+		return passed;
+	}
+
+	/*
+	* Heap traffic with and without arenas:
+	*  - import: a cold import of the backpack with optimization and LODs, mesh processing scratch on the heap vs in
+	*    an arena per thread. Peak is the most heap in use at once above what was in use before the import.
+	*  - draw: allocations per frame drawing with the model's own lists vs a frame arena reset every frame, on the
+	*    backpack and on a scene big enough to be culled in jobs.
+	*/
+	void memoryUse(int runs = 3, int frames = 300) {
+		if (!Allocations::counted) {
+			std::cout << "Memory use needs allocations counted, build with COUNT_ALLOCATIONS defined" << std::endl;
+			return;
+		}
+		std::string backpack = "assets/backpack/backpack.obj";
+		Jobs::Scheduler jobs;
+		std::cout << "Memory use, cold import of '" << backpack << "' with optimization and 4 LOD levels, " << jobs.threadCount() << " threads" << std::endl;
+		for (int arenas = 0; arenas <= 1; arenas++) {
+			ModelOptions options;
+			options.useCache = false;
+			options.optimizeMeshes = true;
+			options.lodLevels = 4;
+			options.jobs = &jobs;
+			options.importArenas = arenas;
+
+			double ms = 0;
+			unsigned long long allocations = 0;
+			long long peak = 0;
+			size_t scratchPeak = 0;
+			for (int r = 0; r < runs; r++) {
+				long long before = Allocations::live;
+				Allocations::resetPeak();
+				Allocations::reset();
+				Timer timer;
+				Model model(backpack, options);
+				ms += timer.elapsedMs();
+				allocations += Allocations::count;
+				peak = std::max(peak, Allocations::peak.load() - before);
+				scratchPeak = model.getLoadTimes().scratchPeak;
+				model.destroy();
+			}
+
+			std::cout << "  " << (arenas ? "import arenas" : "heap scratch") << ": " << allocations / runs << " allocations, peak "
+				<< peak / 1024 << " KB, " << ms / runs << " ms";
+			if (arenas)
+				std::cout << " (biggest arena " << scratchPeak / 1024 << " KB)";
+			std::cout << std::endl;
+		}
+
+		std::string synthetic = "assets/synthetic.obj";
+		writeSyntheticObj(synthetic, 16384, 1);
+		unsigned int program = modelProgram();
+		Mesh::bindSamplers(program);
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.2f, 0.1f, 200.0f);
+		glm::mat4 view = glm::lookAt(glm::vec3(24.0f, 3.0f, 96.0f), glm::vec3(24.0f, 0.0f, 192.0f), glm::vec3(0, 1, 0));
+
+		std::cout << "Allocations per frame over " << frames << " frames" << std::endl;
+		std::string paths[] = { backpack, synthetic };
+		for (std::string const &path : paths) {
+			ModelOptions options;
+			options.useCache = false;
+			options.jobs = &jobs;
+			Model model(path, options);
+			model.setFrustum(projection * view, glm::mat4(1.0f));
+			glUseProgram(program);
+
+			for (int arena = 0; arena <= 1; arena++) {
+				LinearArena frameArena;
+				if (arena)
+					model.setFrameArena(&frameArena);
+				model.draw();  // Warm up, lets the lists (or the arena) grow to size.
+				frameArena.reset();
+				glFinish();
+
+				Allocations::reset();
+				Timer timer;
+				for (int f = 0; f < frames; f++) {
+					model.draw();
+					frameArena.reset();
+				}
+				double ms = timer.elapsedMs();
+				unsigned long long allocations = Allocations::count;
+				glFinish();
+				model.setFrameArena(nullptr);
+
+				std::cout << "  " << model.meshCount() << " meshes, " << (arena ? "frame arena" : "own lists") << ": "
+					<< (double)allocations / frames << " allocations, " << ms / frames << " ms CPU";
+				if (arena)
+					std::cout << ", " << frameArena.peak() / 1024 << " KB of arena";
+				std::cout << std::endl;
+			}
+			model.destroy();
+		}
+
+		glDeleteProgram(program);
+		std::remove(synthetic.c_str());
+	}
+
+	// False for an unknown name, or when a benchmark that checks something (reload, jobs, lod) failed.
+	bool run(std::string const &name) {
+		if (name == "load")
+			modelLoad("assets/backpack/backpack.obj");
+		else if (name == "threads")
+			threadScaling();
+		else if (name == "uniforms")
+			uniformLookups();
+		else if (name == "layout")
+			bufferLayout();
+		else if (name == "submission")
+			submission();
+		else if (name == "optimize")
+			meshOptimization();
+		else if (name == "vertices")
+			vertexFormats();
+		else if (name == "indices")
+			indexFormats();
+		else if (name == "lod")
+			return lodPath();
+		else if (name == "culling")
+			culling();
+		else if (name == "programs")
+			programCache();
+		else if (name == "compile")
+			programBatch();
+		else if (name == "reload")
+			return shaderReload();
+		else if (name == "blocks")
+			uniformBlocks();
+		else if (name == "jobs")
+			return jobSystem();
+		else if (name == "memory")
+			memoryUse();
+		else {
+			std::cout << "Unknown benchmark '" << name << "'" << std::endl;
+			return false;
+		}
+		return true;
+	}
+}
+
+#endif
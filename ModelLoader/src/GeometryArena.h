@@ -0,0 +1,141 @@
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include "Mesh.h"
+
+/*
+* One VAO over a vertex and an index buffer that many meshes are packed into back to back.
+* Each mesh keeps its own 0 based indices and draws its sub range with glDrawElementsBaseVertex,
+* so a whole model can be drawn with a single VAO bind.
+* Since indices are local, each mesh also gets the narrowest index type for its vertex count, mixed in the one index buffer.
+*/
+class GeometryArena {
+	unsigned int VAO = 0, VBO = 0, EBO = 0;
+	unsigned int vertexCapacity = 0, vertexCount = 0;
+	size_t indexCapacity = 0, indexOffset = 0;  // Index buffer size and how much of it is handed out, in bytes.
+	VertexFormat format = FLOAT_VERTICES;
+	bool narrowIndices = true;
+
+	template <typename T>
+	static void narrow(const unsigned int *indices, unsigned int count, std::vector<unsigned char> &out) {
+		out.resize((size_t)count * sizeof(T));
+		T *narrowed = (T*)out.data();
+		for (unsigned int i = 0; i < count; i++)
+			narrowed[i] = (T)indices[i];
+	}
+
+	// Appends indices as 'type', returns where they start in units of that type, or false if they don't fit.
+	bool addIndices(unsigned int type, const unsigned int *indices, unsigned int count, unsigned int &firstIndex) {
+		size_t size = Mesh::indexSize(type);
+		size_t offset = (indexOffset + size - 1) / size * size;
+		if (offset + count * size > indexCapacity)
+			return false;
+
+		// The element buffer binding is VAO state, so go through the VAO rather than disturb whatever is bound.
+		glBindVertexArray(VAO);
+		std::vector<unsigned char> narrowed;
+		if (type == GL_UNSIGNED_BYTE)
+			narrow<uint8_t>(indices, count, narrowed);
+		else if (type == GL_UNSIGNED_SHORT)
+			narrow<uint16_t>(indices, count, narrowed);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, offset, count * size, narrowed.empty() ? (const void*)indices : narrowed.data());
+		glBindVertexArray(0);
+
+		firstIndex = offset / size;
+		indexOffset = offset + count * size;
+		return true;
+	}
+public:
+	unsigned int indexType(unsigned int meshVertexCount) const {
+		return narrowIndices ? Mesh::indexType(meshVertexCount) : GL_UNSIGNED_INT;
+	}
+
+	// Index buffer space a mesh can take, including the padding that aligns it to its index size.
+	static size_t indexSpace(unsigned int meshVertexCount, unsigned int meshIndexCount, bool narrow = true) {
+		size_t size = Mesh::indexSize(narrow ? Mesh::indexType(meshVertexCount) : GL_UNSIGNED_INT);
+		return meshIndexCount * size + size - 1;
+	}
+
+	// Allocates room for everything up front, meshes are then copied in with add().
+	// maxIndexBytes is the sum of indexSpace() over the meshes going in.
+	void create(unsigned int maxVertices, size_t maxIndexBytes, VertexFormat vertexFormat = FLOAT_VERTICES, bool narrow = true) {
+		format = vertexFormat;
+		narrowIndices = narrow;
+		vertexCapacity = maxVertices;
+		indexCapacity = maxIndexBytes;
+
+		glGenVertexArrays(1, &VAO);
+		glBindVertexArray(VAO);
+
+		glGenBuffers(1, &VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, (size_t)maxVertices * Mesh::vertexSize(format), NULL, GL_STATIC_DRAW);
+		Mesh::setAttributes(format);
+
+		glGenBuffers(1, &EBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, maxIndexBytes, NULL, GL_STATIC_DRAW);
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	// Copies a mesh into the next free range. The pointers can point straight into a memory mapped cache file.
+	// Vertices are Vertex or PackedVertex depending on the arena's format.
+	MeshRange add(const void *vertices, unsigned int meshVertexCount, const unsigned int *indices, unsigned int meshIndexCount) {
+		MeshRange range = { vertexCount, 0, meshIndexCount, indexType(meshVertexCount) };
+		if (vertexCount + meshVertexCount > vertexCapacity || !addIndices(range.indexType, indices, meshIndexCount, range.firstIndex)) {
+			std::cout << "Geometry arena is full, mesh skipped" << std::endl;
+			range.indexCount = 0;
+			return range;
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		size_t vertexSize = Mesh::vertexSize(format);
+		glBufferSubData(GL_ARRAY_BUFFER, (size_t)vertexCount * vertexSize, (size_t)meshVertexCount * vertexSize, vertices);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		vertexCount += meshVertexCount;
+		return range;
+	}
+
+	// Another index list over the vertices of a mesh already added, like a LOD. Shares its base vertex and index type.
+	MeshRange addIndices(MeshRange const &mesh, const unsigned int *indices, unsigned int count) {
+		MeshRange range = { mesh.baseVertex, 0, count, mesh.indexType };
+		if (!addIndices(range.indexType, indices, count, range.firstIndex)) {
+			std::cout << "Geometry arena is full, indices skipped" << std::endl;
+			range.indexCount = 0;
+		}
+		return range;
+	}
+
+	unsigned int vao() const {
+		return VAO;
+	}
+
+	VertexFormat vertexFormat() const {
+		return format;
+	}
+
+	// Bytes of vertex and index data handed out so far.
+	size_t vertexBytes() const {
+		return (size_t)vertexCount * Mesh::vertexSize(format);
+	}
+
+	size_t indexBytes() const {
+		return indexOffset;
+	}
+
+	void destroy() {
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		VAO = VBO = EBO = 0;
+	}
+};
+
+#endif
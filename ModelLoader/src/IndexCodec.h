@@ -0,0 +1,73 @@
+#ifndef INDEXCODEC_H
+#define INDEXCODEC_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+* Compact encoding for index buffers on disk.
+* Each index is stored relative to 'next', one past the highest index seen so far: a brand new vertex is 0 and
+* recently used ones are small numbers. That value is zigzagged (so the odd index above 'next' still works) and
+* written as a varint, 7 bits per byte. Meshes whose vertices are in first use order (MeshOptimizer does that)
+* come out at a little over a byte per index.
+*/
+namespace IndexCodec {
+	std::vector<unsigned char> encode(const unsigned int *indices, unsigned int count) {
+		std::vector<unsigned char> encoded;
+		encoded.reserve(count + count / 4);
+
+		int64_t next = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			int64_t delta = next - indices[i];
+			uint64_t value = delta >= 0 ? (uint64_t)delta * 2 : (uint64_t)(-delta) * 2 - 1;
+			while (value >= 0x80) {
+				encoded.push_back((unsigned char)(value | 0x80));
+				value >>= 7;
+			}
+			encoded.push_back((unsigned char)value);
+
+			if (indices[i] >= next)
+				next = (int64_t)indices[i] + 1;
+		}
+		return encoded;
+	}
+
+	// Fills 'count' indices, returns false if the data runs out, is left over, or points past 'vertexCount'.
+	bool decode(const unsigned char *data, size_t size, unsigned int *indices, unsigned int count, unsigned int vertexCount) {
+		const unsigned char *cursor = data, *end = data + size;
+
+		int64_t next = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			if (cursor == end)
+				return false;
+
+			// Most indices are a single byte, so that's the fast path.
+			uint64_t value = *cursor++;
+			if (value >= 0x80) {
+				value &= 0x7F;
+				int shift = 7;
+				for (;;) {
+					if (cursor == end || shift > 35)
+						return false;
+					uint64_t byte = *cursor++;
+					value |= (byte & 0x7F) << shift;
+					if (byte < 0x80)
+						break;
+					shift += 7;
+				}
+			}
+
+			int64_t delta = (value & 1) ? -(int64_t)((value + 1) / 2) : (int64_t)(value / 2);
+			int64_t index = next - delta;
+			if (index < 0 || index >= vertexCount)
+				return false;
+
+			indices[i] = (unsigned int)index;
+			if (index >= next)
+				next = index + 1;
+		}
+		return cursor == end;
+	}
+}
+
+#endif
@@ -4,17 +4,22 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "ShaderProgram.h"
+#include "ShaderRegistry.h"
+#include "UniformBlocks.h"
 #include "Camera.h"
 #include "Constants.h"
 #include "Texture.h"
 #include "Model.h"
+#include "Benchmark.h"
 
 const int WIDTH = 1200, HEIGHT = 1000;
 Camera camera(glm::vec3(0, 0.2f, 2.5f), glm::vec3(0, 1, 0));
 bool wireframe = false;
+bool multiDraw = false;  // M toggles between per mesh draws and multi draw indirect
 
 // ------------------- CALLBACKS -------------------
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -25,6 +30,8 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         glPolygonMode(GL_FRONT_AND_BACK, wireframe? GL_LINE : GL_FILL);
         wireframe = !wireframe;
     }
+    if (key == GLFW_KEY_M && action == GLFW_PRESS)
+        multiDraw = !multiDraw;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
@@ -33,7 +40,7 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 }
 // --------------------------------------------------
 
-int main(void)
+int main(int argc, char** argv)
 {
     GLFWwindow* window;
 
@@ -64,15 +71,75 @@ int main(void)
     std::cout << "OpenGL version: " << glGetString(GL_VERSION) << std::endl;
     glEnable(GL_DEPTH_TEST);
 
+    // 'ModelLoader --bench <name>' runs a benchmark instead of the scene, exiting non-zero if it's unknown or failed a check.
+    if (argc > 2 && std::string(argv[1]) == "--bench") {
+        bool passed = Benchmark::run(argv[2]);
+        glfwTerminate();
+        return passed ? 0 : -1;
+    }
+
     //  ---------------------- MODEL LOADING STUFF ----------------------
-    Model backpackModel("assets/backpack/backpack.obj");
+    // One scheduler for every job: mesh processing on import, texture decodes and culling.
+    // Textures decode as background jobs on the workers, the model shows placeholders until they're uploaded.
+    Jobs::Scheduler jobs;
+    TextureUtil::AsyncLoader textureLoader(jobs);
+    const size_t textureUploadBudget = 8 * 1024 * 1024;  // Bytes per frame
+
+    Timer loadTimer;
+    ModelOptions modelOptions;
+    modelOptions.jobs = &jobs;
+    modelOptions.textureLoader = &textureLoader;
+    modelOptions.optimizeMeshes = true;
+    modelOptions.lodLevels = 4;
+    Model backpackModel("assets/backpack/backpack.obj", modelOptions);
+    std::cout << "Loaded model in " << loadTimer.elapsedMs() << " ms" << std::endl;
+    // Per frame lists (visible meshes and the like) come from here, it's reset once the frame is submitted.
+    LinearArena frameArena;
+    backpackModel.setFrameArena(&frameArena);
     // ------------------------------------------------------------------ 
 
-    unsigned int vShader = Shaders::createShader(GL_VERTEX_SHADER, "shaders/model.vert");
-    unsigned int fShader = Shaders::createShader(GL_FRAGMENT_SHADER, "shaders/model.frag");
-    unsigned int program = Shaders::createAndLinkProgram({ vShader, fShader });
-    glDeleteShader(vShader);
-    glDeleteShader(fShader);
+    // A variant of the model shader per set of #defines in shaders/model.variants, plus any the model needs that
+    // aren't listed. Each mesh is drawn with its own, so meshes without a specular map skip that work.
+    // Saving either shader while this runs rebuilds every variant and swaps them in, as long as they link.
+    std::vector<Shaders::ShaderFile> modelFiles = { { GL_VERTEX_SHADER, "shaders/model.vert" }, { GL_FRAGMENT_SHADER, "shaders/model.frag" } };
+    std::vector<std::vector<std::string>> defineSets;
+    Shaders::readManifest("shaders/model.variants", defineSets);
+    std::vector<std::vector<std::string>> const &modelVariants = backpackModel.getShaderVariants();
+    defineSets.insert(defineSets.end(), modelVariants.begin(), modelVariants.end());
+
+    std::vector<std::vector<Shaders::ShaderFile>> variantFiles;
+    for (auto const &defines : defineSets)
+        variantFiles.push_back(Shaders::withDefines(modelFiles, defines));
+    ShaderRegistry shaders;
+    std::vector<int> ids = shaders.addAll(variantFiles);
+
+    // The model's variants are the ids at the end, in its order.
+    std::vector<int> modelShaders(ids.end() - modelVariants.size(), ids.end());
+    for (int id : modelShaders) {
+        if (id < 0) {
+            glfwTerminate();
+            return -1;
+        }
+    }
+
+    // Every variant reads the camera, light and matrices from the shared uniform blocks, so there's nothing to set
+    // per program beyond hooking them up. Done again after a reload.
+    auto bindPrograms = [&]() {
+        std::vector<unsigned int> programs;
+        for (int id : modelShaders) {
+            unsigned int program = shaders.program(id);
+            UniformBlocks::bindBlocks(program);
+            Mesh::bindSamplers(program);
+            programs.push_back(program);
+        }
+        backpackModel.setVariantPrograms(programs);
+    };
+    bindPrograms();
+
+    FrameUniforms frameUniforms;
+    frameUniforms.create();
+    ObjectUniforms objectUniforms;
+    objectUniforms.create();
 
     glm::mat4 projection = glm::perspective(45.0f, (float)WIDTH / (float)HEIGHT, 0.1f, 50.0f);
 
@@ -83,6 +150,9 @@ int main(void)
     while (!glfwWindowShouldClose(window))
     {
         glfwPollEvents();
+        textureLoader.update(textureUploadBudget);
+        if (shaders.update())
+            bindPrograms();
 
         glClearColor(0.02f, 0.02f, 0.02f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -90,17 +160,31 @@ int main(void)
         // Set view matrix
         camera.update(window);
 
+        UniformBlocks::FrameData frame;
+        frame.view = camera.getViewMatrix();
+        frame.projection = projection;
+        frame.viewProjection = projection * frame.view;
+        frame.viewPos = camera.position;
+        frame.lightDir = lightDir;
+        frame.lightColor = lightColor;
+        frameUniforms.update(frame);
+
         glm::mat4 model = glm::mat4(1.0f);
-        glm::mat4 mvp = projection * camera.getViewMatrix() * model;
-        glUseProgram(program);
-        glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
-        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, &model[0][0]);
-        glUniform3fv(glGetUniformLocation(program, "lightDir"), 1, &lightDir[0]);
-        glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, &camera.position[0]);
-        glUniform3fv(glGetUniformLocation(program, "lightColor"), 1, &lightColor[0]);
-        backpackModel.draw(program);
+        objectUniforms.clear();
+        unsigned int backpackObject = objectUniforms.push({ frame.viewProjection * model, model });
+        objectUniforms.upload();
+        objectUniforms.bind(backpackObject);
+        if (multiDraw != (backpackModel.getSubmission() == Model::MULTI_DRAW_INDIRECT) &&
+            !backpackModel.setSubmission(multiDraw ? Model::MULTI_DRAW_INDIRECT : Model::PER_MESH)) {
+            std::cout << "Multi draw indirect isn't available, staying on per mesh draws" << std::endl;
+            multiDraw = false;
+        }
+        backpackModel.setFrustum(projection * camera.getViewMatrix(), model);
+        backpackModel.setLodView(camera.position, model, projection, (float)HEIGHT);
+        backpackModel.draw();
 
         glfwSwapBuffers(window);
+        frameArena.reset();
     }
 
     glfwTerminate();
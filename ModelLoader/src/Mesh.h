@@ -1,8 +1,12 @@
 #ifndef MESH_H
 #define MESH_H
 #include <glad/glad.h>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
 #include <vector>
 #include <string>
+#include <glm/glm.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
 
@@ -12,6 +16,32 @@ struct Vertex {
 	glm::vec2 uv;
 };
 
+// 14 bytes instead of 32, see VertexPacking.h for the encoding. Everything is 16 bit, so nothing needs padding.
+struct PackedVertex {
+	uint16_t position[3];  // 16 bit unorm across the mesh bounds.
+	int16_t normal[2];     // Octahedral encoded, 16 bit snorm.
+	uint16_t uv[2];        // Half floats.
+};
+static_assert(sizeof(PackedVertex) == 14, "PackedVertex is the vertex buffer stride, it can't have padding");
+
+enum VertexFormat {
+	FLOAT_VERTICES,   // Vertex
+	PACKED_VERTICES   // PackedVertex
+};
+
+// Turns a packed position back into model space: offset + position * scale.
+struct Dequantize {
+	glm::vec3 scale = glm::vec3(1.0f);
+	glm::vec3 offset = glm::vec3(0.0f);
+};
+
+// Locations of the vertex format uniforms in model.vert, -1 if the program doesn't use them.
+struct VertexUniforms {
+	int positionScale = -1;
+	int positionOffset = -1;
+	int packedNormals = -1;
+};
+
 struct Texture {
 	unsigned int id;
 	enum Type {
@@ -22,84 +52,229 @@ struct Texture {
 	} type;
 };
 
+// Where a mesh's texture comes from, resolved into a Texture once it's loaded.
+struct TextureRef {
+	std::string path;
+	Texture::Type type;
+};
+
+// A simplified version of a mesh, indexing the same vertices as the full one.
+struct MeshLod {
+	std::vector<unsigned int> indices;
+	float error = 0;  // How far the surface moved from the original, in model units.
+};
+
+// CPU side of a mesh, everything we need to build one (or cache it) without touching GL.
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<TextureRef> textures;
+	std::vector<MeshLod> lods;  // Coarser as they go, empty unless LODs were generated.
+};
+
+// Box and sphere around a mesh, in model space.
+struct Bounds {
+	glm::vec3 min = glm::vec3(0.0f), max = glm::vec3(0.0f);
+	glm::vec3 centre = glm::vec3(0.0f);
+	float radius = 0;
+};
+
+// Where a mesh lives inside its GeometryArena.
+struct MeshRange {
+	unsigned int baseVertex;  // Added to every index, so indices stay local to the mesh.
+	unsigned int firstIndex;  // In units of indexType, the arena aligns each mesh's indices to their size.
+	unsigned int indexCount;
+	unsigned int indexType;   // GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+};
+
 /*
-* A mesh contains all the relevant vertex data for that particular mesh, and how to draw it.
+* A mesh is a range of its model's geometry buffers plus the textures to draw it with.
 */
 class Mesh {
-	std::vector<Vertex> vertices;
 	std::vector<Texture> textures;
-	std::vector<unsigned int> indices;
+	std::vector<int> units;  // Texture unit of each texture, -1 if the shader has no sampler for it.
+
+	unsigned int VAO;  // Belongs to the model's arena, other meshes may share it.
+	MeshRange range;
+	Dequantize dequantize;  // Identity unless the vertices are packed.
+	Bounds bounds;
 
-	unsigned int VAO, VBO, EBO;
+	// Level 0 is the full mesh, the rest are MeshLods in the same buffers. 'lod' is the one draw() uses.
+	std::vector<MeshRange> lodRanges;
+	std::vector<float> lodErrors;
+	unsigned int lod = 0;
+public:
+	static const int MAX_TEXTURES_PER_TYPE = 4;
 
-	void init() {
-		glGenBuffers(1, &VBO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+	// Every '<type>_texture<num>' sampler has its own fixed texture unit.
+	static int samplerUnit(Texture::Type type, int num) {
+		return type * MAX_TEXTURES_PER_TYPE + num - 1;
+	}
 
-		glGenVertexArrays(1, &VAO);
-		glBindVertexArray(VAO);
+	// Points the program's samplers at their units. Only needed once after linking, so draws don't touch sampler uniforms.
+	static void bindSamplers(unsigned int program) {
+		const char *names[] = { "diffuse", "specular", "normal", "height" };
 
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+		glUseProgram(program);
+		for (int type = Texture::DIFFUSE; type <= Texture::HEIGHT; type++) {
+			for (int num = 1; num <= MAX_TEXTURES_PER_TYPE; num++) {
+				std::string sampler = std::string(names[type]) + "_texture" + std::to_string(num);
+				glUniform1i(glGetUniformLocation(program, sampler.c_str()), samplerUnit((Texture::Type)type, num));
+			}
+		}
+		glUseProgram(0);
+	}
+
+	// Attribute layout for the bound VAO and vertex buffer, locations match model.vert.
+	static void setAttributes(VertexFormat format) {
+		if (format == PACKED_VERTICES) {
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, uv));
+		}
+		else {
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, uv));
+		}
 		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
 		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, uv));
 		glEnableVertexAttribArray(2);
+	}
 
-		glGenBuffers(1, &EBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+	static size_t vertexSize(VertexFormat format) {
+		return format == PACKED_VERTICES ? sizeof(PackedVertex) : sizeof(Vertex);
+	}
 
-		glBindVertexArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	// Indices are local to the mesh, so the narrowest type that can address every vertex is enough.
+	static unsigned int indexType(unsigned int vertexCount) {
+		if (vertexCount <= 256)
+			return GL_UNSIGNED_BYTE;
+		if (vertexCount <= 65536)
+			return GL_UNSIGNED_SHORT;
+		return GL_UNSIGNED_INT;
 	}
-public:
-	Mesh(
-		std::vector<Vertex> vertices, 
-		std::vector<Texture> textures, 
-		std::vector<unsigned int> indices
-	): vertices(vertices), textures(textures), indices(indices) {
-		init();
-	}
-
-	void draw(unsigned int shaderProgram) {
-		glBindVertexArray(VAO);
-		
-		// Texture binding, this assumes samplers are titled '<type>_texture<num>' in the shader.
-		int diffuse = 1, specular = 1, normal = 1, height = 1;
-		for (int i = 0; i < textures.size(); i++) {
-			
-			std::string type = "";
-			int num = 0;
 
-			if (textures[i].type == Texture::DIFFUSE) {
-				type = "diffuse";
-				num = diffuse++;
-			}
-			else if (textures[i].type == Texture::SPECULAR) {
-				type = "specular";
-				num = specular++;
-			}
-			else if (textures[i].type == Texture::NORMAL) {
-				type = "normal";
-				num = normal++;
-			}
-			else if (textures[i].type == Texture::HEIGHT) {
-				type = "height";
-				num = height++;
-			}
+	static size_t indexSize(unsigned int type) {
+		return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+	}
+
+	static Bounds computeBounds(const Vertex *vertices, unsigned int count) {
+		Bounds bounds;
+		if (count == 0)
+			return bounds;
+
+		bounds.min = bounds.max = vertices[0].position;
+		for (unsigned int i = 1; i < count; i++) {
+			bounds.min = glm::min(bounds.min, vertices[i].position);
+			bounds.max = glm::max(bounds.max, vertices[i].position);
+		}
+		bounds.centre = (bounds.min + bounds.max) * 0.5f;
+		for (unsigned int i = 0; i < count; i++)
+			bounds.radius = std::max(bounds.radius, glm::length(vertices[i].position - bounds.centre));
+		return bounds;
+	}
+
+	static VertexUniforms findVertexUniforms(unsigned int program) {
+		VertexUniforms uniforms;
+		uniforms.positionScale = glGetUniformLocation(program, "positionScale");
+		uniforms.positionOffset = glGetUniformLocation(program, "positionOffset");
+		uniforms.packedNormals = glGetUniformLocation(program, "packedNormals");
+		return uniforms;
+	}
+
+	// Takes the textures over, the model has no use for its list once the mesh is made.
+	Mesh(std::vector<Texture> &&textures, unsigned int VAO, MeshRange range, Bounds bounds, Dequantize dequantize = Dequantize()):
+		textures(std::move(textures)), VAO(VAO), range(range), dequantize(dequantize), bounds(bounds), lodRanges(1, range), lodErrors(1, 0.0f) {
+		// Numbering matches the sampler names, the first diffuse texture is 'diffuse_texture1' and so on.
+		int count[4] = { 0, 0, 0, 0 };
+		units.reserve(this->textures.size());
+		for (const Texture &texture : this->textures) {
+			int num = ++count[texture.type];
+			units.push_back(num <= MAX_TEXTURES_PER_TYPE ? samplerUnit(texture.type, num) : -1);
+		}
+	}
+
+	std::vector<Texture> const &getTextures() const {
+		return textures;
+	}
+
+	unsigned int vao() const {
+		return VAO;
+	}
+
+	// Range of the LOD currently selected.
+	MeshRange const &getRange() const {
+		return range;
+	}
+
+	Bounds const &getBounds() const {
+		return bounds;
+	}
+
+	void addLod(MeshRange lodRange, float error) {
+		lodRanges.push_back(lodRange);
+		lodErrors.push_back(error);
+	}
+
+	unsigned int lodCount() const {
+		return lodRanges.size();
+	}
 
-			// Set the sampler and bind to the texture unit.
-			glUniform1i(glGetUniformLocation(shaderProgram, (type + "_texture" + std::to_string(num)).c_str()), i);
-			glActiveTexture(GL_TEXTURE0 + i);
+	unsigned int getLod() const {
+		return lod;
+	}
+
+	// Picks the coarsest LOD that moves the surface by no more than maxError (model units).
+	void selectLod(float maxError) {
+		lod = 0;
+		while (lod + 1 < lodRanges.size() && lodErrors[lod + 1] <= maxError)
+			lod++;
+		range = lodRanges[lod];
+	}
+
+	Dequantize const &getDequantize() const {
+		return dequantize;
+	}
+
+	void setDequantize(VertexUniforms const &uniforms) const {
+		glUniform3fv(uniforms.positionScale, 1, &dequantize.scale[0]);
+		glUniform3fv(uniforms.positionOffset, 1, &dequantize.offset[0]);
+	}
+
+	// #defines of the model shader variant this mesh needs. Meshes without a specular map skip sampling one.
+	std::vector<std::string> shaderDefines() const {
+		for (const Texture &texture : textures)
+			if (texture.type == Texture::SPECULAR)
+				return { "HAS_SPECULAR_MAP" };
+		return {};
+	}
+
+	// True if both meshes bind exactly the same textures, so they can be drawn in one batch.
+	bool sameTextures(Mesh const &other) const {
+		if (textures.size() != other.textures.size())
+			return false;
+		for (int i = 0; i < textures.size(); i++)
+			if (textures[i].id != other.textures[i].id || units[i] != other.units[i])
+				return false;
+		return true;
+	}
+
+	void bindTextures() const {
+		// Samplers already point at their units (see bindSamplers), so this is just binds.
+		for (int i = 0; i < textures.size(); i++) {
+			if (units[i] < 0)
+				continue;
+			glActiveTexture(GL_TEXTURE0 + units[i]);
 			glBindTexture(GL_TEXTURE_2D, textures[i].id);
 		}
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+	}
 
-		glBindVertexArray(0);
-		glActiveTexture(GL_TEXTURE0);
+	// Expects vao() to be bound already, the model only rebinds when it changes.
+	void draw() {
+		bindTextures();
+		glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, range.indexType,
+			(void*)((size_t)range.firstIndex * indexSize(range.indexType)), range.baseVertex);
 	}
 };
 
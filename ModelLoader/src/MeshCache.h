@@ -0,0 +1,297 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "Mesh.h"
+#include "IndexCodec.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+* Binary cache of an imported model, written next to the source file on the first import.
+* Warm starts memory map it and hand the vertex/index blobs straight to GL, Assimp is never touched.
+*
+* Layout:  Header | MeshRecord * meshCount | texture paths | LodRecords | vertex + index blobs (16 byte aligned)
+* Index blobs are raw unsigned ints, or IndexCodec encoded when the cache was written with COMPRESSED_INDICES.
+* Every LOD of a mesh has its own index blob over the mesh's one vertex blob.
+*/
+namespace MeshCache {
+	const uint32_t MAGIC = 0x4D4C474F; // "OGLM"
+	const uint32_t VERSION = 5;  // 5: vertices joined on import.
+
+	// Import options that change what's in the cache, a cache written with different ones is stale.
+	const uint32_t OPTIMIZED = 1 << 0;
+	const uint32_t COMPRESSED_INDICES = 1 << 1;
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vertexSize;  // sizeof(Vertex) when written, guards against layout changes.
+		uint32_t meshCount;
+		uint32_t importFlags;
+		uint32_t lodLevels;   // LODs asked for on import, meshes may have fewer if they couldn't simplify further.
+		uint64_t sourceSize;  // Size and modified time of the source file, a mismatch means the cache is stale.
+		int64_t sourceTime;
+	};
+
+	struct MeshRecord {
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t textureCount;
+		uint32_t textureOffset;  // Offset of this mesh's texture references in the file.
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint64_t indexBytes;  // Size of the index blob, smaller than indexCount * 4 when compressed.
+		uint32_t lodCount;
+		uint32_t lodOffset;   // Offset of this mesh's LodRecords.
+	};
+
+	struct LodRecord {
+		uint32_t indexCount;
+		float error;
+		uint64_t indexOffset;
+		uint64_t indexBytes;
+	};
+
+	// Followed by pathLength chars, not null terminated.
+	struct TextureRecord {
+		uint32_t type;
+		uint32_t pathLength;
+	};
+
+	// A read only view of a whole file in memory.
+	class MappedFile {
+		const unsigned char *bytes = nullptr;
+		size_t length = 0;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+#endif
+	public:
+		MappedFile() = default;
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+
+		bool open(std::string const &path) {
+#ifdef _WIN32
+			file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+				return false;
+			length = (size_t)fileSize.QuadPart;
+
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping == NULL)
+				return false;
+
+			bytes = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				return false;
+
+			struct stat info;
+			if (fstat(fd, &info) != 0 || info.st_size == 0) {
+				::close(fd);
+				return false;
+			}
+			length = (size_t)info.st_size;
+
+			void *view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);  // The mapping keeps its own reference to the file.
+			bytes = view == MAP_FAILED ? nullptr : (const unsigned char*)view;
+#endif
+			return bytes != nullptr;
+		}
+
+		~MappedFile() {
+#ifdef _WIN32
+			if (bytes) UnmapViewOfFile(bytes);
+			if (mapping != NULL) CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+			if (bytes) munmap((void*)bytes, length);
+#endif
+		}
+
+		const unsigned char *data() const { return bytes; }
+		size_t size() const { return length; }
+	};
+
+	// Size and modified time of a file, used to tell if the cache still matches its source.
+	bool sourceStamp(std::string const &path, uint64_t &size, int64_t &time) {
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			return false;
+
+		size = (uint64_t)info.st_size;
+		time = (int64_t)info.st_mtime;
+		return true;
+	}
+
+	uint64_t align(uint64_t offset) {
+		return (offset + 15) & ~(uint64_t)15;
+	}
+
+	bool write(std::string const &cachePath, std::string const &sourcePath, std::vector<MeshData> const &meshes, uint32_t importFlags, uint32_t lodLevels) {
+		Header header = {};
+		header.magic = MAGIC;
+		header.version = VERSION;
+		header.vertexSize = sizeof(Vertex);
+		header.meshCount = meshes.size();
+		header.importFlags = importFlags;
+		header.lodLevels = lodLevels;
+		if (!sourceStamp(sourcePath, header.sourceSize, header.sourceTime))
+			return false;
+
+		// Every index list as it'll be stored: each mesh's full indices, then its LODs.
+		bool compress = (importFlags & COMPRESSED_INDICES) != 0;
+		std::vector<std::vector<unsigned char>> blobs;
+		auto addBlob = [&](std::vector<unsigned int> const &indices) {
+			if (compress)
+				blobs.push_back(IndexCodec::encode(indices.data(), indices.size()));
+			else
+				blobs.emplace_back((const unsigned char*)indices.data(), (const unsigned char*)(indices.data() + indices.size()));
+		};
+		for (const MeshData &mesh : meshes) {
+			addBlob(mesh.indices);
+			for (const MeshLod &lod : mesh.lods)
+				addBlob(lod.indices);
+		}
+
+		// Lay out the file first so every record knows where its data lives.
+		std::vector<MeshRecord> records(meshes.size());
+		std::vector<LodRecord> lodRecords;
+		uint64_t offset = sizeof(Header) + sizeof(MeshRecord) * meshes.size();
+		for (int i = 0; i < meshes.size(); i++) {
+			records[i].vertexCount = meshes[i].vertices.size();
+			records[i].indexCount = meshes[i].indices.size();
+			records[i].textureCount = meshes[i].textures.size();
+			records[i].textureOffset = offset;
+			for (const TextureRef &ref : meshes[i].textures)
+				offset += sizeof(TextureRecord) + ref.path.size();
+		}
+		uint64_t lodTableOffset = offset = align(offset);
+		for (int i = 0; i < meshes.size(); i++) {
+			records[i].lodCount = meshes[i].lods.size();
+			records[i].lodOffset = lodTableOffset + sizeof(LodRecord) * lodRecords.size();
+			for (const MeshLod &lod : meshes[i].lods)
+				lodRecords.push_back({ (uint32_t)lod.indices.size(), lod.error, 0, 0 });
+		}
+		offset += sizeof(LodRecord) * lodRecords.size();
+
+		unsigned int blob = 0, lodRecord = 0;
+		for (int i = 0; i < meshes.size(); i++) {
+			records[i].vertexOffset = offset = align(offset);
+			offset += meshes[i].vertices.size() * sizeof(Vertex);
+			records[i].indexOffset = offset = align(offset);
+			records[i].indexBytes = blobs[blob++].size();
+			offset += records[i].indexBytes;
+			for (int l = 0; l < meshes[i].lods.size(); l++, lodRecord++) {
+				lodRecords[lodRecord].indexOffset = offset = align(offset);
+				lodRecords[lodRecord].indexBytes = blobs[blob++].size();
+				offset += lodRecords[lodRecord].indexBytes;
+			}
+		}
+
+		std::ofstream stream(cachePath, std::ios::binary | std::ios::trunc);
+		if (!stream)
+			return false;
+
+		stream.write((const char*)&header, sizeof(Header));
+		stream.write((const char*)records.data(), sizeof(MeshRecord) * records.size());
+		for (const MeshData &mesh : meshes) {
+			for (const TextureRef &ref : mesh.textures) {
+				TextureRecord texture = { (uint32_t)ref.type, (uint32_t)ref.path.size() };
+				stream.write((const char*)&texture, sizeof(TextureRecord));
+				stream.write(ref.path.data(), ref.path.size());
+			}
+		}
+
+		const char padding[16] = {};
+		stream.write(padding, lodTableOffset - (uint64_t)stream.tellp());
+		stream.write((const char*)lodRecords.data(), sizeof(LodRecord) * lodRecords.size());
+
+		blob = 0;
+		lodRecord = 0;
+		for (int i = 0; i < meshes.size(); i++) {
+			stream.write(padding, records[i].vertexOffset - (uint64_t)stream.tellp());
+			stream.write((const char*)meshes[i].vertices.data(), meshes[i].vertices.size() * sizeof(Vertex));
+			stream.write(padding, records[i].indexOffset - (uint64_t)stream.tellp());
+			stream.write((const char*)blobs[blob].data(), blobs[blob].size());
+			blob++;
+			for (int l = 0; l < meshes[i].lods.size(); l++, lodRecord++, blob++) {
+				stream.write(padding, lodRecords[lodRecord].indexOffset - (uint64_t)stream.tellp());
+				stream.write((const char*)blobs[blob].data(), blobs[blob].size());
+			}
+		}
+
+		return (bool)stream;
+	}
+
+	// Checks the cache is intact and matches the source, so records can be trusted without further bounds checks.
+	// Compressed index blobs are only bounds checked here, IndexCodec::decode checks their contents.
+	bool validate(MappedFile const &file, std::string const &sourcePath, uint32_t importFlags, uint32_t lodLevels) {
+		if (file.size() < sizeof(Header))
+			return false;
+
+		const Header *header = (const Header*)file.data();
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		if (header->magic != MAGIC || header->version != VERSION || header->vertexSize != sizeof(Vertex) || header->importFlags != importFlags ||
+			header->lodLevels != lodLevels)
+			return false;
+		if (!sourceStamp(sourcePath, sourceSize, sourceTime) || header->sourceSize != sourceSize || header->sourceTime != sourceTime)
+			return false;
+		if (sizeof(Header) + (uint64_t)header->meshCount * sizeof(MeshRecord) > file.size())
+			return false;
+
+		const MeshRecord *records = (const MeshRecord*)(file.data() + sizeof(Header));
+		for (int i = 0; i < header->meshCount; i++) {
+			const MeshRecord &record = records[i];
+			if (record.vertexOffset + (uint64_t)record.vertexCount * sizeof(Vertex) > file.size() ||
+				record.indexOffset + record.indexBytes > file.size())
+				return false;
+			if (!(importFlags & COMPRESSED_INDICES) && record.indexBytes != (uint64_t)record.indexCount * sizeof(unsigned int))
+				return false;
+
+			if (record.lodOffset + (uint64_t)record.lodCount * sizeof(LodRecord) > file.size())
+				return false;
+			const LodRecord *lods = (const LodRecord*)(file.data() + record.lodOffset);
+			for (int l = 0; l < record.lodCount; l++) {
+				if (lods[l].indexOffset + lods[l].indexBytes > file.size())
+					return false;
+				if (!(importFlags & COMPRESSED_INDICES) && lods[l].indexBytes != (uint64_t)lods[l].indexCount * sizeof(unsigned int))
+					return false;
+			}
+
+			uint64_t offset = record.textureOffset;
+			for (int t = 0; t < record.textureCount; t++) {
+				if (offset + sizeof(TextureRecord) > file.size())
+					return false;
+				offset += sizeof(TextureRecord) + ((const TextureRecord*)(file.data() + offset))->pathLength;
+				if (offset > file.size())
+					return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+#endif
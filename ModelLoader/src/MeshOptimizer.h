@@ -0,0 +1,274 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include "Mesh.h"
+#include "Arena.h"
+
+/*
+* Import time reordering of a mesh's triangles and vertices for the GPU:
+*  1. Vertex cache: Forsyth's greedy ordering so recently transformed vertices get reused.
+*  2. Overdraw: the cache ordered triangles are cut into clusters and outward facing clusters are moved first,
+*     as long as that doesn't cost more than a few percent of the cache efficiency.
+*  3. Vertex fetch: vertices are renumbered in the order the index buffer first uses them.
+* Everything works on plain vectors, no GL involved. Working memory comes from 'scratch' if there is one, rewound
+* before returning, otherwise the heap.
+*/
+namespace MeshOptimizer {
+	const int CACHE_SIZE = 32;        // LRU cache Forsyth's scoring assumes.
+	const int FIFO_CACHE_SIZE = 16;   // Post transform cache used to measure ACMR/ATVR.
+
+	struct Stats {
+		float acmr;  // Average cache miss ratio: vertices transformed per triangle, 0.5 is ideal for a big grid, 3 is worst.
+		float atvr;  // Average transformed vertex ratio: vertices transformed per unique vertex, 1 is ideal.
+	};
+
+	// Simulates a FIFO post transform cache over the index buffer.
+	Stats analyze(std::vector<unsigned int> const &indices, unsigned int vertexCount, int cacheSize = FIFO_CACHE_SIZE, LinearArena *scratch = nullptr) {
+		ArenaScope scope(scratch);
+		ArenaVector<unsigned int> cache(cacheSize, ~0u, scratch);
+		ArenaVector<char> cached(vertexCount, 0, scratch);
+		unsigned int head = 0, misses = 0;
+
+		for (unsigned int index : indices) {
+			if (cached[index])
+				continue;
+
+			misses++;
+			if (cache[head] != ~0u)
+				cached[cache[head]] = 0;
+			cache[head] = index;
+			cached[index] = 1;
+			head = (head + 1) % cacheSize;
+		}
+
+		Stats stats;
+		stats.acmr = indices.empty() ? 0 : (float)misses / (indices.size() / 3);
+		stats.atvr = vertexCount == 0 ? 0 : (float)misses / vertexCount;
+		return stats;
+	}
+
+	// Forsyth's vertex score, higher means the vertex wants its triangles emitted sooner.
+	float vertexScore(int cachePosition, int remainingTriangles) {
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0) {
+			if (cachePosition < 3)
+				score = 0.75f;  // Just used by the last triangle, fixed score so the next one doesn't favour any of them.
+			else
+				score = std::pow(1.0f - (float)(cachePosition - 3) / (CACHE_SIZE - 3), 1.5f);
+		}
+
+		// Vertices with few triangles left get a boost, finishing them off frees up the cache.
+		return score + 2.0f * std::pow((float)remainingTriangles, -0.5f);
+	}
+
+	std::vector<unsigned int> optimizeVertexCache(std::vector<unsigned int> const &indices, unsigned int vertexCount, LinearArena *scratch = nullptr) {
+		unsigned int triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return indices;
+		ArenaScope scope(scratch);
+
+		// Triangles using each vertex, as one flat list with per vertex offsets.
+		ArenaVector<unsigned int> remaining(vertexCount, 0, scratch), offsets(vertexCount + 1, 0, scratch);
+		for (unsigned int index : indices)
+			remaining[index]++;
+		for (unsigned int v = 0; v < vertexCount; v++)
+			offsets[v + 1] = offsets[v] + remaining[v];
+
+		ArenaVector<unsigned int> adjacency(indices.size(), 0, scratch), filled(vertexCount, 0, scratch);
+		for (unsigned int t = 0; t < triangleCount; t++)
+			for (int k = 0; k < 3; k++) {
+				unsigned int v = indices[t * 3 + k];
+				adjacency[offsets[v] + filled[v]++] = t;
+			}
+
+		ArenaVector<int> cachePosition(vertexCount, -1, scratch);
+		ArenaVector<float> score(vertexCount, 0.0f, scratch), triangleScore(triangleCount, 0.0f, scratch);
+		ArenaVector<char> emitted(triangleCount, 0, scratch);
+		for (unsigned int v = 0; v < vertexCount; v++)
+			score[v] = vertexScore(-1, remaining[v]);
+		for (unsigned int t = 0; t < triangleCount; t++)
+			triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+		ArenaVector<unsigned int> cache(scratch), nextCache(scratch);
+		cache.reserve(CACHE_SIZE + 3);
+		nextCache.reserve(CACHE_SIZE + 3);
+		std::vector<unsigned int> result;
+		result.reserve(indices.size());
+
+		unsigned int scan = 0;  // Fallback when nothing in the cache has triangles left: next unemitted triangle in input order.
+		int best = -1;
+		for (unsigned int emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+			if (best < 0) {
+				while (emitted[scan])
+					scan++;
+				best = scan;
+			}
+
+			unsigned int triangle = best;
+			emitted[triangle] = 1;
+
+			// The triangle's vertices go to the front of the LRU cache, the rest shift back.
+			nextCache.clear();
+			for (int k = 0; k < 3; k++) {
+				unsigned int v = indices[triangle * 3 + k];
+				result.push_back(v);
+				nextCache.push_back(v);
+
+				// Drop this triangle from the vertex's remaining list.
+				unsigned int *begin = &adjacency[offsets[v]], *end = begin + remaining[v];
+				*std::find(begin, end, triangle) = *(end - 1);
+				remaining[v]--;
+			}
+			for (unsigned int v : cache)
+				if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2])
+					nextCache.push_back(v);
+
+			// Anything pushed out of the cache loses its position score, so it gets rescored along with the cache.
+			for (unsigned int i = CACHE_SIZE; i < nextCache.size(); i++)
+				cachePosition[nextCache[i]] = -1;
+			for (unsigned int i = 0; i < nextCache.size() && i < CACHE_SIZE; i++)
+				cachePosition[nextCache[i]] = i;
+
+			// Rescore everything that moved first, a triangle can share two or three of these vertices.
+			for (unsigned int v : nextCache) {
+				float updated = vertexScore(cachePosition[v], remaining[v]);
+				float delta = updated - score[v];
+				score[v] = updated;
+				for (unsigned int i = 0; i < remaining[v]; i++)
+					triangleScore[adjacency[offsets[v] + i]] += delta;
+			}
+
+			// Then pick the best triangle touching the cache for next time.
+			best = -1;
+			float bestScore = -1.0f;
+			for (unsigned int c = 0; c < nextCache.size() && c < CACHE_SIZE; c++) {
+				unsigned int v = nextCache[c];
+				for (unsigned int i = 0; i < remaining[v]; i++) {
+					unsigned int t = adjacency[offsets[v] + i];
+					if (triangleScore[t] > bestScore) {
+						bestScore = triangleScore[t];
+						best = t;
+					}
+				}
+			}
+
+			if (nextCache.size() > CACHE_SIZE)
+				nextCache.resize(CACHE_SIZE);
+			cache.swap(nextCache);
+		}
+
+		return result;
+	}
+
+	// Reorders clusters of cache ordered triangles so those facing away from the mesh centre draw first,
+	// they tend to occlude the rest. Returns the input if the cache efficiency would drop by more than 'threshold'.
+	std::vector<unsigned int> optimizeOverdraw(std::vector<unsigned int> const &indices, std::vector<Vertex> const &vertices, float threshold = 1.05f,
+		LinearArena *scratch = nullptr) {
+		unsigned int triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return indices;
+		ArenaScope scope(scratch);
+
+		// Cluster boundaries are where the cache starts over: a triangle with all 3 vertices missing.
+		ArenaVector<unsigned int> clusterStarts(scratch);
+		{
+			ArenaVector<unsigned int> cache(FIFO_CACHE_SIZE, ~0u, scratch);
+			ArenaVector<char> cached(vertices.size(), 0, scratch);
+			unsigned int head = 0;
+			for (unsigned int t = 0; t < triangleCount; t++) {
+				int misses = 0;
+				for (int k = 0; k < 3; k++) {
+					unsigned int index = indices[t * 3 + k];
+					if (cached[index])
+						continue;
+					misses++;
+					if (cache[head] != ~0u)
+						cached[cache[head]] = 0;
+					cache[head] = index;
+					cached[index] = 1;
+					head = (head + 1) % FIFO_CACHE_SIZE;
+				}
+				if (misses == 3 || t == 0)
+					clusterStarts.push_back(t);
+			}
+		}
+		clusterStarts.push_back(triangleCount);
+
+		glm::vec3 meshCentre(0.0f);
+		for (const Vertex &v : vertices)
+			meshCentre += v.position;
+		meshCentre /= (float)std::max<size_t>(vertices.size(), 1);
+
+		// Sort key: how much the cluster faces away from the centre of the mesh.
+		struct Cluster {
+			unsigned int first, last;
+			float key;
+		};
+		ArenaVector<Cluster> clusters(scratch);
+		for (unsigned int c = 0; c + 1 < clusterStarts.size(); c++) {
+			glm::vec3 centroid(0.0f), normal(0.0f);
+			float area = 0.0f;
+			for (unsigned int t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+				glm::vec3 a = vertices[indices[t * 3]].position, b = vertices[indices[t * 3 + 1]].position, d = vertices[indices[t * 3 + 2]].position;
+				glm::vec3 faceNormal = glm::cross(b - a, d - a);  // Length is twice the area, so this is area weighted.
+				float faceArea = glm::length(faceNormal);
+				centroid += (a + b + d) / 3.0f * faceArea;
+				normal += faceNormal;
+				area += faceArea;
+			}
+
+			Cluster cluster = { clusterStarts[c], clusterStarts[c + 1], 0.0f };
+			if (area > 0.0f && glm::length(normal) > 0.0f)
+				cluster.key = glm::dot(centroid / area - meshCentre, glm::normalize(normal));
+			clusters.push_back(cluster);
+		}
+
+		std::stable_sort(clusters.begin(), clusters.end(), [](Cluster const &a, Cluster const &b) { return a.key > b.key; });
+
+		std::vector<unsigned int> result;
+		result.reserve(indices.size());
+		for (const Cluster &cluster : clusters)
+			result.insert(result.end(), indices.begin() + cluster.first * 3, indices.begin() + cluster.last * 3);
+
+		if (analyze(result, vertices.size(), FIFO_CACHE_SIZE, scratch).acmr > analyze(indices, vertices.size(), FIFO_CACHE_SIZE, scratch).acmr * threshold)
+			return indices;
+		return result;
+	}
+
+	// Renumbers vertices in first use order so vertex fetches walk the buffer forwards. Unused vertices are dropped.
+	void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, LinearArena *scratch = nullptr) {
+		ArenaScope scope(scratch);
+		ArenaVector<unsigned int> remap(vertices.size(), ~0u, scratch);
+		std::vector<Vertex> reordered;
+		reordered.reserve(vertices.size());
+
+		for (unsigned int &index : indices) {
+			if (remap[index] == ~0u) {
+				remap[index] = reordered.size();
+				reordered.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+
+		vertices.swap(reordered);
+	}
+
+	// All three passes, returns the cache stats from before and after.
+	void optimize(MeshData &mesh, Stats &before, Stats &after, LinearArena *scratch = nullptr) {
+		before = analyze(mesh.indices, mesh.vertices.size(), FIFO_CACHE_SIZE, scratch);
+
+		mesh.indices = optimizeVertexCache(mesh.indices, mesh.vertices.size(), scratch);
+		mesh.indices = optimizeOverdraw(mesh.indices, mesh.vertices, 1.05f, scratch);
+		optimizeVertexFetch(mesh.vertices, mesh.indices, scratch);
+
+		after = analyze(mesh.indices, mesh.vertices.size(), FIFO_CACHE_SIZE, scratch);
+	}
+}
+
+#endif
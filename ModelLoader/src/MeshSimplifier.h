@@ -0,0 +1,306 @@
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cfloat>
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include "Mesh.h"
+#include "Arena.h"
+
+/*
+* Quadric error metric simplification (Garland & Heckbert) by edge collapse.
+* Vertices only ever collapse onto other existing vertices, so every LOD is just a new index list over the
+* original vertex buffer and all of them can share it.
+*
+* Each vertex sums the planes of its triangles into a quadric, the cost of collapsing v onto u is the quadric of both
+* evaluated at u: how far u is from all the planes v used to sit on. Collapses are done cheapest first in passes,
+* touching each vertex at most once per pass so costs don't go stale. Open borders only slide along themselves and
+* UV/normal seams (several vertices at one position) are locked, so LODs don't tear.
+*/
+namespace MeshSimplifier {
+	// Symmetric 4x4 matrix of summed plane equations, plus the area they came from.
+	struct Quadric {
+		double a00 = 0, a01 = 0, a02 = 0, a03 = 0, a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
+		double weight = 0;
+
+		// Plane n.p + d = 0 with a unit normal.
+		static Quadric plane(glm::vec3 n, float d, double w) {
+			Quadric q;
+			q.a00 = w * n.x * n.x; q.a01 = w * n.x * n.y; q.a02 = w * n.x * n.z; q.a03 = w * n.x * d;
+			q.a11 = w * n.y * n.y; q.a12 = w * n.y * n.z; q.a13 = w * n.y * d;
+			q.a22 = w * n.z * n.z; q.a23 = w * n.z * d;
+			q.a33 = w * d * d;
+			q.weight = w;
+			return q;
+		}
+
+		void add(Quadric const &q) {
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+			a11 += q.a11; a12 += q.a12; a13 += q.a13;
+			a22 += q.a22; a23 += q.a23;
+			a33 += q.a33;
+			weight += q.weight;
+		}
+
+		// Weighted mean squared distance from p to the planes.
+		double error(glm::vec3 p) const {
+			double x = p.x, y = p.y, z = p.z;
+			double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+				+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+				+ a22 * z * z + 2 * a23 * z
+				+ a33;
+			return weight > 0 ? std::fabs(e) / weight : 0;
+		}
+	};
+
+	class Simplifier {
+		enum Kind : char {
+			MANIFOLD,  // Free to collapse onto any neighbour.
+			BORDER,    // On an open edge, only collapses along it.
+			LOCKED     // Seam or non manifold, never moves.
+		};
+
+		std::vector<glm::vec3> positions;
+		std::vector<unsigned int> indices;
+		std::vector<unsigned int> welded;  // First vertex at the same position, so seams share topology.
+		std::vector<Kind> kinds;
+		std::vector<Quadric> quadrics;
+		double maxCost = 0;
+		LinearArena *scratch;  // Working memory of each step, rewound when it's done.
+
+		typedef std::unordered_map<uint64_t, unsigned int, std::hash<uint64_t>, std::equal_to<uint64_t>,
+			ArenaAllocator<std::pair<const uint64_t, unsigned int>>> EdgeMap;
+
+		static uint64_t edgeKey(unsigned int a, unsigned int b) {
+			return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+		}
+
+		// How many triangles use each edge, by welded vertex.
+		EdgeMap countEdges() const {
+			EdgeMap edges(indices.size(), std::hash<uint64_t>(), std::equal_to<uint64_t>(), scratch);
+			for (size_t t = 0; t < indices.size(); t += 3)
+				for (int k = 0; k < 3; k++)
+					edges[edgeKey(welded[indices[t + k]], welded[indices[t + (k + 1) % 3]])]++;
+			return edges;
+		}
+
+		void weld() {
+			ArenaScope scope(scratch);
+			ArenaVector<unsigned int> order(positions.size(), 0, scratch);
+			for (unsigned int i = 0; i < order.size(); i++)
+				order[i] = i;
+			auto less = [&](unsigned int a, unsigned int b) {
+				glm::vec3 const &p = positions[a], &q = positions[b];
+				if (p.x != q.x) return p.x < q.x;
+				if (p.y != q.y) return p.y < q.y;
+				if (p.z != q.z) return p.z < q.z;
+				return a < b;
+			};
+			std::sort(order.begin(), order.end(), less);
+
+			welded.resize(positions.size());
+			for (unsigned int i = 0; i < order.size(); i++) {
+				bool same = i > 0 && positions[order[i]] == positions[order[i - 1]];
+				welded[order[i]] = same ? welded[order[i - 1]] : order[i];
+			}
+		}
+
+		void classify() {
+			kinds.assign(positions.size(), MANIFOLD);
+			ArenaScope scope(scratch);
+
+			// Several vertices at one spot is a seam.
+			ArenaVector<unsigned int> copies(positions.size(), 0, scratch);
+			for (unsigned int v = 0; v < positions.size(); v++)
+				copies[welded[v]]++;
+			for (unsigned int v = 0; v < positions.size(); v++)
+				if (copies[welded[v]] > 1)
+					kinds[v] = LOCKED;
+
+			EdgeMap edges = countEdges();
+			for (size_t t = 0; t < indices.size(); t += 3) {
+				for (int k = 0; k < 3; k++) {
+					unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+					unsigned int count = edges[edgeKey(welded[a], welded[b])];
+					if (count == 2)
+						continue;
+
+					Kind kind = count == 1 ? BORDER : LOCKED;
+					if (kinds[a] < kind) kinds[a] = kind;
+					if (kinds[b] < kind) kinds[b] = kind;
+				}
+			}
+		}
+
+		void buildQuadrics() {
+			quadrics.assign(positions.size(), Quadric());
+			ArenaScope scope(scratch);
+			EdgeMap edges = countEdges();
+
+			for (size_t t = 0; t < indices.size(); t += 3) {
+				glm::vec3 p0 = positions[indices[t]], p1 = positions[indices[t + 1]], p2 = positions[indices[t + 2]];
+				glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				float area = glm::length(normal);
+				if (area == 0.0f)
+					continue;
+				normal /= area;
+
+				Quadric face = Quadric::plane(normal, -glm::dot(normal, p0), area);
+				for (int k = 0; k < 3; k++)
+					quadrics[indices[t + k]].add(face);
+
+				// Open edges get a plane standing up along them, so border vertices resist moving off the border.
+				for (int k = 0; k < 3; k++) {
+					unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+					if (edges[edgeKey(welded[a], welded[b])] != 1)
+						continue;
+
+					glm::vec3 edge = positions[b] - positions[a];
+					float length = glm::length(edge);
+					if (length == 0.0f)
+						continue;
+					glm::vec3 side = glm::normalize(glm::cross(normal, edge));
+					Quadric border = Quadric::plane(side, -glm::dot(side, positions[a]), 10.0 * length * length);
+					quadrics[a].add(border);
+					quadrics[b].add(border);
+				}
+			}
+		}
+
+		// Would moving v onto u turn any of v's other triangles over?
+		bool flips(unsigned int v, unsigned int u, ArenaVector<unsigned int> const &triangles, ArenaVector<unsigned int> const &offsets) const {
+			for (unsigned int i = offsets[v]; i < offsets[v + 1]; i++) {
+				const unsigned int *triangle = &indices[triangles[i] * 3];
+				if (triangle[0] == u || triangle[1] == u || triangle[2] == u)
+					continue;  // Collapses away.
+
+				glm::vec3 before[3], after[3];
+				for (int k = 0; k < 3; k++) {
+					before[k] = positions[triangle[k]];
+					after[k] = triangle[k] == v ? positions[u] : before[k];
+				}
+				glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+				if (glm::dot(n0, n1) <= 0.0f)
+					return true;
+			}
+			return false;
+		}
+
+		// One round of collapses, returns how many were made.
+		unsigned int pass(unsigned int targetIndexCount, double maxErrorSquared) {
+			unsigned int triangleCount = indices.size() / 3;
+			ArenaScope scope(scratch);
+			EdgeMap edges = countEdges();
+
+			// Triangles around each vertex, as one flat list with per vertex offsets.
+			ArenaVector<unsigned int> offsets(positions.size() + 1, 0, scratch), triangles(indices.size(), 0, scratch);
+			for (unsigned int index : indices)
+				offsets[index + 1]++;
+			for (size_t v = 0; v < positions.size(); v++)
+				offsets[v + 1] += offsets[v];
+			ArenaVector<unsigned int> filled(offsets.begin(), offsets.end() - 1, scratch);
+			for (unsigned int t = 0; t < triangleCount; t++)
+				for (int k = 0; k < 3; k++)
+					triangles[filled[indices[t * 3 + k]]++] = t;
+
+			// Cheapest allowed collapse for every vertex that can move.
+			struct Collapse {
+				unsigned int v, u;
+				double cost;
+			};
+			ArenaVector<Collapse> collapses(scratch);
+			ArenaVector<Collapse> best(positions.size(), Collapse{ 0, 0, DBL_MAX }, scratch);
+			for (unsigned int t = 0; t < triangleCount; t++) {
+				for (int k = 0; k < 3; k++) {
+					for (int direction = 0; direction < 2; direction++) {
+						unsigned int v = indices[t * 3 + (k + direction) % 3], u = indices[t * 3 + (k + 1 - direction) % 3];
+						if (kinds[v] == LOCKED || (kinds[v] == BORDER && edges[edgeKey(welded[v], welded[u])] != 1))
+							continue;
+
+						Quadric q = quadrics[v];
+						q.add(quadrics[u]);
+						double cost = q.error(positions[u]);
+						if (cost < best[v].cost)
+							best[v] = Collapse{ v, u, cost };
+					}
+				}
+			}
+			for (const Collapse &collapse : best)
+				if (collapse.cost <= maxErrorSquared)
+					collapses.push_back(collapse);
+			std::sort(collapses.begin(), collapses.end(), [](Collapse const &a, Collapse const &b) { return a.cost < b.cost; });
+
+			// Each collapse removes about 2 triangles, don't overshoot the target by much. Collapses that conflict with
+			// cheaper ones get skipped, the pass still stops at the wanted'th cost rather than reach for dearer ones.
+			unsigned int wanted = (indices.size() - targetIndexCount) / 6 + 1;
+			double costLimit = collapses.empty() ? 0 : collapses[std::min<size_t>(wanted, collapses.size()) - 1].cost;
+			ArenaVector<char> touched(positions.size(), 0, scratch);
+			ArenaVector<unsigned int> remap(positions.size(), 0, scratch);
+			for (unsigned int v = 0; v < remap.size(); v++)
+				remap[v] = v;
+
+			unsigned int done = 0;
+			for (const Collapse &collapse : collapses) {
+				if (done >= wanted || collapse.cost > costLimit)
+					break;
+				if (touched[collapse.v] || touched[collapse.u] || flips(collapse.v, collapse.u, triangles, offsets))
+					continue;
+
+				// Lock v's neighbourhood for the rest of the pass, its triangles are about to change shape.
+				for (unsigned int i = offsets[collapse.v]; i < offsets[collapse.v + 1]; i++)
+					for (int k = 0; k < 3; k++)
+						touched[indices[triangles[i] * 3 + k]] = 1;
+
+				remap[collapse.v] = collapse.u;
+				quadrics[collapse.u].add(quadrics[collapse.v]);
+				maxCost = std::max(maxCost, collapse.cost);
+				done++;
+			}
+
+			// Rewrite the triangles, dropping the ones that collapsed to a line. These outlive the pass, so they're on the heap.
+			std::vector<unsigned int> remaining;
+			remaining.reserve(indices.size());
+			for (unsigned int t = 0; t < triangleCount; t++) {
+				unsigned int a = remap[indices[t * 3]], b = remap[indices[t * 3 + 1]], c = remap[indices[t * 3 + 2]];
+				if (welded[a] == welded[b] || welded[b] == welded[c] || welded[a] == welded[c])
+					continue;
+				remaining.push_back(a);
+				remaining.push_back(b);
+				remaining.push_back(c);
+			}
+			indices.swap(remaining);
+			return done;
+		}
+	public:
+		// 'scratch' is optional, it only has to outlive the simplifier.
+		Simplifier(std::vector<Vertex> const &vertices, std::vector<unsigned int> const &meshIndices, LinearArena *scratch = nullptr):
+			indices(meshIndices), scratch(scratch) {
+			positions.reserve(vertices.size());
+			for (const Vertex &vertex : vertices)
+				positions.push_back(vertex.position);
+
+			weld();
+			classify();
+			buildQuadrics();
+		}
+
+		// Keeps collapsing from wherever the last call stopped, until the index count is at the target or nothing
+		// cheaper than maxError is left. Calls with falling targets give a LOD chain.
+		std::vector<unsigned int> const &simplify(unsigned int targetIndexCount, float maxError = FLT_MAX) {
+			double maxErrorSquared = (double)maxError * maxError;
+			while (indices.size() > targetIndexCount && pass(targetIndexCount, maxErrorSquared) > 0);
+			return indices;
+		}
+
+		// Worst collapse so far, roughly how far (in model units) the surface has moved from the original.
+		float error() const {
+			return (float)std::sqrt(maxCost);
+		}
+	};
+}
+
+#endif
@@ -1,38 +1,318 @@
 #ifndef MODEL_H
 #define MODEL_H
+#include <algorithm>
+#include <memory>
 #include <vector>
 #include <iostream>
 #include <glm/common.hpp>
 #include <unordered_map>
 #include "Mesh.h"
+#include "GeometryArena.h"
 #include "Texture.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "VertexPacking.h"
+#include "Frustum.h"
+#include "Jobs.h"
+#include "Arena.h"
+#include "Timer.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+struct ModelOptions {
+	bool useCache = true;  // Cache the imported geometry in '<path>.cache' and reuse it while the source is unchanged.
+	Jobs::Scheduler *jobs = nullptr;  // Runs mesh processing on import and culls big models. Kept for draws, so it has to outlive the model.
+	unsigned int threads = 0;  // Without 'jobs', threads of the scheduler made just for the import, 0 = one per core.
+	bool importArenas = true;  // Working memory of mesh processing comes from arenas lent to each job instead of the heap.
+	TextureUtil::AsyncLoader *textureLoader = nullptr;  // Decode textures in the background instead of blocking the load.
+	bool sharedBuffers = true;  // Pack every mesh into one VAO/VBO/EBO instead of giving each mesh its own.
+	bool optimizeMeshes = false;  // Reorder triangles and vertices for the GPU caches on import, see MeshOptimizer.h.
+	VertexFormat vertexFormat = FLOAT_VERTICES;  // PACKED_VERTICES halves the vertex buffers, the program needs bindUniforms().
+	bool narrowIndices = true;  // 8 or 16 bit indices for meshes with few enough vertices, otherwise everything is 32 bit.
+	bool compressIndices = false;  // Store the cache's indices with IndexCodec, smaller file for a bit of decoding on load.
+	unsigned int lodLevels = 0;  // Simplified levels per mesh, each with about half the triangles of the one before.
+	float lodPixelError = 1.0f;  // How many pixels a LOD may move the surface by before a finer one is used.
+};
+
+// Where the load time went, in milliseconds, and the working memory mesh processing took.
+struct ModelLoadTimes {
+	double import = 0;   // Assimp reading the file, or mapping the cache.
+	double process = 0;  // Converting Assimp meshes into MeshData, including optimization and LODs.
+	double upload = 0;   // Textures and GL buffers.
+	double decode = 0;   // Decompressing cached indices, part of upload.
+	size_t scratchPeak = 0;  // Most any one import arena held, in bytes. 0 without import arenas.
+};
+
+// MeshOptimizer's stats over every mesh of an import, ACMR weighted by triangles and ATVR by vertices. All zero
+// unless the meshes were optimized during this load, a load from the cache doesn't run the optimizer.
+struct ModelOptimizeStats {
+	MeshOptimizer::Stats before = { 0, 0 }, after = { 0, 0 };
+	unsigned int triangles = 0;
+};
+
+// One draw as glMultiDrawElementsIndirect reads it from the indirect buffer.
+struct DrawElementsCommand {
+	unsigned int count;
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int baseVertex;
+	unsigned int baseInstance;  // Set to the mesh index, for shaders that want per mesh data.
+};
+
 /*
 * A model contains many meshes.
 */
 class Model {
+public:
+	static const unsigned int CULL_CHUNK = 1024;  // Meshes per culling job, with a scheduler and at least two chunks' worth.
+
+	enum Submission {
+		PER_MESH,             // A glDrawElementsBaseVertex per mesh.
+		MULTI_DRAW_INDIRECT   // A glMultiDrawElementsIndirect per group of meshes sharing textures.
+	};
+private:
 	std::vector<Mesh> meshes;
 	std::string directory;  // Directory of the model.
 	std::unordered_map<std::string, Texture> loadedTextures; // So we dont reload the same texture
+	ModelLoadTimes loadTimes;
+	ModelOptimizeStats optimizeStats;
+	TextureUtil::AsyncLoader *textureLoader;
+	Jobs::Scheduler *jobs;
+
+	std::vector<GeometryArena> arenas;  // Just the one with shared buffers, otherwise one per mesh.
+	bool sharedBuffers;
+	bool narrowIndices;
 
-	void processNode(aiNode *node, const aiScene *scene) {
-		for (int i = 0; i < node->mNumMeshes; i++) {
-			aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
+	VertexFormat vertexFormat;
+	VertexUniforms vertexUniforms;
+	VertexPacking::Error packingError;
 
-			meshes.push_back(processMesh(mesh, scene));
+	// Textures can't change inside a multi draw, so meshes are grouped by texture set and each group is one call.
+	struct IndirectBatch {
+		unsigned int mesh;  // Any mesh of the group, to bind its textures.
+		unsigned int firstCommand;
+		unsigned int commandCount;
+	};
+
+	Submission submission = PER_MESH;
+	std::vector<IndirectBatch> batches;
+	std::vector<DrawElementsCommand> commands;  // What's in the indirect buffer, rewritten when LODs change.
+	unsigned int indirectBuffer = 0;
+
+	// Set by setLodView, draws pick each mesh's LOD from it.
+	bool hasLods = false;
+	bool lodView = false;
+	glm::vec3 lodCamera;
+	glm::mat4 lodModelMatrix;
+	float lodPixelsPerUnit = 0;  // Pixels covered by one unit at a distance of one unit.
+	float lodPixelError;
+	unsigned long long drawnTriangles = 0;
+
+	// Set by setFrustum, draws skip meshes whose box is outside it. 'visible' is what the last draw kept.
+	bool culling = false;
+	Frustum frustum;
+	BoxList boxes;  // Model space bounding box of each mesh.
+	unsigned int visibleCount = 0;
+
+	// Lists a draw works out and throws away. From frameArena if there is one, otherwise kept on the heap between draws.
+	// Either way resizing them doesn't zero them (see ArenaAllocator), a draw writes what it reads.
+	LinearArena *frameArena = nullptr;
+	ArenaVector<unsigned int> visible;
+	ArenaVector<unsigned char> meshVisible;  // 'visible' as a flag per mesh, for the indirect commands.
+	ArenaVector<unsigned int> chunkVisible;  // Visible count of each chunk when culling is split into jobs.
+
+	// Shader variants the meshes need (their Mesh::shaderDefines) and which one each mesh uses. Only used for drawing
+	// once setVariantPrograms has been given a program for each, otherwise everything uses the bound program.
+	std::vector<std::vector<std::string>> variants;
+	std::vector<unsigned int> meshVariant;
+	std::vector<unsigned int> variantPrograms;
+	std::vector<VertexUniforms> variantUniforms;
+
+	// An index list for addMesh, either straight from the cache mapping or from MeshData.
+	struct IndexList {
+		const unsigned int *indices;
+		unsigned int count;
+		float error;
+	};
+
+	void buildIndirectCommands() {
+		// A multi draw has one index type too, so that's part of the grouping.
+		std::vector<std::vector<unsigned int>> groups;
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			int group = 0;
+			while (group < groups.size() && (!meshes[groups[group][0]].sameTextures(meshes[i]) ||
+				meshes[groups[group][0]].getRange().indexType != meshes[i].getRange().indexType))
+				group++;
+			if (group == groups.size())
+				groups.emplace_back();
+			groups[group].push_back(i);
 		}
+		// Meshes with the same textures need the same variant, so sorting the groups by it keeps program switches down.
+		std::stable_sort(groups.begin(), groups.end(), [&](std::vector<unsigned int> const &a, std::vector<unsigned int> const &b) {
+			return meshVariant[a[0]] < meshVariant[b[0]];
+		});
+
+		commands.clear();
+		batches.clear();
+		for (const std::vector<unsigned int> &group : groups) {
+			batches.push_back({ group[0], (unsigned int)commands.size(), (unsigned int)group.size() });
+			for (unsigned int mesh : group) {
+				MeshRange const &range = meshes[mesh].getRange();
+				commands.push_back({ range.indexCount, 1, range.firstIndex, (int)range.baseVertex, mesh });
+			}
+		}
+
+		if (indirectBuffer == 0)
+			glGenBuffers(1, &indirectBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		// Rewritten whenever culling or LODs change what's drawn.
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsCommand), commands.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// Culls a chunk of meshes per job, each into its own stretch of 'visible', then closes the gaps so the order is
+	// the same as culling in one go.
+	void cullInJobs() {
+		unsigned int chunks = (boxes.count + CULL_CHUNK - 1) / CULL_CHUNK;
+		chunkVisible.resize(chunks);
+		jobs->forEach(chunks, [&](unsigned int chunk) {
+			unsigned int begin = chunk * CULL_CHUNK;
+			chunkVisible[chunk] = Culling::cull(frustum, boxes, begin, std::min(begin + CULL_CHUNK, boxes.count), &visible[begin]);
+		}, 1);
+
+		visibleCount = chunkVisible[0];
+		for (unsigned int chunk = 1; chunk < chunks; chunk++) {
+			std::copy(&visible[chunk * CULL_CHUNK], &visible[chunk * CULL_CHUNK] + chunkVisible[chunk], &visible[visibleCount]);
+			visibleCount += chunkVisible[chunk];
+		}
+	}
+
+	// Each mesh gets the coarsest LOD whose error covers no more than lodPixelError pixels from where the camera is.
+	void selectLods() {
+		glm::vec3 axes(glm::length(glm::vec3(lodModelMatrix[0])), glm::length(glm::vec3(lodModelMatrix[1])), glm::length(glm::vec3(lodModelMatrix[2])));
+		float scale = std::max(axes.x, std::max(axes.y, axes.z));
+
+		for (unsigned int v = 0; v < visibleCount; v++) {
+			Mesh &mesh = meshes[visible[v]];
+			if (mesh.lodCount() == 1)
+				continue;
+
+			// Distance to the nearest point of the bounding sphere, inside it the full mesh is always used.
+			Bounds const &bounds = mesh.getBounds();
+			glm::vec3 centre = glm::vec3(lodModelMatrix * glm::vec4(bounds.centre, 1.0f));
+			float distance = glm::length(centre - lodCamera) - bounds.radius * scale;
+			if (distance <= 0.0f) {
+				mesh.selectLod(0.0f);
+				continue;
+			}
+
+			// Error in model units that projects to lodPixelError pixels.
+			mesh.selectLod(lodPixelError * distance / (lodPixelsPerUnit * scale));
+		}
+	}
+
+	// Points the indirect commands at the LODs just selected and zeroes the instance count of culled meshes,
+	// only uploading when something changed.
+	void updateIndirectCommands() {
+		meshVisible.assign(meshes.size(), 0);
+		for (unsigned int v = 0; v < visibleCount; v++)
+			meshVisible[visible[v]] = 1;
+
+		bool changed = false;
+		for (DrawElementsCommand &command : commands) {
+			MeshRange const &range = meshes[command.baseInstance].getRange();
+			if (command.firstIndex != range.firstIndex || command.instanceCount != meshVisible[command.baseInstance]) {
+				command.firstIndex = range.firstIndex;
+				command.count = range.indexCount;
+				command.instanceCount = meshVisible[command.baseInstance];
+				changed = true;
+			}
+		}
+
+		if (changed) {
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+			glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsCommand), commands.data());
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+	}
+
+	// Uniforms that are the same for every mesh of the model.
+	void setFormatUniforms(VertexUniforms const &uniforms) {
+		glUniform1i(uniforms.packedNormals, vertexFormat == PACKED_VERTICES);
+		if (vertexFormat == FLOAT_VERTICES) {
+			Dequantize identity;
+			glUniform3fv(uniforms.positionScale, 1, &identity.scale[0]);
+			glUniform3fv(uniforms.positionOffset, 1, &identity.offset[0]);
+		}
+	}
+
+	void useVariant(unsigned int variant) {
+		glUseProgram(variantPrograms[variant]);
+		setFormatUniforms(variantUniforms[variant]);
+	}
+
+	void drawPerMesh() {
+		// A pass per shader variant, or just the one with whatever program is bound.
+		bool byVariant = !variantPrograms.empty();
+		unsigned int passes = byVariant ? variantPrograms.size() : 1;
+		for (unsigned int pass = 0; pass < passes; pass++) {
+			if (byVariant)
+				useVariant(pass);
+			VertexUniforms const &uniforms = byVariant ? variantUniforms[pass] : vertexUniforms;
+
+			// With shared buffers the VAO is bound once, then it's just draws.
+			unsigned int bound = 0;
+			for (unsigned int v = 0; v < visibleCount; v++) {
+				Mesh &mesh = meshes[visible[v]];
+				if (byVariant && meshVariant[visible[v]] != pass)
+					continue;
+				if (mesh.vao() != bound) {
+					bound = mesh.vao();
+					glBindVertexArray(bound);
+				}
+				if (vertexFormat == PACKED_VERTICES)
+					mesh.setDequantize(uniforms);
+				mesh.draw();
+			}
+		}
+	}
+
+	void drawIndirect() {
+		updateIndirectCommands();
+
+		glBindVertexArray(arenas[0].vao());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		unsigned int variant = (unsigned int)-1;
+		for (const IndirectBatch &batch : batches) {
+			if (!variantPrograms.empty() && meshVariant[batch.mesh] != variant) {
+				variant = meshVariant[batch.mesh];
+				useVariant(variant);
+			}
+			meshes[batch.mesh].bindTextures();
+			glMultiDrawElementsIndirect(GL_TRIANGLES, meshes[batch.mesh].getRange().indexType,
+				(void*)((size_t)batch.firstCommand * sizeof(DrawElementsCommand)), batch.commandCount, 0);
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// Flattens the node tree into the order meshes get drawn in.
+	void processNode(aiNode *node, const aiScene *scene, std::vector<aiMesh*> &found) {
+		for (int i = 0; i < node->mNumMeshes; i++)
+			found.push_back(scene->mMeshes[node->mMeshes[i]]);
 		
 		// Recursvely iterate children and process their meshes too.
 		for (int i = 0; i < node->mNumChildren; i++)
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, found);
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene) {
-		std::vector<Vertex> vertices;
+	// Only reads the scene, so it's safe to run for many meshes at once.
+	MeshData processMesh(aiMesh *mesh, const aiScene *scene) {
+		MeshData data;
+		std::vector<Vertex> &vertices = data.vertices;
+		vertices.reserve(mesh->mNumVertices);
 		// process all vertex properties
 		for (int i = 0; i < mesh->mNumVertices; i++) {
 			Vertex v;
@@ -49,7 +329,8 @@ class Model {
 		}
 
 		// Process indices
-		std::vector<unsigned int> indices;
+		std::vector<unsigned int> &indices = data.indices;
+		indices.reserve(mesh->mNumFaces * 3);
 		for (int i = 0; i < mesh->mNumFaces; i++) {
 			aiFace face = mesh->mFaces[i];
 
@@ -59,69 +340,491 @@ class Model {
 
 		// Now process materials
 		
-		std::vector<Texture> textures;
 		if (scene->HasMaterials()) {
 			// Each mesh links to one material
 			aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
 			
-			processTexture(aiTextureType_DIFFUSE, material, textures);
-			processTexture(aiTextureType_SPECULAR, material, textures);
-			processTexture(aiTextureType_HEIGHT, material, textures);
-			processTexture(aiTextureType_AMBIENT, material, textures);
+			processTexture(aiTextureType_DIFFUSE, material, data.textures);
+			processTexture(aiTextureType_SPECULAR, material, data.textures);
+			processTexture(aiTextureType_HEIGHT, material, data.textures);
+			processTexture(aiTextureType_AMBIENT, material, data.textures);
 		}
 
-		return Mesh(vertices, textures, indices);
+		return data;
 	}
 
-	void processTexture(aiTextureType type, aiMaterial *material, std::vector<Texture> &textures) {
+	void processTexture(aiTextureType type, aiMaterial *material, std::vector<TextureRef> &textures) {
 		for (int i = 0; i < material->GetTextureCount(type); i++) {
 
 			aiString path;
 			material->GetTexture(type, i, &path);
-			std::string fullPath = directory + "/" + path.C_Str();
 
-			// Check if texture already exists
-			if (loadedTextures.find(fullPath) != loadedTextures.end()) {
-				Texture found = loadedTextures.find(fullPath)->second;
-				textures.push_back(found);
-				continue;
-			}
-
-			unsigned int texID = TextureUtil::load(fullPath);
-
-			Texture texture;
-			texture.id = texID;
+			TextureRef ref;
+			ref.path = directory + "/" + path.C_Str();
 			if (type == aiTextureType_DIFFUSE)
-				texture.type = Texture::DIFFUSE;
+				ref.type = Texture::DIFFUSE;
 			else if (type == aiTextureType_SPECULAR)
-				texture.type = Texture::SPECULAR;
+				ref.type = Texture::SPECULAR;
 			else if (type == aiTextureType_HEIGHT)
-				texture.type = Texture::NORMAL;
+				ref.type = Texture::NORMAL;
 			else if (type == aiTextureType_AMBIENT)
-				texture.type = Texture::HEIGHT;
+				ref.type = Texture::HEIGHT;
+
+			textures.push_back(ref);
+		}
+	}
+
+	Texture loadTexture(TextureRef const &ref) {
+		// Check if texture already exists
+		if (loadedTextures.find(ref.path) != loadedTextures.end())
+			return loadedTextures.find(ref.path)->second;
+
+		Texture texture;
+		texture.id = textureLoader ? textureLoader->load(ref.path) : TextureUtil::load(ref.path);
+		texture.type = ref.type;
+
+		loadedTextures.insert({ ref.path, texture });
+		return texture;
+	}
+
+	// With shared buffers, one arena big enough for every mesh is made up front.
+	void createArenas(unsigned int totalVertices, size_t totalIndexBytes) {
+		if (!sharedBuffers)
+			return;
+		arenas.emplace_back();
+		arenas.back().create(totalVertices, totalIndexBytes, vertexFormat, narrowIndices);
+	}
+
+	// Index buffer space for a mesh and all its LODs.
+	size_t indexSpace(unsigned int vertexCount, std::vector<IndexList> const &levels) const {
+		size_t bytes = 0;
+		for (const IndexList &level : levels)
+			bytes += GeometryArena::indexSpace(vertexCount, level.count, narrowIndices);
+		return bytes;
+	}
 
-			textures.push_back(texture);
-			loadedTextures.insert({ fullPath, texture });
+	// levels[0] is the full mesh, any more are its LODs.
+	void addMesh(const Vertex *vertices, unsigned int vertexCount, std::vector<IndexList> const &levels, std::vector<Texture> &&textures) {
+		if (!sharedBuffers) {
+			arenas.emplace_back();
+			arenas.back().create(vertexCount, indexSpace(vertexCount, levels), vertexFormat, narrowIndices);
+		}
+		const unsigned int *indices = levels[0].indices;
+		unsigned int indexCount = levels[0].count;
+
+		// Packing is cheap next to the import, so the cache keeps floats and meshes are packed on the way to GL.
+		MeshRange range;
+		Dequantize dequantize;
+		if (vertexFormat == PACKED_VERTICES) {
+			std::vector<PackedVertex> packed;
+			dequantize = VertexPacking::pack(vertices, vertexCount, packed, &packingError);
+			range = arenas.back().add(packed.data(), vertexCount, indices, indexCount);
+		}
+		else
+			range = arenas.back().add(vertices, vertexCount, indices, indexCount);
+
+		Bounds bounds = Mesh::computeBounds(vertices, vertexCount);
+		boxes.add(bounds.centre, (bounds.max - bounds.min) * 0.5f);
+		meshes.emplace_back(std::move(textures), arenas.back().vao(), range, bounds, dequantize);
+		std::vector<std::string> defines = meshes.back().shaderDefines();
+		unsigned int variant = std::find(variants.begin(), variants.end(), defines) - variants.begin();
+		if (variant == variants.size())
+			variants.push_back(defines);
+		meshVariant.push_back(variant);
+		for (int l = 1; l < levels.size(); l++)
+			meshes.back().addLod(arenas.back().addIndices(range, levels[l].indices, levels[l].count), levels[l].error);
+		hasLods |= levels.size() > 1;
+	}
+
+	// Simplifies a mesh into lodLevels LODs, stopping early once it won't get any smaller.
+	static void generateLods(MeshData &data, unsigned int lodLevels, bool optimize, LinearArena *scratch = nullptr) {
+		if (lodLevels == 0 || data.indices.empty())
+			return;
+
+		ArenaScope scope(scratch);
+		MeshSimplifier::Simplifier simplifier(data.vertices, data.indices, scratch);
+		unsigned int previous = data.indices.size();
+		for (unsigned int l = 0; l < lodLevels; l++) {
+			std::vector<unsigned int> const &indices = simplifier.simplify(previous / 2 / 3 * 3);
+			if (indices.size() > previous * 3 / 4 || indices.empty())
+				break;
+
+			MeshLod lod;
+			lod.indices = optimize ? MeshOptimizer::optimizeVertexCache(indices, data.vertices.size(), scratch) : indices;
+			lod.error = simplifier.error();
+			data.lods.push_back(std::move(lod));
+			previous = indices.size();
 		}
 	}
+
+	// Builds every mesh straight out of the mapped cache, returns false if there's no usable cache.
+	bool loadFromCache(std::string const &cachePath, std::string const &sourcePath, uint32_t importFlags, unsigned int lodLevels) {
+		Timer timer;
+		MeshCache::MappedFile file;
+		if (!file.open(cachePath) || !MeshCache::validate(file, sourcePath, importFlags, lodLevels))
+			return false;
+		loadTimes.import = timer.elapsedMs();
+		timer.reset();
+
+		const MeshCache::Header *header = (const MeshCache::Header*)file.data();
+		const MeshCache::MeshRecord *records = (const MeshCache::MeshRecord*)(file.data() + sizeof(MeshCache::Header));
+
+		unsigned int totalVertices = 0;
+		size_t totalIndexBytes = 0;
+		for (int i = 0; i < header->meshCount; i++) {
+			totalVertices += records[i].vertexCount;
+			totalIndexBytes += GeometryArena::indexSpace(records[i].vertexCount, records[i].indexCount, narrowIndices);
+			const MeshCache::LodRecord *lods = (const MeshCache::LodRecord*)(file.data() + records[i].lodOffset);
+			for (int l = 0; l < records[i].lodCount; l++)
+				totalIndexBytes += GeometryArena::indexSpace(records[i].vertexCount, lods[l].indexCount, narrowIndices);
+		}
+		createArenas(totalVertices, totalIndexBytes);
+
+		// Reused by every mesh when the indices are compressed, one per level.
+		std::vector<std::vector<unsigned int>> decoded;
+
+		for (int i = 0; i < header->meshCount; i++) {
+			const MeshCache::MeshRecord &record = records[i];
+
+			std::vector<Texture> textures;
+			const unsigned char *cursor = file.data() + record.textureOffset;
+			for (int t = 0; t < record.textureCount; t++) {
+				const MeshCache::TextureRecord *texture = (const MeshCache::TextureRecord*)cursor;
+				TextureRef ref;
+				ref.path.assign((const char*)cursor + sizeof(MeshCache::TextureRecord), texture->pathLength);
+				ref.type = (Texture::Type)texture->type;
+				textures.push_back(loadTexture(ref));
+				cursor += sizeof(MeshCache::TextureRecord) + texture->pathLength;
+			}
+
+			std::vector<IndexList> levels;
+			levels.push_back({ (const unsigned int*)(file.data() + record.indexOffset), record.indexCount, 0.0f });
+			const MeshCache::LodRecord *lods = (const MeshCache::LodRecord*)(file.data() + record.lodOffset);
+			for (int l = 0; l < record.lodCount; l++)
+				levels.push_back({ (const unsigned int*)(file.data() + lods[l].indexOffset), lods[l].indexCount, lods[l].error });
+
+			if (importFlags & MeshCache::COMPRESSED_INDICES) {
+				Timer decodeTimer;
+				decoded.resize(std::max(decoded.size(), levels.size()));
+				for (int l = 0; l < levels.size(); l++) {
+					uint64_t bytes = l == 0 ? record.indexBytes : lods[l - 1].indexBytes;
+					decoded[l].resize(levels[l].count);
+					if (!IndexCodec::decode((const unsigned char*)levels[l].indices, bytes, decoded[l].data(), levels[l].count, record.vertexCount)) {
+						std::cout << "Corrupt indices for mesh " << i << " in '" << cachePath << "', level skipped" << std::endl;
+						levels[l].count = 0;
+					}
+					levels[l].indices = decoded[l].data();
+				}
+				loadTimes.decode += decodeTimer.elapsedMs();
+			}
+
+			addMesh((const Vertex*)(file.data() + record.vertexOffset), record.vertexCount, levels, std::move(textures));
+		}
+		loadTimes.upload = timer.elapsedMs();
+
+		return true;
+	}
 public:
-	Model(std::string const &path) {
+	Model(std::string const &path, ModelOptions options = ModelOptions()): textureLoader(options.textureLoader), jobs(options.jobs), sharedBuffers(options.sharedBuffers),
+		narrowIndices(options.narrowIndices), vertexFormat(options.vertexFormat), lodPixelError(options.lodPixelError) {
 		directory = path.substr(0, path.find_last_of('/'));
 
+		std::string cachePath = path + ".cache";
+		uint32_t importFlags = (options.optimizeMeshes ? MeshCache::OPTIMIZED : 0) | (options.compressIndices ? MeshCache::COMPRESSED_INDICES : 0);
+		if (options.useCache && loadFromCache(cachePath, path, importFlags, options.lodLevels))
+			return;
+
+		Timer timer;
 		Assimp::Importer importer;
-		const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate);
+		// OBJ gives every face corner a vertex of its own, joining the identical ones is what lets the optimizer reuse
+		// vertices and the simplifier collapse anything at all.
+		const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+		loadTimes.import = timer.elapsedMs();
 
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
 			std::cout << "Error loading Assimp scene: " << importer.GetErrorString() << std::endl;
 			return;
 		}
 
-		processNode(scene->mRootNode, scene);
+		// CPU side of every mesh is done in parallel, each one writes to its own slot so the order matches the node tree.
+		timer.reset();
+		std::vector<aiMesh*> found;
+		processNode(scene->mRootNode, scene, found);
+
+		std::vector<MeshData> imported(found.size());
+		std::vector<MeshOptimizer::Stats> before(found.size()), after(found.size());
+		std::unique_ptr<Jobs::Scheduler> importJobs;
+		if (!jobs)
+			importJobs.reset(new Jobs::Scheduler(options.threads));
+		Jobs::Scheduler &scheduler = jobs ? *jobs : *importJobs;
+
+		// Each job borrows an arena for its mesh and hands it back reset, so one only ever holds the biggest mesh's
+		// working memory. Borrowed per job rather than kept per thread: the scheduler may be shared, and threads that
+		// aren't its workers (this one, or another waiting on it) all look the same to it.
+		ArenaPool scratch;
+		ArenaPool *pool = options.importArenas ? &scratch : nullptr;
+
+		// A job per mesh, their sizes vary too much to batch them.
+		scheduler.forEach(found.size(), [&](unsigned int i) {
+			PooledArena arena(pool);
+			imported[i] = processMesh(found[i], scene);
+			if (options.optimizeMeshes)
+				MeshOptimizer::optimize(imported[i], before[i], after[i], arena.get());
+			generateLods(imported[i], options.lodLevels, options.optimizeMeshes, arena.get());
+		}, 1);
+		loadTimes.scratchPeak = scratch.peak();
+		loadTimes.process = timer.elapsedMs();
+
+		if (options.optimizeMeshes) {
+			double vertices = 0;
+			for (int i = 0; i < imported.size(); i++) {
+				unsigned int triangles = imported[i].indices.size() / 3, meshVertices = imported[i].vertices.size();
+				std::cout << "Mesh " << i << " (" << triangles << " triangles): ACMR " << before[i].acmr << " -> " << after[i].acmr
+					<< ", ATVR " << before[i].atvr << " -> " << after[i].atvr << std::endl;
+				optimizeStats.before.acmr += before[i].acmr * triangles;
+				optimizeStats.after.acmr += after[i].acmr * triangles;
+				optimizeStats.before.atvr += before[i].atvr * meshVertices;
+				optimizeStats.after.atvr += after[i].atvr * meshVertices;
+				optimizeStats.triangles += triangles;
+				vertices += meshVertices;
+			}
+			if (optimizeStats.triangles > 0) {
+				optimizeStats.before.acmr /= optimizeStats.triangles;
+				optimizeStats.after.acmr /= optimizeStats.triangles;
+				optimizeStats.before.atvr /= vertices;
+				optimizeStats.after.atvr /= vertices;
+			}
+		}
+
+		// GL work stays on this thread.
+		timer.reset();
+		unsigned int totalVertices = 0;
+		size_t totalIndexBytes = 0;
+		std::vector<std::vector<IndexList>> levels(imported.size());
+		for (int i = 0; i < imported.size(); i++) {
+			levels[i].push_back({ imported[i].indices.data(), (unsigned int)imported[i].indices.size(), 0.0f });
+			for (const MeshLod &lod : imported[i].lods)
+				levels[i].push_back({ lod.indices.data(), (unsigned int)lod.indices.size(), lod.error });
+
+			totalVertices += imported[i].vertices.size();
+			totalIndexBytes += indexSpace(imported[i].vertices.size(), levels[i]);
+		}
+		createArenas(totalVertices, totalIndexBytes);
+
+		for (int i = 0; i < imported.size(); i++) {
+			std::vector<Texture> textures;
+			for (const TextureRef &ref : imported[i].textures)
+				textures.push_back(loadTexture(ref));
+
+			addMesh(imported[i].vertices.data(), imported[i].vertices.size(), levels[i], std::move(textures));
+		}
+		loadTimes.upload = timer.elapsedMs();
+
+		if (options.useCache && !MeshCache::write(cachePath, path, imported, importFlags, options.lodLevels))
+			std::cout << "Couldn't write model cache '" << cachePath << "'" << std::endl;
+	}
+
+	ModelLoadTimes getLoadTimes() const {
+		return loadTimes;
+	}
+
+	ModelOptimizeStats getOptimizeStats() const {
+		return optimizeStats;
+	}
+
+	unsigned int meshCount() const {
+		return meshes.size();
+	}
+
+	VertexFormat getVertexFormat() const {
+		return vertexFormat;
+	}
+
+	// Only filled in for PACKED_VERTICES.
+	VertexPacking::Error const &getPackingError() const {
+		return packingError;
+	}
+
+	// GPU memory of the vertex and index buffers.
+	size_t vertexBytes() const {
+		size_t bytes = 0;
+		for (const GeometryArena &arena : arenas)
+			bytes += arena.vertexBytes();
+		return bytes;
+	}
+
+	size_t indexBytes() const {
+		size_t bytes = 0;
+		for (const GeometryArena &arena : arenas)
+			bytes += arena.indexBytes();
+		return bytes;
+	}
+
+	// Finds the vertex format uniforms of the program the model is drawn with. Only needed once after linking.
+	void bindUniforms(unsigned int program) {
+		vertexUniforms = Mesh::findVertexUniforms(program);
+	}
+
+	// Multi draw indirect needs GL 4.3 and shared buffers, otherwise this keeps PER_MESH and returns false.
+	// Packed meshes each have their own dequantize uniforms, which can't change inside a multi draw, so they're per mesh only.
+	bool setSubmission(Submission mode) {
+		if (mode == MULTI_DRAW_INDIRECT && (!GLAD_GL_VERSION_4_3 || !sharedBuffers || meshes.empty() || vertexFormat == PACKED_VERTICES))
+			return false;
+
+		if (mode == MULTI_DRAW_INDIRECT && batches.empty())
+			buildIndirectCommands();
+		submission = mode;
+		return true;
+	}
+
+	Submission getSubmission() const {
+		return submission;
+	}
+
+	// The #defines of each shader variant the meshes need, see Mesh::shaderDefines. Build a program for each
+	// (e.g. with Shaders::Variants) and hand them to setVariantPrograms in the same order.
+	std::vector<std::vector<std::string>> const &getShaderVariants() const {
+		return variants;
+	}
+
+	// Draws each mesh with the program of its variant instead of the bound one, switching as needed. The programs
+	// need their samplers set up by Mesh::bindSamplers. Call it again if they change (a reload), empty to stop.
+	// Returns false, changing nothing, unless there's a program for every variant.
+	bool setVariantPrograms(std::vector<unsigned int> const &programs) {
+		if (!programs.empty() && programs.size() != variants.size())
+			return false;
+
+		variantPrograms = programs;
+		variantUniforms.clear();
+		for (unsigned int program : programs)
+			variantUniforms.push_back(Mesh::findVertexUniforms(program));
+		return true;
+	}
+
+	// Expects the program to be bound, with its samplers set up by Mesh::bindSamplers and uniforms found by bindUniforms.
+	// With variant programs set it binds those itself and leaves the last one bound.
+	void draw() {
+		if (variantPrograms.empty())
+			setFormatUniforms(vertexUniforms);
+
+		if (frameArena) {
+			// Last frame's lists went with the reset.
+			visible = ArenaVector<unsigned int>(frameArena);
+			meshVisible = ArenaVector<unsigned char>(frameArena);
+			chunkVisible = ArenaVector<unsigned int>(frameArena);
+		}
+		visible.resize(boxes.cx.size());
+		if (culling && jobs && boxes.count >= 2 * CULL_CHUNK)
+			cullInJobs();
+		else if (culling)
+			visibleCount = Culling::cull(frustum, boxes, visible.data());
+		else {
+			visibleCount = meshes.size();
+			for (unsigned int i = 0; i < visibleCount; i++)
+				visible[i] = i;
+		}
+
+		if (lodView && hasLods)
+			selectLods();
+		drawnTriangles = 0;
+		for (unsigned int v = 0; v < visibleCount; v++)
+			drawnTriangles += meshes[visible[v]].getRange().indexCount / 3;
+
+		if (submission == MULTI_DRAW_INDIRECT)
+			drawIndirect();
+		else
+			drawPerMesh();
+
+		glBindVertexArray(0);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	/*
+	* Where the model is being looked at from, for picking LODs on the following draws. Call it whenever the camera
+	* or the model matrix changes, e.g. with Camera::position every frame. 'viewportHeight' is in pixels.
+	*/
+	void setLodView(glm::vec3 cameraPosition, glm::mat4 const &modelMatrix, glm::mat4 const &projection, float viewportHeight) {
+		lodView = true;
+		lodCamera = cameraPosition;
+		lodModelMatrix = modelMatrix;
+		lodPixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;  // projection[1][1] is 1 / tan(fovY / 2).
+	}
+
+	// Back to full detail everywhere.
+	void clearLodView() {
+		lodView = false;
+		for (Mesh &mesh : meshes)
+			mesh.selectLod(0.0f);
+	}
+
+	void setLodPixelError(float pixels) {
+		lodPixelError = pixels;
+	}
+
+	/*
+	* Takes the lists each draw works out (visible meshes and the like) from 'arena' instead of keeping its own.
+	* Reset the arena between frames, never during a draw. nullptr goes back to the model's own.
+	*/
+	void setFrameArena(LinearArena *arena) {
+		frameArena = arena;
+		visible = ArenaVector<unsigned int>(arena);
+		meshVisible = ArenaVector<unsigned char>(arena);
+		chunkVisible = ArenaVector<unsigned int>(arena);
+	}
+
+	/*
+	* Skips meshes outside the view on the following draws. Takes projection * view and the model matrix, and
+	* culls in model space so the mesh boxes never need transforming. Call it whenever either changes.
+	*/
+	void setFrustum(glm::mat4 const &viewProjection, glm::mat4 const &modelMatrix) {
+		culling = true;
+		frustum = Frustum::fromMatrix(viewProjection * modelMatrix);
 	}
 
-	void draw(unsigned int shaderProgram) {
-		for (int i = 0; i < meshes.size(); i++)
-			meshes[i].draw(shaderProgram);
+	void clearFrustum() {
+		culling = false;
+	}
+
+	// Triangles the last draw() submitted, after culling and LOD selection.
+	unsigned long long getDrawnTriangles() const {
+		return drawnTriangles;
+	}
+
+	// Meshes the last draw() submitted, after culling.
+	unsigned int getDrawnMeshes() const {
+		return visibleCount;
+	}
+
+	std::vector<Mesh> const &getMeshes() const {
+		return meshes;
+	}
+
+	void destroy() {
+		for (GeometryArena &arena : arenas)
+			arena.destroy();
+		for (auto &loaded : loadedTextures)
+			glDeleteTextures(1, &loaded.second.id);
+
+		if (indirectBuffer != 0)
+			glDeleteBuffers(1, &indirectBuffer);
+		indirectBuffer = 0;
+		batches.clear();
+		commands.clear();
+		hasLods = false;
+		lodView = false;
+		culling = false;
+		boxes.clear();
+		visible.clear();
+		visibleCount = 0;
+		submission = PER_MESH;
+		variants.clear();
+		meshVariant.clear();
+		variantPrograms.clear();
+		variantUniforms.clear();
+
+		meshes.clear();
+		arenas.clear();
+		loadedTextures.clear();
 	}
 };
 
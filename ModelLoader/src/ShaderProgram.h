@@ -1,12 +1,82 @@
 #ifndef SHADERPROGRAM_H
 #define SHADERPROGRAM_H
 #include <glad/glad.h>
+#include <cstdint>
 #include <string>
 #include <vector>
+#include <unordered_map>
 
 namespace Shaders {
 	unsigned int createShader(GLenum type, std::string path);
 	unsigned int createAndLinkProgram(std::vector<unsigned int> shaders);
+
+	struct ShaderFile {
+		GLenum type;
+		std::string path;
+		std::vector<std::string> defines;  // Injected after #version, see injectDefines.
+	};
+
+	// Builds a program from shader files, e.g. { { GL_VERTEX_SHADER, "shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "shaders/shader.frag" } }.
+	// The linked binary is cached next to the first file ('<path>.program') and later launches load that instead of
+	// compiling, until the sources or the driver change. 'cached' says which happened. Returns -1 on failure.
+	unsigned int loadProgram(std::vector<ShaderFile> const &files, bool *cached = nullptr);
+
+	// Several programs at once. Every compile and link is issued before any status is queried, so the driver gets to
+	// work through the whole batch together, on its own threads with GL_KHR_parallel_shader_compile. Cache hits skip all
+	// of that. Returns a program (or -1) per entry, in order.
+	std::vector<unsigned int> loadPrograms(std::vector<std::vector<ShaderFile>> const &programs, std::vector<bool> *cached = nullptr);
+
+	// Whether the driver compiles on threads of its own (KHR or ARB_parallel_shader_compile), turned on by the first call.
+	bool parallelCompile();
+
+	// 'source' with a '#define' per entry right after its #version line. Entries are "NAME" or "NAME=VALUE".
+	std::string injectDefines(std::string const &source, std::vector<std::string> const &defines);
+
+	// Copies of 'files' with 'defines' on each, sorted and without repeats so a set always makes the same variant.
+	std::vector<ShaderFile> withDefines(std::vector<ShaderFile> files, std::vector<std::string> defines);
+
+	// Define sets from a manifest: a variant per line with its defines separated by spaces, '-' for none, '#' comments.
+	bool readManifest(std::string const &path, std::vector<std::vector<std::string>> &variants);
+
+	// Permutations of one program, each the same files built with a different set of #defines. Variants are keyed by
+	// a hash of their sorted defines, so a set given in another order gets the same program. They're built on first
+	// use, or ahead of time in one batch with prepare().
+	class Variants {
+		std::vector<ShaderFile> files;
+		std::unordered_map<uint64_t, unsigned int> programs;
+	public:
+		Variants() = default;
+		explicit Variants(std::vector<ShaderFile> const &files);
+
+		// The program for these defines, built now if it wasn't yet. -1 if it doesn't build.
+		unsigned int get(std::vector<std::string> const &defines);
+
+		// Builds every set that isn't built yet, as one batch.
+		void prepare(std::vector<std::vector<std::string>> const &sets);
+		// The same with the sets from a manifest, false if it can't be read.
+		bool prepare(std::string const &manifestPath);
+
+		// Distinct variants built so far.
+		size_t size() const;
+		void destroy();
+	};
+
+	// Reads a whole shader file, false (with a message) if it can't.
+	bool readSource(std::string const &path, std::string &source);
+
+	// Prints why 'program' didn't link: the compile log of whichever of 'shaders' failed, or else the link log.
+	void reportErrors(std::vector<ShaderFile> const &files, std::vector<unsigned int> const &shaders, unsigned int program);
+
+	// Every active uniform location of a linked program, queried once so draws never call glGetUniformLocation.
+	class Uniforms {
+		std::unordered_map<std::string, int> locations;
+	public:
+		Uniforms() = default;
+		explicit Uniforms(unsigned int program);
+
+		// -1 if the program has no such uniform, which glUniform* quietly ignores.
+		int operator[](std::string const &name) const;
+	};
 }
 
 #endif
\ No newline at end of file
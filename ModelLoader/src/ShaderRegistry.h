@@ -0,0 +1,368 @@
+#ifndef SHADERREGISTRY_H
+#define SHADERREGISTRY_H
+#include <glad/glad.h>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "ShaderProgram.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// From GL_KHR_parallel_shader_compile, which our glad doesn't have.
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+/*
+* Tells which of a set of files were written since it was last asked. On Linux that's inotify on their directories,
+* which catches editors that save by writing a new file and renaming it over the old one. Elsewhere it compares
+* sizes and modified times every POLL_INTERVAL calls.
+*/
+class FileWatcher {
+	struct File {
+		std::string path;
+		uint64_t size;
+		int64_t time;
+	};
+	std::vector<File> files;
+#ifdef __linux__
+	int fd = -1;
+	std::vector<std::pair<int, std::string>> directories;  // Watch descriptor and the directory it's on.
+#else
+	unsigned int calls = 0;
+#endif
+
+	static void stamp(std::string const &path, uint64_t &size, int64_t &time) {
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0) {
+			size = 0;
+			time = 0;
+			return;
+		}
+		size = (uint64_t)info.st_size;
+		time = (int64_t)info.st_mtime;
+	}
+
+	static std::string directoryOf(std::string const &path) {
+		size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? "." : path.substr(0, slash);
+	}
+
+public:
+	static const unsigned int POLL_INTERVAL = 15;
+
+	FileWatcher() = default;
+	FileWatcher(const FileWatcher &) = delete;
+	FileWatcher &operator=(const FileWatcher &) = delete;
+
+	~FileWatcher() {
+		destroy();
+	}
+
+	bool watch(std::string const &path) {
+		for (File const &file : files)
+			if (file.path == path)
+				return true;
+
+		File file = { path, 0, 0 };
+		stamp(path, file.size, file.time);
+		files.push_back(file);
+
+#ifdef __linux__
+		if (fd < 0)
+			fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd < 0)
+			return false;
+
+		std::string directory = directoryOf(path);
+		for (auto const &watched : directories)
+			if (watched.second == directory)
+				return true;
+
+		int descriptor = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (descriptor < 0)
+			return false;
+		directories.push_back({ descriptor, directory });
+#endif
+		return true;
+	}
+
+	// Watched files that changed since the last call, each at most once.
+	std::vector<std::string> changes() {
+		std::vector<std::string> changed;
+		auto add = [&](std::string const &path) {
+			for (std::string const &seen : changed)
+				if (seen == path)
+					return;
+			changed.push_back(path);
+		};
+
+#ifdef __linux__
+		if (fd < 0)
+			return changed;
+
+		alignas(inotify_event) char buffer[4096];
+		ssize_t length;
+		while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+			for (char *at = buffer; at < buffer + length; at += sizeof(inotify_event) + ((inotify_event*)at)->len) {
+				inotify_event *event = (inotify_event*)at;
+				if (event->len == 0)
+					continue;
+
+				for (auto const &watched : directories) {
+					if (watched.first != event->wd)
+						continue;
+					std::string path = watched.second + "/" + event->name;
+					for (File const &file : files)
+						if (file.path == path)
+							add(path);
+				}
+			}
+		}
+#else
+		if (++calls % POLL_INTERVAL != 0)
+			return changed;
+
+		for (File &file : files) {
+			uint64_t size;
+			int64_t time;
+			stamp(file.path, size, time);
+			if (size != file.size || time != file.time) {
+				file.size = size;
+				file.time = time;
+				add(file.path);
+			}
+		}
+#endif
+		return changed;
+	}
+
+	void destroy() {
+#ifdef __linux__
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+		directories.clear();
+#endif
+		files.clear();
+	}
+};
+
+/*
+* Programs that rebuild themselves when their shader files change on disk.
+* A rebuild is spread over frames so no frame pays for all of it: one compile per update(), then the link, then
+* waiting until the driver says it's done (GL_KHR_parallel_shader_compile) before asking for the link status.
+* Only a program that linked replaces the old one, a broken edit leaves the last good program in use.
+*/
+class ShaderRegistry {
+	enum State {
+		IDLE,
+		SETTLING,   // Changed, waiting a few frames in case the editor is still writing.
+		COMPILING,  // One stage compiled per update.
+		LINKING,
+		WAITING     // Linked, waiting for the result.
+	};
+
+	struct Entry {
+		std::vector<Shaders::ShaderFile> files;
+		unsigned int program = 0;
+		State state = IDLE;
+		unsigned int settleFrames = 0;
+		std::vector<std::string> sources;
+		std::vector<unsigned int> shaders;
+		unsigned int pending = 0;  // The program being built.
+	};
+
+	std::vector<Entry> entries;
+	FileWatcher watcher;
+	unsigned int reloads = 0;
+
+	static void abandon(Entry &entry) {
+		for (unsigned int shader : entry.shaders)
+			glDeleteShader(shader);
+		entry.shaders.clear();
+		if (entry.pending != 0)
+			glDeleteProgram(entry.pending);
+		entry.pending = 0;
+		entry.state = IDLE;
+	}
+
+	// Moves a rebuild along. Returns true if it did GL work worth a frame: a compile or a link.
+	bool step(Entry &entry, bool &swapped) {
+		switch (entry.state) {
+		case IDLE:
+			return false;
+
+		case SETTLING:
+			if (--entry.settleFrames > 0)
+				return false;
+			entry.sources.assign(entry.files.size(), std::string());
+			for (size_t i = 0; i < entry.files.size(); i++) {
+				if (!Shaders::readSource(entry.files[i].path, entry.sources[i])) {
+					entry.state = IDLE;
+					return false;
+				}
+				entry.sources[i] = Shaders::injectDefines(entry.sources[i], entry.files[i].defines);
+			}
+			entry.state = COMPILING;
+			return false;
+
+		case COMPILING: {
+			size_t stage = entry.shaders.size();
+			const char *source = entry.sources[stage].c_str();
+			unsigned int shader = glCreateShader(entry.files[stage].type);
+			glShaderSource(shader, 1, &source, NULL);
+			glCompileShader(shader);
+			entry.shaders.push_back(shader);
+			if (entry.shaders.size() == entry.files.size())
+				entry.state = LINKING;
+			return true;
+		}
+
+		case LINKING:
+			entry.pending = glCreateProgram();
+			for (unsigned int shader : entry.shaders)
+				glAttachShader(entry.pending, shader);
+			glLinkProgram(entry.pending);
+			entry.state = WAITING;
+			return true;
+
+		case WAITING: {
+			// Without the extension there's no asking, the link has had a frame and the status query waits for the rest.
+			if (Shaders::parallelCompile()) {
+				int done = GL_FALSE;
+				glGetProgramiv(entry.pending, GL_COMPLETION_STATUS_KHR, &done);
+				if (!done)
+					return false;
+			}
+
+			int success;
+			glGetProgramiv(entry.pending, GL_LINK_STATUS, &success);
+			if (success) {
+				std::cout << "Reloaded";
+				for (Shaders::ShaderFile const &file : entry.files)
+					std::cout << " " << file.path;
+				std::cout << std::endl;
+				glDeleteProgram(entry.program);
+				entry.program = entry.pending;
+				entry.pending = 0;
+				swapped = true;
+				reloads++;
+			}
+			else
+				Shaders::reportErrors(entry.files, entry.shaders, entry.pending);
+			abandon(entry);
+			return false;
+		}
+		}
+		return false;
+	}
+
+public:
+	static const unsigned int SETTLE_FRAMES = 2;
+
+	// Builds the programs as one Shaders::loadPrograms batch and starts watching their files. Returns an id per
+	// program for program(), -1 for any that didn't build. A program that's already here (same files and defines,
+	// e.g. a shader variant asked for twice) isn't built again and gets the id it already has.
+	std::vector<int> addAll(std::vector<std::vector<Shaders::ShaderFile>> const &programs) {
+		std::vector<int> ids(programs.size(), -1);
+		std::vector<std::vector<Shaders::ShaderFile>> missing;
+		std::vector<size_t> missingIndex;
+		for (size_t p = 0; p < programs.size(); p++) {
+			ids[p] = find(programs[p]);
+			if (ids[p] < 0) {
+				missing.push_back(programs[p]);
+				missingIndex.push_back(p);
+			}
+		}
+
+		std::vector<unsigned int> built = Shaders::loadPrograms(missing);
+		for (size_t m = 0; m < missing.size(); m++) {
+			// The same program twice in one call only gets built the once.
+			int existing = find(missing[m]);
+			if (existing >= 0 || built[m] == (unsigned int)-1) {
+				if (built[m] != (unsigned int)-1)
+					glDeleteProgram(built[m]);
+				ids[missingIndex[m]] = existing;
+				continue;
+			}
+
+			Entry entry;
+			entry.files = missing[m];
+			entry.program = built[m];
+			entries.push_back(entry);
+			for (Shaders::ShaderFile const &file : missing[m])
+				watcher.watch(file.path);
+			ids[missingIndex[m]] = (int)entries.size() - 1;
+		}
+		return ids;
+	}
+
+	int add(std::vector<Shaders::ShaderFile> const &files) {
+		return addAll({ files })[0];
+	}
+
+	// Id of a program built from exactly these files and defines, -1 if there's none.
+	int find(std::vector<Shaders::ShaderFile> const &files) const {
+		for (size_t id = 0; id < entries.size(); id++) {
+			std::vector<Shaders::ShaderFile> const &other = entries[id].files;
+			bool same = other.size() == files.size();
+			for (size_t i = 0; i < files.size() && same; i++)
+				same = other[i].type == files[i].type && other[i].path == files[i].path && other[i].defines == files[i].defines;
+			if (same)
+				return (int)id;
+		}
+		return -1;
+	}
+
+	// The current program, which changes when a reload swaps in a new one.
+	unsigned int program(int id) const {
+		return entries[id].program;
+	}
+
+	// Once a frame. Picks up changed files and moves rebuilds along, at most one compile or link per call.
+	// Returns true when a program was swapped, anything cached from the old one (uniform locations) has to be redone.
+	bool update() {
+		for (std::string const &path : watcher.changes()) {
+			for (Entry &entry : entries) {
+				for (Shaders::ShaderFile const &file : entry.files) {
+					if (file.path != path)
+						continue;
+					// Start over if it was mid rebuild, that one's out of date already.
+					abandon(entry);
+					entry.state = SETTLING;
+					entry.settleFrames = SETTLE_FRAMES;
+				}
+			}
+		}
+
+		bool swapped = false, worked = false;
+		for (Entry &entry : entries) {
+			if (worked && (entry.state == COMPILING || entry.state == LINKING))
+				continue;
+			worked = step(entry, swapped) || worked;
+		}
+		return swapped;
+	}
+
+	// Programs swapped in since the start.
+	unsigned int reloadCount() const {
+		return reloads;
+	}
+
+	void destroy() {
+		for (Entry &entry : entries) {
+			abandon(entry);
+			glDeleteProgram(entry.program);
+		}
+		entries.clear();
+		watcher.destroy();
+	}
+};
+
+#endif
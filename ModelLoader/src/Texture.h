@@ -2,10 +2,28 @@
 #define TEXTURE_H
 #include <glad/glad.h>
 #include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <cstring>
+#include <iostream>
+#include "Jobs.h"
+#include "Timer.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 namespace TextureUtil {
+    // Used as the internal format too, so the texture has exactly the channels the image does.
+    GLenum formatFor(int channels) {
+        if (channels == 1)
+            return GL_RED;
+        else if (channels == 2)
+            return GL_RG;
+        else if (channels == 3)
+            return GL_RGB;
+        return GL_RGBA;
+    }
+
     unsigned int load(std::string path, bool flipUv = false) {
         unsigned int texture;
         glGenTextures(1, &texture);
@@ -20,14 +38,7 @@ namespace TextureUtil {
         stbi_set_flip_vertically_on_load(false);
 
         if (data) {
-            GLenum format;
-            if (channels == 1)
-                format = GL_RED;
-            else if (channels == 3)
-                format = GL_RGB;
-            else if (channels == 4)
-                format = GL_RGBA;
-
+            GLenum format = formatFor(channels);
             glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         }
         else {
@@ -38,6 +49,149 @@ namespace TextureUtil {
         glBindTexture(GL_TEXTURE_2D, 0);
         return texture;
     }
+
+    /*
+    * Decodes textures as background jobs on a scheduler so big images don't stall the render thread, not even when
+    * it's helping out in the scheduler's wait() (culling), since that never picks up background jobs.
+    * load() hands back a texture straight away holding a 1x1 grey placeholder, update() (GL thread, once a frame)
+    * then uploads finished decodes through a pixel unpack buffer until the frame's byte budget runs out.
+    */
+    class AsyncLoader {
+        struct Decoded {
+            unsigned int texture;
+            std::string path;
+            unsigned char *data;
+            int width, height, channels;
+            double decodeMs;
+        };
+
+        Jobs::Scheduler &jobs;
+        Jobs::Counter decodes;
+        std::deque<Decoded> decoded;
+        unsigned int inFlight = 0;  // Requested but not uploaded yet.
+        std::mutex mutex;
+
+        unsigned int pbo = 0;  // Only exists while there's something to upload.
+        bool verbose;
+
+        void decode(unsigned int texture, std::string const &path, bool flipUv) {
+            Timer timer;
+            Decoded result;
+            result.texture = texture;
+            result.path = path;
+            stbi_set_flip_vertically_on_load_thread(flipUv);
+            result.data = stbi_load(path.c_str(), &result.width, &result.height, &result.channels, 0);
+            result.decodeMs = timer.elapsedMs();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            decoded.push_back(result);
+        }
+
+        static size_t bytes(Decoded const &image) {
+            return image.data ? (size_t)image.width * image.height * image.channels : 0;
+        }
+
+        // Copies the pixels into the PBO and specifies the texture from it, so the driver can DMA in the background.
+        void upload(Decoded const &image) {
+            size_t size = bytes(image);
+            GLenum format = formatFor(image.channels);
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);  // Orphan so we never wait on the last upload.
+            void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (mapped) {
+                memcpy(mapped, image.data, size);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+                glBindTexture(GL_TEXTURE_2D, image.texture);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // Rows of RGB/RED images aren't always 4 byte aligned.
+                glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, (void*)0);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+    public:
+        // 'jobs' has to outlive the loader.
+        AsyncLoader(Jobs::Scheduler &jobs, bool verbose = true): jobs(jobs), verbose(verbose) {}
+
+        AsyncLoader(const AsyncLoader &) = delete;
+        AsyncLoader &operator=(const AsyncLoader &) = delete;
+
+        // Decodes still going have to finish first, they write into this.
+        ~AsyncLoader() {
+            jobs.wait(decodes);
+            for (Decoded &image : decoded)
+                stbi_image_free(image.data);
+        }
+
+        // Returns a usable texture right away, it shows the placeholder until update() uploads the real image.
+        unsigned int load(std::string path, bool flipUv = false) {
+            unsigned int texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+            const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                inFlight++;
+            }
+            jobs.runBackground([this, texture, path, flipUv]() { decode(texture, path, flipUv); }, decodes);
+            return texture;
+        }
+
+        // Call once a frame on the GL thread. At least one finished texture is uploaded per call, so big ones still get through.
+        void update(size_t byteBudget) {
+            size_t uploaded = 0;
+            while (true) {
+                Decoded image;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (inFlight == 0 && pbo != 0) {
+                        glDeleteBuffers(1, &pbo);
+                        pbo = 0;
+                    }
+                    if (decoded.empty())
+                        return;
+
+                    if (uploaded > 0 && uploaded + bytes(decoded.front()) > byteBudget)
+                        return;
+
+                    image = decoded.front();
+                    decoded.pop_front();
+                    inFlight--;
+                }
+
+                if (!image.data) {
+                    std::cout << "Couldn't load texture '" << image.path << "'" << std::endl;
+                    continue;
+                }
+
+                Timer timer;
+                if (pbo == 0)
+                    glGenBuffers(1, &pbo);
+                upload(image);
+                uploaded += bytes(image);
+                stbi_image_free(image.data);
+
+                if (verbose)
+                    std::cout << "Texture '" << image.path << "' (" << image.width << "x" << image.height << ") decoded in "
+                        << image.decodeMs << " ms, uploaded in " << timer.elapsedMs() << " ms" << std::endl;
+            }
+        }
+
+        // True once every requested texture has been uploaded.
+        bool idle() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return inFlight == 0;
+        }
+    };
 }
 
 #endif
\ No newline at end of file
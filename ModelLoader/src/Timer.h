@@ -0,0 +1,20 @@
+#ifndef TIMER_H
+#define TIMER_H
+#include <chrono>
+
+// Wall clock stopwatch, for timing loads and benchmarks.
+class Timer {
+	std::chrono::high_resolution_clock::time_point start;
+public:
+	Timer() { reset(); }
+
+	void reset() {
+		start = std::chrono::high_resolution_clock::now();
+	}
+
+	double elapsedMs() const {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef VERTEXPACKING_H
+#define VERTEXPACKING_H
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include "Mesh.h"
+
+/*
+* Converts float vertices into PackedVertex and back:
+*  - Positions are 16 bit unorm across the mesh's bounding box, the box comes back as a Dequantize for the shader.
+*  - Normals are octahedral encoded (the unit sphere folded onto a square) into two 16 bit snorms.
+*  - UVs are half floats.
+* The unpack side mirrors what the GL and model.vert do, so the error report is what actually ends up on screen.
+*/
+namespace VertexPacking {
+	int16_t toSnorm16(float value) {
+		return (int16_t)std::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+	}
+
+	float fromSnorm16(int16_t value) {
+		return std::max(value / 32767.0f, -1.0f);
+	}
+
+	glm::vec2 octEncode(glm::vec3 n) {
+		n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		glm::vec2 folded(n.x, n.y);
+		// The lower half folds over the diagonals onto the corners of the square.
+		if (n.z < 0.0f) {
+			folded.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+			folded.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		return folded;
+	}
+
+	// Same as octDecode in model.vert.
+	glm::vec3 octDecode(glm::vec2 e) {
+		glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+		float t = std::max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -t : t;
+		n.y += n.y >= 0.0f ? -t : t;
+		return glm::normalize(n);
+	}
+
+	Dequantize bounds(const Vertex *vertices, unsigned int count) {
+		Dequantize dequantize;
+		if (count == 0)
+			return dequantize;
+
+		glm::vec3 low = vertices[0].position, high = vertices[0].position;
+		for (unsigned int i = 1; i < count; i++) {
+			low = glm::min(low, vertices[i].position);
+			high = glm::max(high, vertices[i].position);
+		}
+		dequantize.offset = low;
+		dequantize.scale = high - low;
+		return dequantize;
+	}
+
+	PackedVertex pack(Vertex const &vertex, Dequantize const &dequantize) {
+		PackedVertex packed;
+		for (int i = 0; i < 3; i++) {
+			// A flat axis has a scale of 0, every vertex sits on the offset.
+			float t = dequantize.scale[i] > 0.0f ? (vertex.position[i] - dequantize.offset[i]) / dequantize.scale[i] : 0.0f;
+			packed.position[i] = (uint16_t)std::round(glm::clamp(t, 0.0f, 1.0f) * 65535.0f);
+		}
+
+		// Meshes without normals have zeros, which would divide by zero in the encode.
+		glm::vec2 normal = glm::length(vertex.normal) > 0.0f ? octEncode(vertex.normal) : glm::vec2(0.0f, 0.0f);
+		packed.normal[0] = toSnorm16(normal.x);
+		packed.normal[1] = toSnorm16(normal.y);
+
+		packed.uv[0] = glm::packHalf1x16(vertex.uv.x);
+		packed.uv[1] = glm::packHalf1x16(vertex.uv.y);
+		return packed;
+	}
+
+	Vertex unpack(PackedVertex const &packed, Dequantize const &dequantize) {
+		Vertex vertex;
+		for (int i = 0; i < 3; i++)
+			vertex.position[i] = dequantize.offset[i] + packed.position[i] / 65535.0f * dequantize.scale[i];
+		vertex.normal = octDecode(glm::vec2(fromSnorm16(packed.normal[0]), fromSnorm16(packed.normal[1])));
+		vertex.uv = glm::vec2(glm::unpackHalf1x16(packed.uv[0]), glm::unpackHalf1x16(packed.uv[1]));
+		return vertex;
+	}
+
+	// Worst and average difference between the float vertices and what the packed ones decode to.
+	struct Error {
+		unsigned long long vertices = 0;
+		double maxPosition = 0, sumPosition = 0;  // Model space units.
+		double maxNormal = 0, sumNormal = 0;      // Degrees.
+		double maxUv = 0, sumUv = 0;
+
+		void add(Vertex const &original, Vertex const &decoded) {
+			double position = glm::length(original.position - decoded.position);
+			double uv = glm::length(original.uv - decoded.uv);
+			double normal = 0;
+			if (glm::length(original.normal) > 0.0f) {
+				float cosine = glm::clamp(glm::dot(glm::normalize(original.normal), decoded.normal), -1.0f, 1.0f);
+				normal = std::acos(cosine) * 180.0 / 3.14159265358979;
+			}
+
+			maxPosition = std::max(maxPosition, position);
+			maxNormal = std::max(maxNormal, normal);
+			maxUv = std::max(maxUv, uv);
+			sumPosition += position;
+			sumNormal += normal;
+			sumUv += uv;
+			vertices++;
+		}
+
+		void print() const {
+			double count = (double)std::max(vertices, 1ull);
+			std::cout << "Packed vertex error over " << vertices << " vertices (max / mean)" << std::endl;
+			std::cout << "  position: " << maxPosition << " / " << sumPosition / count << std::endl;
+			std::cout << "  normal:   " << maxNormal << " / " << sumNormal / count << " degrees" << std::endl;
+			std::cout << "  uv:       " << maxUv << " / " << sumUv / count << std::endl;
+		}
+	};
+
+	// Packs a whole mesh against its own bounds. Pass an Error to measure what was lost.
+	Dequantize pack(const Vertex *vertices, unsigned int count, std::vector<PackedVertex> &packed, Error *error = nullptr) {
+		Dequantize dequantize = bounds(vertices, count);
+		packed.resize(count);
+		for (unsigned int i = 0; i < count; i++) {
+			packed[i] = pack(vertices[i], dequantize);
+			if (error)
+				error->add(vertices[i], unpack(packed[i], dequantize));
+		}
+		return dequantize;
+	}
+}
+
+#endif
@@ -1,8 +1,16 @@
 #version 330 core
 
 layout (location = 0) in vec3 inPos;
-uniform mat4 mvp;
 
+// PLAIN_UNIFORMS is only for the benchmark, to compare against setting mvp on each draw.
+#ifdef PLAIN_UNIFORMS
+uniform mat4 mvp;
+#else
+layout (std140) uniform Object {  // See UniformBlocks.h
+	mat4 mvp;
+	mat4 model;
+};
+#endif
 
 void main() {
 	gl_Position = mvp * vec4(inPos, 1.0);
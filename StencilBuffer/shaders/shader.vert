@@ -3,7 +3,15 @@
 layout (location = 0) in vec3 inPos;
 layout (location = 1) in vec2 inUv;
 
+// PLAIN_UNIFORMS is only for the benchmark, to compare against setting mvp on each draw.
+#ifdef PLAIN_UNIFORMS
 uniform mat4 mvp;
+#else
+layout (std140) uniform Object {  // See UniformBlocks.h
+	mat4 mvp;
+	mat4 model;
+};
+#endif
 
 out vec2 uv;
 
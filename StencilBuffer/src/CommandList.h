@@ -0,0 +1,133 @@
+#ifndef COMMANDLIST_H
+#define COMMANDLIST_H
+#include <glad/glad.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <glm/glm.hpp>
+#include "GLState.h"
+
+/*
+* GL work written down instead of done, so any thread can record it and the GL thread replays it later. Commands go
+* into a flat array of 32 bit words, an opcode then its arguments, and uniform values into a blob of floats next to
+* it. Recording touches no GL at all, so lists for disjoint parts of a scene can be recorded in parallel and then
+* replayed one after the other on the thread that owns the context.
+* Nothing is freed by reset(), a list reused every frame stops allocating once it's seen its biggest frame.
+*/
+class CommandList {
+	enum Opcode : uint32_t {
+		USE_PROGRAM,         // program
+		BIND_VERTEX_ARRAY,   // vao
+		BIND_TEXTURE,        // unit, texture (2D)
+		UNIFORM_MATRIX4,     // location, offset into the blob
+		UNIFORM_VEC3,        // location, offset into the blob
+		DRAW_ARRAYS          // mode, first, count
+	};
+
+	std::vector<uint32_t> commands;
+	std::vector<float> blob;
+	unsigned int draws = 0;
+
+	// What was last recorded, so repeats within a list are dropped while recording. Replay drops the ones between
+	// lists through its GLState.
+	static const unsigned int NONE = 0xFFFFFFFF;
+	unsigned int program = NONE, vao = NONE, texture = NONE;
+
+	uint32_t store(const float *values, size_t count) {
+		size_t offset = blob.size();
+		blob.resize(offset + count);
+		std::memcpy(&blob[offset], values, count * sizeof(float));
+		return (uint32_t)offset;
+	}
+
+public:
+	void reset() {
+		commands.clear();
+		blob.clear();
+		draws = 0;
+		program = vao = texture = NONE;
+	}
+
+	void useProgram(unsigned int id) {
+		if (id == program)
+			return;
+		program = id;
+		commands.insert(commands.end(), { USE_PROGRAM, id });
+	}
+
+	void bindVertexArray(unsigned int id) {
+		if (id == vao)
+			return;
+		vao = id;
+		commands.insert(commands.end(), { BIND_VERTEX_ARRAY, id });
+	}
+
+	// Only unit 0 is remembered for dropping repeats, binds to other units are always recorded.
+	void bindTexture(unsigned int unit, unsigned int id) {
+		if (unit == 0) {
+			if (id == texture)
+				return;
+			texture = id;
+		}
+		commands.insert(commands.end(), { BIND_TEXTURE, unit, id });
+	}
+
+	void uniformMatrix4(int location, glm::mat4 const &value) {
+		commands.insert(commands.end(), { UNIFORM_MATRIX4, (uint32_t)location, store(&value[0][0], 16) });
+	}
+
+	void uniform3(int location, glm::vec3 const &value) {
+		commands.insert(commands.end(), { UNIFORM_VEC3, (uint32_t)location, store(&value[0], 3) });
+	}
+
+	void drawArrays(GLenum mode, int first, int count) {
+		commands.insert(commands.end(), { DRAW_ARRAYS, mode, (uint32_t)first, (uint32_t)count });
+		draws++;
+	}
+
+	unsigned int drawCount() const {
+		return draws;
+	}
+
+	// Bytes recorded, commands and uniform values.
+	size_t size() const {
+		return commands.size() * sizeof(uint32_t) + blob.size() * sizeof(float);
+	}
+
+	// On the GL thread. Binds go through 'state', which drops the ones the list before already made.
+	void replay(GLState &state) const {
+		const uint32_t *at = commands.data(), *end = at + commands.size();
+		while (at < end) {
+			switch (at[0]) {
+			case USE_PROGRAM:
+				state.useProgram(at[1]);
+				at += 2;
+				break;
+			case BIND_VERTEX_ARRAY:
+				state.bindVertexArray(at[1]);
+				at += 2;
+				break;
+			case BIND_TEXTURE:
+				state.bindTexture(at[1], at[2]);
+				at += 3;
+				break;
+			case UNIFORM_MATRIX4:
+				glUniformMatrix4fv((int)at[1], 1, GL_FALSE, &blob[at[2]]);
+				at += 3;
+				break;
+			case UNIFORM_VEC3:
+				glUniform3fv((int)at[1], 1, &blob[at[2]]);
+				at += 3;
+				break;
+			case DRAW_ARRAYS:
+				glDrawArrays(at[1], (int)at[2], (int)at[3]);
+				at += 4;
+				break;
+			default:
+				return;  // Can't happen unless the list is corrupt, don't read past what we understand.
+			}
+		}
+	}
+};
+
+#endif
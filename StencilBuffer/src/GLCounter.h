@@ -0,0 +1,121 @@
+#ifndef GLCOUNTER_H
+#define GLCOUNTER_H
+#include <glad/glad.h>
+#include <iostream>
+
+/*
+* Counts GL calls by swapping glad's function pointers for wrappers that bump a counter and forward the call.
+* install() has to run after gladLoadGLLoader. Only the functions hooked in install() are counted.
+*/
+namespace GLCounter {
+	enum Call {
+		USE_PROGRAM,
+		BIND_VERTEX_ARRAY,
+		BIND_BUFFER,
+		BUFFER_DATA,
+		ACTIVE_TEXTURE,
+		BIND_TEXTURE,
+		GET_UNIFORM_LOCATION,
+		UNIFORM,
+		STATE,
+		DRAW,
+		CALL_COUNT
+	};
+
+	const char *callNames[CALL_COUNT] = {
+		"glUseProgram",
+		"glBindVertexArray",
+		"glBindBuffer*",
+		"glBuffer*Data",
+		"glActiveTexture",
+		"glBindTexture",
+		"glGetUniformLocation",
+		"glUniform*",
+		"glEnable/glDisable/glDepth*/glStencil*",
+		"glDraw*"
+	};
+
+	unsigned long long counts[CALL_COUNT] = {};
+	bool installed = false;
+
+	// One instantiation per hooked function (Slot), even when two functions share a signature.
+	template <int Slot, Call call, typename Ret, typename... Args>
+	struct Wrapper {
+		static Ret (APIENTRYP original)(Args...);
+
+		static Ret APIENTRY counted(Args... args) {
+			counts[call]++;
+			return original(args...);
+		}
+	};
+
+	template <int Slot, Call call, typename Ret, typename... Args>
+	Ret (APIENTRYP Wrapper<Slot, call, Ret, Args...>::original)(Args...) = nullptr;
+
+	template <int Slot, Call call, typename Ret, typename... Args>
+	void hook(Ret (APIENTRYP &function)(Args...)) {
+		if (!function)
+			return;  // Not supported by this context, nothing to count.
+		Wrapper<Slot, call, Ret, Args...>::original = function;
+		function = &Wrapper<Slot, call, Ret, Args...>::counted;
+	}
+
+#define GLCOUNTER_HOOK(function, call) hook<__LINE__, call>(glad_##function)
+
+	void install() {
+		if (installed)
+			return;
+		installed = true;
+
+		GLCOUNTER_HOOK(glUseProgram, USE_PROGRAM);
+		GLCOUNTER_HOOK(glBindVertexArray, BIND_VERTEX_ARRAY);
+		GLCOUNTER_HOOK(glBindBuffer, BIND_BUFFER);
+		GLCOUNTER_HOOK(glBindBufferBase, BIND_BUFFER);
+		GLCOUNTER_HOOK(glBindBufferRange, BIND_BUFFER);
+		GLCOUNTER_HOOK(glBufferData, BUFFER_DATA);
+		GLCOUNTER_HOOK(glBufferSubData, BUFFER_DATA);
+		GLCOUNTER_HOOK(glActiveTexture, ACTIVE_TEXTURE);
+		GLCOUNTER_HOOK(glBindTexture, BIND_TEXTURE);
+		GLCOUNTER_HOOK(glGetUniformLocation, GET_UNIFORM_LOCATION);
+		GLCOUNTER_HOOK(glUniform1i, UNIFORM);
+		GLCOUNTER_HOOK(glUniform1f, UNIFORM);
+		GLCOUNTER_HOOK(glUniform3fv, UNIFORM);
+		GLCOUNTER_HOOK(glUniform4fv, UNIFORM);
+		GLCOUNTER_HOOK(glUniformMatrix4fv, UNIFORM);
+		GLCOUNTER_HOOK(glEnable, STATE);
+		GLCOUNTER_HOOK(glDisable, STATE);
+		GLCOUNTER_HOOK(glDepthFunc, STATE);
+		GLCOUNTER_HOOK(glStencilFunc, STATE);
+		GLCOUNTER_HOOK(glStencilMask, STATE);
+		GLCOUNTER_HOOK(glStencilOp, STATE);
+		GLCOUNTER_HOOK(glDrawArrays, DRAW);
+		GLCOUNTER_HOOK(glDrawElements, DRAW);
+		GLCOUNTER_HOOK(glDrawArraysInstanced, DRAW);
+		GLCOUNTER_HOOK(glDrawElementsBaseVertex, DRAW);
+		GLCOUNTER_HOOK(glMultiDrawElementsIndirect, DRAW);
+	}
+
+#undef GLCOUNTER_HOOK
+
+	void reset() {
+		for (int i = 0; i < CALL_COUNT; i++)
+			counts[i] = 0;
+	}
+
+	unsigned long long total() {
+		unsigned long long sum = 0;
+		for (int i = 0; i < CALL_COUNT; i++)
+			sum += counts[i];
+		return sum;
+	}
+
+	// Average calls per frame, skipping calls that never happened.
+	void print(int frames) {
+		for (int i = 0; i < CALL_COUNT; i++)
+			if (counts[i] > 0)
+				std::cout << "    " << callNames[i] << ": " << (double)counts[i] / frames << std::endl;
+		std::cout << "    total: " << (double)total() / frames << std::endl;
+	}
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+#include <glad/glad.h>
+
+/*
+* A shadow copy of the GL state the draw code changes. Each setter checks what was set last and only calls GL when
+* it's different, so draw helpers can set everything they need without caring what the one before left bound.
+* It starts out not knowing anything, the first call of each always goes through. Anything that changes this state
+* without going through here (a texture load binding its texture, say) has to be followed by invalidate().
+*/
+class GLState {
+	// Wider than any GL value so it can't clash with one, a mask of all ones included.
+	static const long long UNKNOWN = -1;
+	static const int TEXTURE_UNITS = 16;  // Units past this aren't tracked, their binds always go through.
+	static const int TEXTURE_TARGETS = 2;
+	static const int CAPABILITIES = 4;
+
+	long long program, vertexArray, activeUnit;
+	long long textures[TEXTURE_UNITS][TEXTURE_TARGETS];  // Binding of each unit, per targetIndex.
+	long long enabled[CAPABILITIES];    // 1 or 0, in the order of capabilityIndex.
+	long long depthFunction, stencilWriteMask;
+	long long stencilFunction, stencilRef, stencilReadMask;
+	long long stencilFail, depthFail, depthPass;
+
+	unsigned long long issued = 0, skipped = 0;
+
+	static int targetIndex(GLenum target) {
+		switch (target) {
+		case GL_TEXTURE_2D: return 0;
+		case GL_TEXTURE_CUBE_MAP: return 1;
+		default: return -1;
+		}
+	}
+
+	static int capabilityIndex(GLenum capability) {
+		switch (capability) {
+		case GL_DEPTH_TEST: return 0;
+		case GL_STENCIL_TEST: return 1;
+		case GL_BLEND: return 2;
+		case GL_CULL_FACE: return 3;
+		default: return -1;
+		}
+	}
+
+	// Counts the call and returns true if it needs to go to GL, updating the shadow if so.
+	bool change(long long &shadow, long long value) {
+		if (shadow == value) {
+			skipped++;
+			return false;
+		}
+		shadow = value;
+		issued++;
+		return true;
+	}
+
+public:
+	GLState() {
+		invalidate();
+	}
+
+	// Forget everything, the next call of each goes through. For after GL was changed behind our back.
+	void invalidate() {
+		program = vertexArray = activeUnit = UNKNOWN;
+		for (auto &unit : textures)
+			for (long long &texture : unit)
+				texture = UNKNOWN;
+		for (long long &flag : enabled)
+			flag = UNKNOWN;
+		depthFunction = stencilWriteMask = UNKNOWN;
+		stencilFunction = stencilRef = stencilReadMask = UNKNOWN;
+		stencilFail = depthFail = depthPass = UNKNOWN;
+	}
+
+	void useProgram(unsigned int id) {
+		if (change(program, id))
+			glUseProgram(id);
+	}
+
+	void bindVertexArray(unsigned int id) {
+		if (change(vertexArray, id))
+			glBindVertexArray(id);
+	}
+
+	// 'unit' is the index, not GL_TEXTURE0 + index.
+	void activeTexture(unsigned int unit) {
+		if (change(activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+	// Binds a texture to a unit, switching the active unit only if the texture isn't bound there already.
+	// 2D and cube map bindings are tracked, other targets always go through.
+	void bindTexture(unsigned int unit, unsigned int texture, GLenum target = GL_TEXTURE_2D) {
+		int index = targetIndex(target);
+		if (unit >= TEXTURE_UNITS || index < 0) {
+			activeTexture(unit);
+			glBindTexture(target, texture);
+			issued++;
+			return;
+		}
+		if (textures[unit][index] == texture) {
+			skipped++;
+			return;
+		}
+		activeTexture(unit);
+		textures[unit][index] = texture;
+		glBindTexture(target, texture);
+		issued++;
+	}
+
+	// Only the capabilities in capabilityIndex are tracked, others always go through.
+	void enable(GLenum capability) {
+		int index = capabilityIndex(capability);
+		if (index < 0)
+			issued++;
+		if (index < 0 || change(enabled[index], 1))
+			glEnable(capability);
+	}
+
+	void disable(GLenum capability) {
+		int index = capabilityIndex(capability);
+		if (index < 0)
+			issued++;
+		if (index < 0 || change(enabled[index], 0))
+			glDisable(capability);
+	}
+
+	void depthFunc(GLenum function) {
+		if (change(depthFunction, function))
+			glDepthFunc(function);
+	}
+
+	void stencilMask(unsigned int mask) {
+		if (change(stencilWriteMask, mask))
+			glStencilMask(mask);
+	}
+
+	void stencilFunc(GLenum function, int ref, unsigned int mask) {
+		if (stencilFunction == function && stencilRef == ref && stencilReadMask == mask) {
+			skipped++;
+			return;
+		}
+		stencilFunction = function;
+		stencilRef = ref;
+		stencilReadMask = mask;
+		glStencilFunc(function, ref, mask);
+		issued++;
+	}
+
+	void stencilOp(GLenum fail, GLenum zFail, GLenum zPass) {
+		if (stencilFail == fail && depthFail == zFail && depthPass == zPass) {
+			skipped++;
+			return;
+		}
+		stencilFail = fail;
+		depthFail = zFail;
+		depthPass = zPass;
+		glStencilOp(fail, zFail, zPass);
+		issued++;
+	}
+
+	// Calls that went to GL and calls that were dropped as redundant, since the start or resetCounts().
+	unsigned long long issuedCount() const {
+		return issued;
+	}
+
+	unsigned long long skippedCount() const {
+		return skipped;
+	}
+
+	void resetCounts() {
+		issued = skipped = 0;
+	}
+};
+
+#endif
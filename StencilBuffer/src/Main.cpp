@@ -9,17 +9,45 @@
 #include "ShaderProgram.h"
 #include "Texture.h"
 #include "Camera.h"
+#include "Frustum.h"
 #include "Constants.h"
+#include "UniformBlocks.h"
+#include "GLState.h"
+#include "RenderQueue.h"
+#include "CommandList.h"
+#include "Jobs.h"
+#include "GLCounter.h"
+#include "Timer.h"
+#include <random>
 
 const int WIDTH = 1200, HEIGHT = 1000;
 Camera camera(glm::vec3(0, 0.2f, 2.5f), glm::vec3(0, 1, 0));
 
-glm::mat4 projection = glm::perspective(45.0f, (float)WIDTH / (float)HEIGHT, 0.1f, 50.0f);
+const float FAR = 50.0f;
+glm::mat4 projection = glm::perspective(45.0f, (float)WIDTH / (float)HEIGHT, 0.1f, FAR);
 
 unsigned int cubeVAO, cubeVBO;
 unsigned int planeVAO, planeVBO;
 unsigned int program, outlineProgram;
 unsigned int marbleTexture, metalTexture;
+Frustum frustum;  // Rebuilt from the camera every frame, draws outside it are skipped.
+GLState glState;  // Draws set everything they need through this, it drops what's already set.
+
+// Draws are queued and sorted by key: pass first, then program and material (textures).
+RenderQueue queue;
+enum Pass {
+    SCENE_PASS,    // Normal scene without outlines
+    STENCIL_PASS,  // Things we'd like to outline, writing to the stencil buffer
+    OUTLINE_PASS   // Scaled up single colour versions, only where the stencil isn't set
+};
+enum ProgramId { TEXTURED_PROGRAM, OUTLINE_PROGRAM };
+enum MaterialId { METAL_MATERIAL, MARBLE_MATERIAL, NO_MATERIAL };
+
+// Every object's matrices for the frame, uploaded together before the first draw.
+ObjectUniforms objectUniforms;
+// Only for the benchmark: mvp set as a plain uniform on every draw, the way it was before the uniform blocks.
+bool plainUniforms = false;
+int mvpLocation, outlineMvpLocation;
 
 // ------------------- CALLBACKS -------------------
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -34,44 +62,442 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 }
 // --------------------------------------------------
 
-void drawPlane() {
-    glUseProgram(program);
-    glm::mat4 mvp = projection * camera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
-    glBindVertexArray(planeVAO);
+// Points the bound program at an object's matrices.
+void setObject(unsigned int object, int plainMvpLocation) {
+    if (plainUniforms)
+        glUniformMatrix4fv(plainMvpLocation, 1, GL_FALSE, &objectUniforms.get(object).mvp[0][0]);
+    else
+        objectUniforms.bind(object);
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, metalTexture);
-    glDrawArrays(GL_TRIANGLES, 0, sizeof(Constants::planeVerts) / sizeof(float));
-    glBindVertexArray(0);
+// 0 at the camera, 1 at the far plane, for the sort keys.
+float viewDepth(glm::vec3 position) {
+    return -(camera.getViewMatrix() * glm::vec4(position, 1.0f)).z / FAR;
 }
 
-void drawCube(glm::vec3 position) {
-    glUseProgram(program);
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);  // To avoid Z fighting
-    glm::mat4 mvp = projection * camera.getViewMatrix() * model;
-    glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
-    glBindVertexArray(cubeVAO);
+void drawPlane(unsigned int object) {
+    glm::vec3 centre(0.0f, -0.5f, 0.0f);
+    if (!frustum.containsBox(centre, glm::vec3(5.0f, 0.0f, 5.0f)))
+        return;
+    queue.submit(RenderQueue::opaqueKey(SCENE_PASS, TEXTURED_PROGRAM, METAL_MATERIAL, viewDepth(centre)),
+        { program, planeVAO, metalTexture, GL_TEXTURE_2D, 0, sizeof(Constants::planeVerts) / sizeof(float), object });
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, marbleTexture);
-    glDrawArrays(GL_TRIANGLES, 0, sizeof(Constants::cubeVerts) / sizeof(float));
-    glBindVertexArray(0);
+void drawCube(glm::vec3 position, unsigned int object) {
+    if (!frustum.containsBox(position, glm::vec3(0.5f)))
+        return;
+    queue.submit(RenderQueue::opaqueKey(STENCIL_PASS, TEXTURED_PROGRAM, MARBLE_MATERIAL, viewDepth(position)),
+        { program, cubeVAO, marbleTexture, GL_TEXTURE_2D, 0, sizeof(Constants::cubeVerts) / sizeof(float), object });
 }
 
-void drawScaledCube(glm::vec3 position, float scaleFactor=1.1f) {
-    glUseProgram(outlineProgram);
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), position) * 
-                      glm::scale(glm::mat4(1.0f), glm::vec3(scaleFactor, scaleFactor, scaleFactor));
-    glm::mat4 mvp = projection * camera.getViewMatrix() * model;
-    glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
-    glBindVertexArray(cubeVAO);
+void drawScaledCube(glm::vec3 position, unsigned int object, float scaleFactor=1.1f) {
+    if (!frustum.containsBox(position, glm::vec3(0.5f * scaleFactor)))
+        return;
+    queue.submit(RenderQueue::opaqueKey(OUTLINE_PASS, OUTLINE_PROGRAM, NO_MATERIAL, viewDepth(position)),
+        { outlineProgram, cubeVAO, 0, GL_TEXTURE_2D, 0, sizeof(Constants::cubeVerts) / sizeof(float), object });
+}
 
-    glDrawArrays(GL_TRIANGLES, 0, sizeof(Constants::cubeVerts) / sizeof(float));
-    glBindVertexArray(0);
+// Each pass sets all of the state it needs, any pass can be empty and skipped.
+void beginPass(unsigned int pass) {
+    switch (pass) {
+    case SCENE_PASS:
+        glState.disable(GL_STENCIL_TEST);
+        glState.depthFunc(GL_LESS);
+        break;
+    case STENCIL_PASS:
+        glState.enable(GL_STENCIL_TEST);
+        glState.stencilFunc(GL_ALWAYS, 1, 0xFF); // Always pass, write a 1 where our fragments are.
+        glState.stencilMask(0xFF); // Enable writing to stencil
+        glState.depthFunc(GL_LESS);
+        break;
+    case OUTLINE_PASS:
+        glState.enable(GL_STENCIL_TEST);
+        glState.stencilFunc(GL_NOTEQUAL, 1, 0xFF); // Only draw when stencil != 1
+        glState.stencilMask(0x00);
+        glState.depthFunc(GL_ALWAYS);  // Draw ontop of everything else
+        break;
+    }
 }
 
-int main(void)
+void drawScene(glm::vec3 const (&cubePositions)[2]) {
+    const float outlineScale = 1.1f;
+
+    // Matrices first, so they all go up in one upload.
+    glm::mat4 viewProjection = projection * camera.getViewMatrix();
+    objectUniforms.clear();
+    unsigned int plane = objectUniforms.push({ viewProjection, glm::mat4(1.0f) });
+    unsigned int cubes[2], outlines[2];
+    for (int i = 0; i < 2; i++) {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), cubePositions[i]);
+        cubes[i] = objectUniforms.push({ viewProjection * model, model });
+        model = model * glm::scale(glm::mat4(1.0f), glm::vec3(outlineScale));
+        outlines[i] = objectUniforms.push({ viewProjection * model, model });
+    }
+    if (!plainUniforms)
+        objectUniforms.upload();
+
+    // The order these are queued in doesn't matter, the passes keep the stencil steps in order.
+    queue.clear();
+    drawPlane(plane);
+    drawCube(cubePositions[0], cubes[0]);
+    drawCube(cubePositions[1], cubes[1]);
+    drawScaledCube(cubePositions[0], outlines[0], outlineScale);
+    drawScaledCube(cubePositions[1], outlines[1], outlineScale);
+    queue.sort();
+
+    glState.stencilMask(0xFF);  // allow glClear to write to the stencil buffer and clear it
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    glState.stencilOp(GL_KEEP, GL_REPLACE, GL_REPLACE); // Replace if stencil & depth test passes
+
+    queue.execute(glState, beginPass, [](DrawPacket const &packet) {
+        setObject(packet.object, packet.program == outlineProgram ? outlineMvpLocation : mvpLocation);
+    });
+
+    glState.depthFunc(GL_LESS); // Default depth testing
+    glState.disable(GL_STENCIL_TEST); // We're done with stencil test.
+}
+
+// Both programs with mvp as a plain uniform, for the benchmarks. Sets mvpLocation and outlineMvpLocation.
+bool loadPlainPrograms(unsigned int (&plainPrograms)[2]) {
+    std::vector<unsigned int> built = Shaders::loadPrograms({
+        Shaders::withDefines({ { GL_VERTEX_SHADER, "shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "shaders/shader.frag" } }, { "PLAIN_UNIFORMS" }),
+        Shaders::withDefines({ { GL_VERTEX_SHADER, "shaders/outline.vert" }, { GL_FRAGMENT_SHADER, "shaders/outline.frag" } }, { "PLAIN_UNIFORMS" }) });
+    if (built[0] == (unsigned int)-1 || built[1] == (unsigned int)-1)
+        return false;
+    plainPrograms[0] = built[0];
+    plainPrograms[1] = built[1];
+    glUseProgram(plainPrograms[0]);
+    glUniform1i(glGetUniformLocation(plainPrograms[0], "tex"), 0);
+    mvpLocation = glGetUniformLocation(plainPrograms[0], "mvp");
+    outlineMvpLocation = glGetUniformLocation(plainPrograms[1], "mvp");
+    glState.invalidate();
+    return true;
+}
+
+// 'StencilBuffer --bench blocks': GL calls per frame of the scene with mvp set as a uniform on every draw vs the
+// Object block. Expects the programs and objectUniforms to be set up.
+void uniformBlocksBenchmark(glm::vec3 const (&cubePositions)[2], int frames = 2000) {
+    unsigned int plainPrograms[2];
+    if (!loadPlainPrograms(plainPrograms))
+        return;
+
+    frustum = Frustum::fromMatrix(projection * camera.getViewMatrix());
+    GLCounter::install();
+    std::cout << "Stencil scene over " << frames << " frames (per frame)" << std::endl;
+
+    unsigned int blockPrograms[2] = { program, outlineProgram };
+    for (int blocks = 0; blocks <= 1; blocks++) {
+        plainUniforms = !blocks;
+        program = blocks ? blockPrograms[0] : plainPrograms[0];
+        outlineProgram = blocks ? blockPrograms[1] : plainPrograms[1];
+
+        drawScene(cubePositions);  // Warm up
+        glFinish();
+        GLCounter::reset();
+        Timer timer;
+        for (int f = 0; f < frames; f++)
+            drawScene(cubePositions);
+        double ms = timer.elapsedMs();
+        glFinish();
+
+        std::cout << "  " << (blocks ? "uniform blocks" : "plain uniforms") << ": " << ms / frames << " ms CPU" << std::endl;
+        GLCounter::print(frames);
+    }
+
+    glDeleteProgram(plainPrograms[0]);
+    glDeleteProgram(plainPrograms[1]);
+}
+
+// 'StencilBuffer --bench state': thousands of draws sharing the two programs, VAOs and textures, each setting all of
+// its state straight through GL vs through glState. Once in a random order and once in runs of 32 draws with the
+// same state, like a scene drawn object by object.
+void stateCacheBenchmark(int frames = 200, int drawCount = 10000) {
+    struct Draw {
+        unsigned int program, vao, texture;
+        int vertices;
+    };
+    unsigned int programs[2] = { program, outlineProgram };
+    unsigned int textures[2] = { marbleTexture, metalTexture };
+    unsigned int vaos[2] = { cubeVAO, planeVAO };
+    int vertices[2] = { sizeof(Constants::cubeVerts) / sizeof(float), sizeof(Constants::planeVerts) / sizeof(float) };
+
+    std::mt19937 random(1234);
+    std::vector<Draw> shuffled, grouped;
+    for (int i = 0; i < drawCount; i++) {
+        int shape = random() % 2;
+        shuffled.push_back({ programs[random() % 2], vaos[shape], textures[random() % 2], vertices[shape] });
+        int run = i / 32;
+        grouped.push_back({ programs[run % 2], vaos[run / 2 % 2], textures[run / 4 % 2], vertices[run / 2 % 2] });
+    }
+
+    // Every draw uses the same matrices, only the state changes matter here.
+    objectUniforms.clear();
+    objectUniforms.bind(objectUniforms.push({ projection * camera.getViewMatrix(), glm::mat4(1.0f) }));
+    objectUniforms.upload();
+    glDisable(GL_STENCIL_TEST);
+
+    GLCounter::install();
+    std::cout << drawCount << " draws over 2 programs, 2 VAOs and 2 textures, " << frames << " frames (per frame)" << std::endl;
+
+    std::vector<Draw> const *orders[2] = { &shuffled, &grouped };
+    for (std::vector<Draw> const *draws : orders) {
+        std::cout << (draws == &shuffled ? "random order" : "runs of 32") << std::endl;
+        for (int cached = 0; cached <= 1; cached++) {
+            auto drawFrame = [&]() {
+                for (Draw const &draw : *draws) {
+                    if (cached) {
+                        glState.useProgram(draw.program);
+                        glState.bindVertexArray(draw.vao);
+                        glState.bindTexture(0, draw.texture);
+                    }
+                    else {
+                        glUseProgram(draw.program);
+                        glBindVertexArray(draw.vao);
+                        glActiveTexture(GL_TEXTURE0);
+                        glBindTexture(GL_TEXTURE_2D, draw.texture);
+                    }
+                    glDrawArrays(GL_TRIANGLES, 0, draw.vertices);
+                }
+            };
+
+            glState.invalidate();
+            drawFrame();  // Warm up
+            glFinish();
+            GLCounter::reset();
+            glState.resetCounts();
+            Timer timer;
+            for (int f = 0; f < frames; f++)
+                drawFrame();
+            double ms = timer.elapsedMs();
+            glFinish();
+
+            std::cout << "  " << (cached ? "state cache" : "straight to GL") << ": " << ms / frames << " ms CPU" << std::endl;
+            GLCounter::print(frames);
+            if (cached)
+                std::cout << "    cache issued " << (double)glState.issuedCount() / frames << ", skipped "
+                    << (double)glState.skippedCount() / frames << std::endl;
+        }
+    }
+    glState.invalidate();
+}
+
+// 'StencilBuffer --bench queue': 50k packets over 2 programs, 2 VAOs and 16 textures, a tenth of them blended, run in
+// submission order vs sorted by key. Reports state changes (binds that got past glState) and the CPU time to build
+// the keys, sort and submit, with std::sort on the same keys for reference.
+void renderQueueBenchmark(int frames = 100, int packetCount = 50000) {
+    const int TEXTURES = 16;
+    unsigned int textures[TEXTURES];
+    glGenTextures(TEXTURES, textures);
+    for (int i = 0; i < TEXTURES; i++) {
+        unsigned char colour[4] = { (unsigned char)(i * 16), (unsigned char)(255 - i * 16), 128, 160 };
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, colour);
+    }
+
+    struct Object {
+        unsigned int program, vao;
+        int texture, vertices;
+        float depth;
+        bool blended;
+    };
+    unsigned int programs[2] = { program, outlineProgram };
+    unsigned int vaos[2] = { cubeVAO, planeVAO };
+    int vertices[2] = { sizeof(Constants::cubeVerts) / sizeof(float), sizeof(Constants::planeVerts) / sizeof(float) };
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> depths(0.0f, 1.0f);
+    std::vector<Object> scene;
+    for (int i = 0; i < packetCount; i++) {
+        int p = random() % 2, v = random() % 2;
+        scene.push_back({ programs[p], vaos[v], (int)(random() % TEXTURES), vertices[v], depths(random), random() % 10 == 0 });
+    }
+
+    // Every packet uses the same matrices, only the order and state changes matter here.
+    objectUniforms.clear();
+    objectUniforms.bind(objectUniforms.push({ projection * camera.getViewMatrix(), glm::mat4(1.0f) }));
+    objectUniforms.upload();
+    glState.disable(GL_STENCIL_TEST);
+
+    auto blendPass = [](unsigned int pass) {
+        if (pass == 1) {
+            glState.enable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
+        else
+            glState.disable(GL_BLEND);
+    };
+    auto noUniforms = [](DrawPacket const &) {};
+
+    GLCounter::install();
+    std::cout << packetCount << " packets over 2 programs, 2 VAOs and " << TEXTURES << " textures, " << frames << " frames (per frame)" << std::endl;
+
+    std::vector<uint64_t> keys;
+    for (int sorted = 0; sorted <= 1; sorted++) {
+        double build = 0, sort = 0, submit = 0, stdSort = 0;
+        unsigned long long changes = 0;
+        GLCounter::reset();
+        for (int f = 0; f < frames; f++) {
+            Timer timer;
+            queue.clear();
+            for (Object const &object : scene) {
+                int programId = object.program == outlineProgram;
+                uint64_t key = object.blended ? RenderQueue::blendedKey(1, programId, object.texture, object.depth)
+                    : RenderQueue::opaqueKey(0, programId, object.texture, object.depth);
+                queue.submit(key, { object.program, object.vao, textures[object.texture], GL_TEXTURE_2D, 0, object.vertices, 0 });
+            }
+            build += timer.elapsedMs();
+
+            if (sorted) {
+                timer.reset();
+                queue.sort();
+                sort += timer.elapsedMs();
+            }
+
+            glState.invalidate();
+            glState.resetCounts();
+            timer.reset();
+            queue.execute(glState, blendPass, noUniforms);
+            submit += timer.elapsedMs();
+            changes += glState.issuedCount();
+
+            if (sorted && f == 0) {
+                keys.clear();
+                for (Object const &object : scene)
+                    keys.push_back(object.blended ? RenderQueue::blendedKey(1, object.program == outlineProgram, object.texture, object.depth)
+                        : RenderQueue::opaqueKey(0, object.program == outlineProgram, object.texture, object.depth));
+                timer.reset();
+                std::sort(keys.begin(), keys.end());
+                stdSort = timer.elapsedMs();
+            }
+        }
+        glFinish();
+
+        std::cout << "  " << (sorted ? "sorted by key" : "submission order") << ": build " << build / frames << " ms, sort "
+            << sort / frames << " ms, submit " << submit / frames << " ms, " << (double)changes / frames << " state changes" << std::endl;
+        if (sorted)
+            std::cout << "    std::sort of the same keys: " << stdSort << " ms" << std::endl;
+        GLCounter::print(frames);
+    }
+
+    glState.disable(GL_BLEND);
+    glState.invalidate();
+    glDeleteTextures(TEXTURES, textures);
+}
+
+// 'StencilBuffer --bench commands': frame build time of a 100k object scene against thread count. Each frame culls
+// every object, works out its mvp and records its draw; with command lists the objects are split into LISTS chunks
+// recorded as jobs, then replayed in order on this thread. Inline does the same on one thread straight to GL.
+void commandListBenchmark(int frames = 20, int objectCount = 100000) {
+    const unsigned int LISTS = 256;
+    unsigned int plainPrograms[2];
+    if (!loadPlainPrograms(plainPrograms))
+        return;
+
+    struct Object {
+        glm::vec3 position;
+        float scale;
+        unsigned int program, vao, texture;
+        int mvpLocation, vertices;
+    };
+    unsigned int vaos[2] = { cubeVAO, planeVAO };
+    unsigned int textures[2] = { marbleTexture, metalTexture };
+    int vertices[2] = { sizeof(Constants::cubeVerts) / sizeof(float), sizeof(Constants::planeVerts) / sizeof(float) };
+    int locations[2] = { mvpLocation, outlineMvpLocation };
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> x(-40.0f, 40.0f), y(-5.0f, 5.0f), z(-60.0f, 2.0f), scale(0.05f, 0.3f);
+    std::vector<Object> scene;
+    for (int i = 0; i < objectCount; i++) {
+        int p = random() % 2, v = random() % 2;
+        scene.push_back({ glm::vec3(x(random), y(random), z(random)), scale(random), plainPrograms[p], vaos[v], textures[random() % 2], locations[p], vertices[v] });
+    }
+
+    glm::mat4 viewProjection = projection * camera.getViewMatrix();
+    Frustum sceneFrustum = Frustum::fromMatrix(viewProjection);
+    glState.disable(GL_STENCIL_TEST);
+
+    // What an object needs this frame: skipped if it's outside the view, otherwise its mvp.
+    auto visible = [&](Object const &object, glm::mat4 &mvp) {
+        if (!sceneFrustum.containsBox(object.position, glm::vec3(5.0f * object.scale)))
+            return false;
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), object.position) * glm::scale(glm::mat4(1.0f), glm::vec3(object.scale));
+        mvp = viewProjection * model;
+        return true;
+    };
+
+    std::cout << objectCount << " objects, " << LISTS << " command lists, " << frames << " frames (per frame)" << std::endl;
+
+    // One thread, no lists: the way the samples draw.
+    double inline_ = 0;
+    unsigned int drawn = 0;
+    for (int f = 0; f < frames; f++) {
+        glState.invalidate();
+        Timer timer;
+        drawn = 0;
+        for (Object const &object : scene) {
+            glm::mat4 mvp;
+            if (!visible(object, mvp))
+                continue;
+            glState.useProgram(object.program);
+            glState.bindVertexArray(object.vao);
+            glState.bindTexture(0, object.texture);
+            glUniformMatrix4fv(object.mvpLocation, 1, GL_FALSE, &mvp[0][0]);
+            glDrawArrays(GL_TRIANGLES, 0, object.vertices);
+            drawn++;
+        }
+        inline_ += timer.elapsedMs();
+    }
+    glFinish();
+    std::cout << "  inline: " << inline_ / frames << " ms (" << drawn << " draws)" << std::endl;
+
+    std::vector<CommandList> lists(LISTS);
+    unsigned int chunkSize = (objectCount + LISTS - 1) / LISTS;
+    double singleThreaded = 0;
+    unsigned int maxThreads = Jobs::defaultThreads();
+    for (unsigned int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2) {
+        Jobs::Scheduler jobs(threads);
+        double record = 0, replay = 0;
+        size_t bytes = 0;
+        for (int f = 0; f < frames; f++) {
+            Timer timer;
+            jobs.forEach(LISTS, [&](unsigned int l) {
+                CommandList &list = lists[l];
+                list.reset();
+                unsigned int end = std::min((l + 1) * chunkSize, (unsigned int)objectCount);
+                for (unsigned int i = l * chunkSize; i < end; i++) {
+                    glm::mat4 mvp;
+                    if (!visible(scene[i], mvp))
+                        continue;
+                    list.useProgram(scene[i].program);
+                    list.bindVertexArray(scene[i].vao);
+                    list.bindTexture(0, scene[i].texture);
+                    list.uniformMatrix4(scene[i].mvpLocation, mvp);
+                    list.drawArrays(GL_TRIANGLES, 0, scene[i].vertices);
+                }
+            }, 1);
+            record += timer.elapsedMs();
+
+            glState.invalidate();
+            timer.reset();
+            for (CommandList const &list : lists)
+                list.replay(glState);
+            replay += timer.elapsedMs();
+        }
+        glFinish();
+
+        for (CommandList const &list : lists)
+            bytes += list.size();
+        if (threads == 1)
+            singleThreaded = record;
+        std::cout << "  " << threads << " threads: record " << record / frames << " ms (" << singleThreaded / record << "x), replay "
+            << replay / frames << " ms, frame " << (record + replay) / frames << " ms, " << bytes / 1024 << " KB recorded" << std::endl;
+    }
+
+    glState.invalidate();
+    glDeleteProgram(plainPrograms[0]);
+    glDeleteProgram(plainPrograms[1]);
+}
+
+int main(int argc, char** argv)
 {
     GLFWwindow* window;
 
@@ -131,18 +557,16 @@ int main(void)
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    // Shader init
-    unsigned int vShader = Shaders::createShader(GL_VERTEX_SHADER, "shaders/shader.vert");
-    unsigned int fShader = Shaders::createShader(GL_FRAGMENT_SHADER, "shaders/shader.frag");
-    program = Shaders::createAndLinkProgram({ vShader, fShader });
-    glDeleteShader(vShader);
-    glDeleteShader(fShader);
-
-    vShader = Shaders::createShader(GL_VERTEX_SHADER, "shaders/outline.vert");
-    fShader = Shaders::createShader(GL_FRAGMENT_SHADER, "shaders/outline.frag");
-    outlineProgram = Shaders::createAndLinkProgram({ vShader, fShader });
-    glDeleteShader(vShader);
-    glDeleteShader(fShader);
+    // Shader init, both programs in one batch so their compiles overlap.
+    std::vector<unsigned int> programs = Shaders::loadPrograms({
+        { { GL_VERTEX_SHADER, "shaders/shader.vert" }, { GL_FRAGMENT_SHADER, "shaders/shader.frag" } },
+        { { GL_VERTEX_SHADER, "shaders/outline.vert" }, { GL_FRAGMENT_SHADER, "shaders/outline.frag" } } });
+    program = programs[0];
+    outlineProgram = programs[1];
+    // Both read their matrices from the Object block.
+    UniformBlocks::bindBlocks(program);
+    UniformBlocks::bindBlocks(outlineProgram);
+    objectUniforms.create();
 
     //Texture init
     marbleTexture = Texture::load("assets/marble.jpg", GL_RGB);
@@ -150,44 +574,38 @@ int main(void)
     glUseProgram(program);
     glUniform1i(glGetUniformLocation(program, "tex"), 0);
 
-    glm::vec3 cube1Pos = glm::vec3(0.0f, 0.2f, 0.0f);
-    glm::vec3 cube2Pos = glm::vec3(1.0f, 0.2f, 3.0f);
+    glm::vec3 cubePositions[2] = { glm::vec3(0.0f, 0.2f, 0.0f), glm::vec3(1.0f, 0.2f, 3.0f) };
 
-    // Render loop
     glClearColor(0.06f, 0.07f, 0.08f, 1.0f);
+
+    // 'StencilBuffer --bench <blocks|state|queue|commands>' runs a benchmark instead of the scene.
+    if (argc > 2 && std::string(argv[1]) == "--bench") {
+        std::string name = argv[2];
+        if (name == "blocks")
+            uniformBlocksBenchmark(cubePositions);
+        else if (name == "state")
+            stateCacheBenchmark();
+        else if (name == "queue")
+            renderQueueBenchmark();
+        else if (name == "commands")
+            commandListBenchmark();
+        else {
+            std::cout << "Unknown benchmark '" << name << "'" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwTerminate();
+        return 0;
+    }
+
+    // Render loop
     while (!glfwWindowShouldClose(window))
     {
         glfwPollEvents();
 
         camera.update(window);
-
-        glStencilMask(0xFF);  // allow glClear to write to the stencil buffer and clear it
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-        glStencilOp(GL_KEEP, GL_REPLACE, GL_REPLACE); // Replace if stencil & depth test passes
-
-        // Normal scene without outlines
-        drawPlane();
-
-        // 1st render pass:
-        // Draw out things we'd like to outline and write to stencil buffer
-        // ------------------------------------------------------------------------------
-        glEnable(GL_STENCIL_TEST);
-        glStencilFunc(GL_ALWAYS, 1, 0xFF); // Always pass, write a 1 where our fragments are.
-        glStencilMask(0xFF); // Enable writing to stencil
-        drawCube(cube1Pos);
-        drawCube(cube2Pos);
-        glStencilMask(0x00);
-
-        // 2nd render pass:
-        // Draw scaled up single-colour version of cubes, do not draw on top of stencil buffer.
-        // ------------------------------------------------------------------------------
-        glStencilFunc(GL_NOTEQUAL, 1, 0xFF); // Only draw when stencil != 1
-        glDepthFunc(GL_ALWAYS);  // Draw ontop of everything else
-        drawScaledCube(cube1Pos);
-        drawScaledCube(cube2Pos);
-        glDepthFunc(GL_LESS); // Default depth testing
-
-        glDisable(GL_STENCIL_TEST); // We're done with stencil test.
+        frustum = Frustum::fromMatrix(projection * camera.getViewMatrix());
+        drawScene(cubePositions);
 
         glfwSwapBuffers(window);
     }
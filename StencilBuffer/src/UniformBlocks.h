@@ -0,0 +1,138 @@
+#ifndef UNIFORMBLOCKS_H
+#define UNIFORMBLOCKS_H
+#include <glad/glad.h>
+#include <cstring>
+#include <vector>
+#include <glm/glm.hpp>
+
+/*
+* std140 uniform blocks shared by every program. Data that's the same for the whole frame (camera, light) goes in
+* the Frame block, written once a frame and bound once. Data per object (its matrices) goes in the Object block,
+* which every object of the frame shares: they're packed into one big buffer, uploaded in one go, and each draw
+* binds its slice with glBindBufferRange. Programs only need bindBlocks() once after linking.
+*/
+namespace UniformBlocks {
+	// Binding points, the same in every program.
+	enum Binding {
+		FRAME_BINDING = 0,
+		OBJECT_BINDING = 1
+	};
+
+	// Has to match 'uniform Frame' in the shaders. vec3s are padded to 16 bytes by std140.
+	struct FrameData {
+		glm::mat4 view;
+		glm::mat4 projection;
+		glm::mat4 viewProjection;
+		glm::vec3 viewPos;
+		float pad0;
+		glm::vec3 lightDir;
+		float pad1;
+		glm::vec3 lightColor;
+		float pad2;
+	};
+
+	// Has to match 'uniform Object' in the shaders.
+	struct ObjectData {
+		glm::mat4 mvp;
+		glm::mat4 model;
+	};
+
+	static_assert(sizeof(FrameData) == 240, "FrameData doesn't match the std140 layout");
+	static_assert(sizeof(ObjectData) == 128, "ObjectData doesn't match the std140 layout");
+
+	// Points the program's Frame and Object blocks at the shared binding points, skipping any it doesn't have.
+	void bindBlocks(unsigned int program) {
+		unsigned int frame = glGetUniformBlockIndex(program, "Frame");
+		if (frame != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, frame, FRAME_BINDING);
+		unsigned int object = glGetUniformBlockIndex(program, "Object");
+		if (object != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, object, OBJECT_BINDING);
+	}
+}
+
+// The Frame block. Bound for good by create(), update() is one upload a frame whatever the number of programs.
+class FrameUniforms {
+	unsigned int buffer = 0;
+public:
+	void create() {
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBlocks::FrameData), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, UniformBlocks::FRAME_BINDING, buffer);
+	}
+
+	void update(UniformBlocks::FrameData const &data) {
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+	}
+
+	void destroy() {
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+};
+
+/*
+* The Object blocks of a frame. clear() at the start of the frame, push() each object, upload() once they're all
+* in, then bind() an object before its draws. Slots are spaced by GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT so any of them
+* can be bound. Every upload respecifies the buffer, so a frame never waits for the GPU to finish reading the last one.
+*/
+class ObjectUniforms {
+	unsigned int buffer = 0;
+	size_t stride = 0;
+	std::vector<unsigned char> staging;
+	unsigned int count = 0;
+public:
+	// 'objects' is only a first guess, push() makes room for more.
+	void create(unsigned int objects = 64) {
+		int alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		stride = (sizeof(UniformBlocks::ObjectData) + alignment - 1) / alignment * alignment;
+		staging.resize(objects * stride);
+		glGenBuffers(1, &buffer);
+		count = 0;
+	}
+
+	void clear() {
+		count = 0;
+	}
+
+	// Returns the object's slot, for bind().
+	unsigned int push(UniformBlocks::ObjectData const &data) {
+		if ((count + 1) * stride > staging.size())
+			staging.resize(staging.size() * 2 + stride);
+		std::memcpy(&staging[count * stride], &data, sizeof(data));
+		return count++;
+	}
+
+	UniformBlocks::ObjectData const &get(unsigned int slot) const {
+		return *(const UniformBlocks::ObjectData*)&staging[slot * stride];
+	}
+
+	// Sends every object pushed this frame in one upload.
+	void upload() {
+		if (count == 0)
+			return;
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, count * stride, staging.data(), GL_STREAM_DRAW);
+	}
+
+	void bind(unsigned int slot) {
+		glBindBufferRange(GL_UNIFORM_BUFFER, UniformBlocks::OBJECT_BINDING, buffer, slot * stride, sizeof(UniformBlocks::ObjectData));
+	}
+
+	unsigned int size() const {
+		return count;
+	}
+
+	void destroy() {
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+		staging.clear();
+		count = 0;
+	}
+};
+
+#endif
@@ -92,11 +92,7 @@ int main(void)
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
     // -------- SHADERS ---------
-    unsigned int vertexShader = Shaders::createShader(GL_VERTEX_SHADER, "shaders/texture.vert");
-    unsigned int fragmentShader = Shaders::createShader(GL_FRAGMENT_SHADER, "shaders/texture.frag");
-    unsigned int program = Shaders::createAndLinkProgram({ vertexShader, fragmentShader });
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    unsigned int program = Shaders::loadProgram({ { GL_VERTEX_SHADER, "shaders/texture.vert" }, { GL_FRAGMENT_SHADER, "shaders/texture.frag" } });
 
     // -------- TEXTURES ----------
     unsigned int containerTexture = loadTexture("assets/container.jpg", GL_RGB);